@@ -0,0 +1,50 @@
+#pragma once
+
+// shared helpers for the benchmark programs
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+
+static inline uint64_t bench_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// process cpu time (user + sys) in ns
+static inline uint64_t bench_cpu_ns() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+// looks for --name=value, returns def if missing
+static inline const char *bench_arg(int argc, char **argv, const char *name, const char *def) {
+    size_t len = strlen(name);
+    for (int i = 1; i < argc; i++)
+        if (strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+    return def;
+}
+
+static inline long bench_arg(int argc, char **argv, const char *name, long def) {
+    const char *v = bench_arg(argc, argv, name, (const char *) nullptr);
+    return v ? strtol(v, nullptr, 10) : def;
+}
+
+static inline double bench_arg(int argc, char **argv, const char *name, double def) {
+    const char *v = bench_arg(argc, argv, name, (const char *) nullptr);
+    return v ? strtod(v, nullptr) : def;
+}
+
+// sorts in place, q in [0, 1]
+static inline uint64_t bench_percentile(std::vector<uint64_t> &v, double q) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t) (q * (double) (v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
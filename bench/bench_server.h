@@ -0,0 +1,486 @@
+#pragma once
+
+/*
+ * Loopback HTTP/1.1 stand-in server for the benchmarks.
+ * One epoll thread per server, responses are prebuilt at start.
+ *
+ * A request can override the configured delay with a ?d=<us> query parameter.
+ * Connections are kept until the client closes them, snowhttp closes after every response.
+ *
+ * With tls set connections go through a non-blocking wolfSSL_accept first, the default
+ * certificate paths are the ECC ones of the wolfSSL source tree, relative to the repo root.
+ *
+ * With h2 set the server offers h2 over ALPN, connections starting with the HTTP/2 preface get one response per
+ * stream, HPACK through lib/http2.h. Flow control is not enforced, bodies have to fit the client's stream window,
+ * and a delay holds all of the connection's pending responses.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "wolfssl/options.h"
+#include "wolfssl/wolfcrypt/settings.h"
+#include "wolfssl/ssl.h"
+
+#include "../lib/http2.h"
+
+struct bench_server_t {
+    int port = 0; // 0 - pick a free one, filled in by bench_server_start
+    size_t bodySize = 64;
+    bool chunked = false;
+    size_t chunkSize = 4096;
+    int delayUs = 0;
+    bool reusePort = false; // SO_REUSEPORT, several servers share one port
+
+    bool tls = false;
+    bool h2 = false;
+    const char *certFile = "lib/wolf/wolfssl/certs/server-ecc.pem";
+    const char *keyFile = "lib/wolf/wolfssl/certs/ecc-key.pem";
+    WOLFSSL_CTX *ctx = nullptr;
+
+    int listenFd = -1;
+    int pfd = -1;
+    std::atomic<bool> stop = false;
+    std::thread thread;
+    std::string response;
+    std::string h2Headers; // HPACK block of the response headers, not indexed so it fits every connection
+};
+
+struct bench_server_h2_t {
+    std::string in, out; // frames, out takes the place of bench_server_t::response
+    snow_hpack_table_t decoder;
+    bool preface = false;
+};
+
+struct bench_server_conn_t {
+    char req[4096];
+    size_t reqLen = 0;
+    size_t sent = 0; // bytes of the response already written
+    uint64_t due = 0; // ns, 0 - not pending
+    bool responding = false;
+    WOLFSSL *ssl = nullptr;
+    bool handshaking = false;
+    std::unique_ptr<bench_server_h2_t> h2; // from the preface on
+};
+
+static inline uint64_t bench_server_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static inline void bench_server_ctl(bench_server_t *srv, int op, int fd, uint32_t events) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(srv->pfd, op, fd, &ev);
+}
+
+static inline void bench_server_build(bench_server_t *srv) {
+    std::string body(srv->bodySize, 'x');
+    char header[256];
+
+    if (srv->chunked && !srv->h2) { // HTTP/2 has its own framing
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n");
+        srv->response = header;
+        for (size_t off = 0; off < body.size(); off += srv->chunkSize) {
+            size_t len = std::min(srv->chunkSize, body.size() - off);
+            snprintf(header, sizeof(header), "%zx\r\n", len);
+            srv->response += header;
+            srv->response.append(body, off, len);
+            srv->response += "\r\n";
+        }
+        srv->response += "0\r\n\r\n";
+    } else {
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", body.size());
+        srv->response = header + body;
+    }
+
+    if (srv->h2) {
+        char block[256], length[32], *it = block;
+        snow_hpack_table_t table;
+        snprintf(length, sizeof(length), "%zu", body.size());
+        it = snow_hpack_encode(&table, it, ":status", 7, "200", 3, HPACK_NOT_INDEXED);
+        it = snow_hpack_encode(&table, it, "content-type", 12, "text/plain", 10, HPACK_NOT_INDEXED);
+        it = snow_hpack_encode(&table, it, "content-length", 14, length, strlen(length), HPACK_NOT_INDEXED);
+        srv->h2Headers.assign(block, it - block);
+    }
+}
+
+// bytes read, 0 - closed or failed, -1 - would block
+static inline ssize_t bench_server_recv(int fd, bench_server_conn_t *c, char *buf, size_t len) {
+    if (c->ssl) {
+        int ret = wolfSSL_read(c->ssl, buf, (int) len);
+        if (ret > 0) return ret;
+        int err = wolfSSL_get_error(c->ssl, ret);
+        return err == WOLFSSL_ERROR_WANT_READ || err == WOLFSSL_ERROR_WANT_WRITE ? -1 : 0;
+    }
+
+    ssize_t ret;
+    while ((ret = read(fd, buf, len)) < 0 && errno == EINTR);
+    if (ret < 0) return errno == EAGAIN ? -1 : 0;
+    return ret;
+}
+
+// bytes written, 0 - failed, -1 - would block
+static inline ssize_t bench_server_send(int fd, bench_server_conn_t *c, const char *buf, size_t len) {
+    if (c->ssl) {
+        int ret = wolfSSL_write(c->ssl, buf, (int) len);
+        if (ret > 0) return ret;
+        int err = wolfSSL_get_error(c->ssl, ret);
+        return err == WOLFSSL_ERROR_WANT_READ || err == WOLFSSL_ERROR_WANT_WRITE ? -1 : 0;
+    }
+
+    ssize_t ret;
+    while ((ret = write(fd, buf, len)) < 0 && errno == EINTR);
+    if (ret < 0) return errno == EAGAIN ? -1 : 0;
+    return ret;
+}
+
+// returns false once the connection should be closed
+static inline bool bench_server_write(bench_server_t *srv, int fd, bench_server_conn_t *c) {
+    const std::string &out = c->h2 ? c->h2->out : srv->response;
+    while (c->sent < out.size()) {
+        ssize_t ret = bench_server_send(fd, c, out.data() + c->sent, out.size() - c->sent);
+        if (ret == 0) return false;
+        if (ret < 0) {
+            bench_server_ctl(srv, EPOLL_CTL_MOD, fd, EPOLLIN | EPOLLOUT);
+            return true;
+        }
+        c->sent += ret;
+    }
+    if (c->h2) {
+        c->h2->out.clear();
+        c->sent = 0;
+    }
+    c->responding = false;
+    return true;
+}
+
+static inline void bench_server_h2_frame(bench_server_conn_t *c, int type, int flags, uint32_t streamId, const char *payload, size_t len) {
+    char header[h2FrameHeaderSize];
+    snow_h2_frameHeader(header, len, type, flags, streamId);
+    c->h2->out.append(header, sizeof(header));
+    c->h2->out.append(payload, len);
+}
+
+// handles the complete frames read so far, returns false once the connection should be closed,
+// *delayUs is set to the largest ?d= of the new requests
+static inline bool bench_server_h2_process(bench_server_t *srv, bench_server_conn_t *c, int *delayUs) {
+    bench_server_h2_t *h2 = c->h2.get();
+    size_t at = 0;
+
+    if (!h2->preface) {
+        if (h2->in.size() < sizeof(h2Preface) - 1) return true;
+        if (h2->in.compare(0, sizeof(h2Preface) - 1, h2Preface) != 0) return false;
+        at = sizeof(h2Preface) - 1;
+        h2->preface = true;
+
+        char settings[6] = {0, H2_MAX_CONCURRENT_STREAMS};
+        snow_h2_write32(settings + 2, 100);
+        bench_server_h2_frame(c, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    }
+
+    while (h2->in.size() - at >= h2FrameHeaderSize) {
+        auto *frame = (const uint8_t *) h2->in.data() + at;
+        size_t len = frame[0] << 16U | frame[1] << 8U | frame[2];
+        if (h2->in.size() - at < h2FrameHeaderSize + len) break;
+
+        int type = frame[3], flags = frame[4];
+        uint32_t streamId = snow_h2_read32(frame + 5) & 0x7fffffffU;
+        const uint8_t *payload = frame + h2FrameHeaderSize, *end = payload + len;
+        at += h2FrameHeaderSize + len;
+
+        if (type == H2_SETTINGS && !(flags & H2_ACK)) bench_server_h2_frame(c, H2_SETTINGS, H2_ACK, 0, nullptr, 0);
+        else if (type == H2_PING && !(flags & H2_ACK)) bench_server_h2_frame(c, H2_PING, H2_ACK, 0, (const char *) payload, len);
+        else if (type == H2_GOAWAY) return false;
+        else if (type == H2_HEADERS) { // snowhttp sends a request's headers in one frame
+            if (flags & H2_PADDED) end -= *payload++;
+            if (flags & H2_PRIORITY_FLAG) payload += 5;
+
+            char scratch[4096];
+            int requestDelay = srv->delayUs;
+            bool valid = snow_hpack_decode(&h2->decoder, payload, end, scratch, sizeof(scratch),
+                                           [&](const char *name, size_t nameLen, const char *value, size_t valueLen) {
+                if (nameLen != 5 || memcmp(name, ":path", 5) != 0) return;
+                std::string path(value, valueLen);
+                size_t d = path.find("d=");
+                if (d != std::string::npos && d > 0 && (path[d - 1] == '?' || path[d - 1] == '&')) requestDelay = atoi(path.c_str() + d + 2);
+            });
+            if (!valid || !(flags & H2_END_HEADERS)) return false;
+            *delayUs = std::max(*delayUs, requestDelay);
+
+            const std::string &body = srv->response; // the HTTP/1.1 response, the body is at its end
+            size_t bodyLen = srv->bodySize, off = body.size() - bodyLen;
+            bench_server_h2_frame(c, H2_HEADERS, H2_END_HEADERS | (bodyLen ? 0 : H2_END_STREAM), streamId, srv->h2Headers.data(),
+                                  srv->h2Headers.size());
+            for (size_t sent = 0; sent < bodyLen; sent += h2MaxFrameSize) {
+                size_t n = std::min<size_t>(h2MaxFrameSize, bodyLen - sent);
+                bench_server_h2_frame(c, H2_DATA, sent + n == bodyLen ? H2_END_STREAM : 0, streamId, body.data() + off + sent, n);
+            }
+        }
+    }
+
+    h2->in.erase(0, at);
+    return true;
+}
+
+static inline void bench_server_close(bench_server_t *srv, int fd, std::vector<bench_server_conn_t> &conns) {
+    epoll_ctl(srv->pfd, EPOLL_CTL_DEL, fd, nullptr);
+    if (conns[fd].ssl) wolfSSL_free(conns[fd].ssl);
+    close(fd);
+    conns[fd] = bench_server_conn_t();
+}
+
+// returns false once the connection should be closed, c->handshaking is cleared when done
+static inline bool bench_server_accept_tls(bench_server_t *srv, int fd, bench_server_conn_t *c) {
+    int ret = wolfSSL_accept(c->ssl);
+    if (ret == SSL_SUCCESS) {
+        c->handshaking = false;
+        bench_server_ctl(srv, EPOLL_CTL_MOD, fd, EPOLLIN);
+        return true;
+    }
+
+    int err = wolfSSL_get_error(c->ssl, ret);
+    if (err == WOLFSSL_ERROR_WANT_READ) bench_server_ctl(srv, EPOLL_CTL_MOD, fd, EPOLLIN);
+    else if (err == WOLFSSL_ERROR_WANT_WRITE) bench_server_ctl(srv, EPOLL_CTL_MOD, fd, EPOLLIN | EPOLLOUT);
+    else return false;
+    return true;
+}
+
+static inline void bench_server_run(bench_server_t *srv) {
+    std::vector<bench_server_conn_t> conns(1024); // indexed by fd, grows with the highest fd
+    std::vector<int> pending;
+    struct epoll_event events[256];
+
+    while (!srv->stop.load(std::memory_order_relaxed)) {
+        uint64_t now = bench_server_now_ns();
+        int timeout = 1;
+
+        for (size_t i = 0; i < pending.size();) { // delayed responses that are due
+            int fd = pending[i];
+            if (conns[fd].due <= now) {
+                conns[fd].due = 0;
+                if (!bench_server_write(srv, fd, &conns[fd])) bench_server_close(srv, fd, conns);
+                pending[i] = pending.back();
+                pending.pop_back();
+            } else i++;
+        }
+        if (!pending.empty()) timeout = 0;
+
+        int n = epoll_wait(srv->pfd, events, 256, timeout);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == srv->listenFd) {
+                int cfd;
+                while ((cfd = accept4(srv->listenFd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    int one = 1;
+                    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    if ((size_t) cfd >= conns.size()) conns.resize(cfd * 2);
+                    bench_server_ctl(srv, EPOLL_CTL_ADD, cfd, EPOLLIN);
+                    conns[cfd] = bench_server_conn_t();
+
+                    if (srv->ctx) {
+                        conns[cfd].ssl = wolfSSL_new(srv->ctx);
+                        if (conns[cfd].ssl == nullptr) {
+                            bench_server_close(srv, cfd, conns);
+                            continue;
+                        }
+                        wolfSSL_set_fd(conns[cfd].ssl, cfd);
+                        wolfSSL_set_using_nonblock(conns[cfd].ssl, 1);
+                        if (srv->h2) wolfSSL_UseALPN(conns[cfd].ssl, (char *) "h2", 2, WOLFSSL_ALPN_CONTINUE_ON_MISMATCH);
+                        conns[cfd].handshaking = true;
+                    }
+                }
+                continue;
+            }
+
+            bench_server_conn_t *c = &conns[fd];
+
+            if (c->handshaking) {
+                if (!bench_server_accept_tls(srv, fd, c)) {
+                    bench_server_close(srv, fd, conns);
+                    continue;
+                }
+                if (c->handshaking) continue;
+                // the request can already sit in wolfSSL's buffer, read right away
+            }
+
+            if (events[i].events & EPOLLOUT && c->responding) {
+                if (!bench_server_write(srv, fd, c)) {
+                    bench_server_close(srv, fd, conns);
+                    continue;
+                }
+                if (!c->responding) bench_server_ctl(srv, EPOLL_CTL_MOD, fd, EPOLLIN);
+            }
+
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c->ssl) continue;
+
+            ssize_t ret = bench_server_recv(fd, c, c->req + c->reqLen, sizeof(c->req) - 1 - c->reqLen);
+            if (ret <= 0) {
+                if (ret < 0) continue;
+                if (c->due) pending.erase(std::find(pending.begin(), pending.end(), fd));
+                bench_server_close(srv, fd, conns);
+                continue;
+            }
+            c->reqLen += ret;
+            c->req[c->reqLen] = 0;
+
+            if (srv->h2 && !c->h2 && c->reqLen >= 3 && memcmp(c->req, "PRI", 3) == 0) c->h2.reset(new bench_server_h2_t());
+            if (c->h2) {
+                c->h2->in.append(c->req, c->reqLen);
+                c->reqLen = 0;
+
+                int delayUs = 0;
+                if (!bench_server_h2_process(srv, c, &delayUs)) {
+                    if (c->due) pending.erase(std::find(pending.begin(), pending.end(), fd));
+                    bench_server_close(srv, fd, conns);
+                    continue;
+                }
+                if (c->h2->out.empty() || c->responding) continue; // an earlier write is still going out, it takes the new frames too
+
+                c->responding = true;
+                if (delayUs > 0) {
+                    c->due = bench_server_now_ns() + delayUs * 1000ULL;
+                    pending.push_back(fd);
+                } else if (!bench_server_write(srv, fd, c)) bench_server_close(srv, fd, conns);
+                continue;
+            }
+
+            if (!strstr(c->req, "\r\n\r\n")) {
+                if (c->reqLen == sizeof(c->req) - 1) bench_server_close(srv, fd, conns);
+                continue;
+            }
+
+            int delayUs = srv->delayUs;
+            char *lineEnd = strstr(c->req, "\r\n");
+            char *d = strstr(c->req, "d=");
+            if (d && d < lineEnd && (d[-1] == '?' || d[-1] == '&')) delayUs = atoi(d + 2);
+
+            c->reqLen = 0;
+            c->sent = 0;
+            c->responding = true;
+
+            if (delayUs > 0) {
+                c->due = bench_server_now_ns() + delayUs * 1000ULL;
+                pending.push_back(fd);
+            } else if (!bench_server_write(srv, fd, c)) bench_server_close(srv, fd, conns);
+        }
+    }
+
+    for (bench_server_conn_t &c : conns)
+        if (c.ssl) wolfSSL_free(c.ssl);
+}
+
+// binds 127.0.0.1:port and starts the server thread, returns false on failure
+static inline bool bench_server_start(bench_server_t *srv) {
+    bench_server_build(srv);
+
+    if (srv->tls) {
+        wolfSSL_Init();
+        srv->ctx = wolfSSL_CTX_new(wolfSSLv23_server_method());
+        if (srv->ctx == nullptr ||
+            wolfSSL_CTX_use_certificate_file(srv->ctx, srv->certFile, SSL_FILETYPE_PEM) != SSL_SUCCESS ||
+            wolfSSL_CTX_use_PrivateKey_file(srv->ctx, srv->keyFile, SSL_FILETYPE_PEM) != SSL_SUCCESS) {
+            fprintf(stderr, "could not load %s / %s\n", srv->certFile, srv->keyFile);
+            if (srv->ctx) wolfSSL_CTX_free(srv->ctx);
+            srv->ctx = nullptr;
+            return false;
+        }
+    }
+
+    srv->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(srv->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (srv->reusePort) setsockopt(srv->listenFd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(srv->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(srv->listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(srv->listenFd, 4096) != 0) {
+        close(srv->listenFd);
+        if (srv->ctx) wolfSSL_CTX_free(srv->ctx);
+        srv->ctx = nullptr;
+        return false;
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(srv->listenFd, (struct sockaddr *) &addr, &len);
+    srv->port = ntohs(addr.sin_port);
+
+    srv->pfd = epoll_create1(0);
+    bench_server_ctl(srv, EPOLL_CTL_ADD, srv->listenFd, EPOLLIN);
+
+    srv->thread = std::thread(bench_server_run, srv);
+    return true;
+}
+
+static inline void bench_server_stop(bench_server_t *srv) {
+    srv->stop = true;
+    srv->thread.join();
+    close(srv->pfd);
+    close(srv->listenFd);
+    if (srv->ctx) wolfSSL_CTX_free(srv->ctx);
+    srv->ctx = nullptr;
+}
+
+/*
+ * Starts n servers sharing one port (SO_REUSEPORT) in a child process, so they neither share the
+ * client's cpu accounting nor its threads. setup(bench_server_t *) configures each one.
+ * Returns the child's pid and sets *port, -1 on failure. Stop with bench_server_kill.
+ */
+template<class setup_t>
+static inline pid_t bench_server_fork(int n, int *port, setup_t setup) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        std::vector<bench_server_t> servers(n);
+        for (auto &srv : servers) {
+            setup(&srv);
+            srv.reusePort = true;
+            srv.port = servers[0].port;
+            if (!bench_server_start(&srv)) _exit(1);
+        }
+
+        if (write(fds[1], &servers[0].port, sizeof(int)) != sizeof(int)) _exit(1);
+        close(fds[1]);
+        for (;;) pause();
+    }
+    close(fds[1]);
+
+    if (pid < 0 || read(fds[0], port, sizeof(int)) != sizeof(int)) {
+        if (pid > 0) waitpid(pid, nullptr, 0);
+        close(fds[0]);
+        return -1;
+    }
+    close(fds[0]);
+    return pid;
+}
+
+static inline void bench_server_kill(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
@@ -0,0 +1,121 @@
+/*
+ * TLS handshake throughput against loopback wolfSSL servers, for every loop count in --loops.
+ * Every request is a fresh connection, so with --resume=0 every request is a full handshake.
+ * --per-loop-ctx=1 sets tlsCtxPerLoop, compare against 0 for the shared context.
+ *
+ * bench_handshake --loops=1,2,4,8 --requests=5000 --per-loop-ctx=1 --servers=4 --resume=0
+ *
+ * Run from the repo root (server certificates), prints one JSON line per loop count.
+ */
+
+#include <cassert>
+#include <atomic>
+
+#include "../lib/snowhttp.h"
+#include "bench.h"
+#include "bench_server.h"
+
+snow_global_t global = {};
+ev_loop loops[multi_loop_max];
+
+std::vector<uint64_t> startNs, latencyNs;
+std::atomic<int> completed = 0, failed = 0;
+int requestN;
+
+void finish() {
+    if (completed.fetch_add(1) + 1 == requestN)
+        for (int i = 0; i < multi_loop_n_runtime; i++) loops[i].brk = 1;
+}
+
+void http_cb(char *data, size_t len, void *extra) {
+    latencyNs[(size_t) extra] = bench_now_ns() - startNs[(size_t) extra];
+    finish();
+}
+
+void err_cb(int err, void *extra) {
+    failed++;
+    finish();
+}
+
+void run(int loopN, int port, bool resume) {
+    multi_loop_n_runtime = loopN;
+    loopTopologyReport = false;
+
+    for (int i = 0; i < multi_loop_n_runtime; i++) {
+        loops[i] = {-1, 0, nullptr, nullptr};
+        global.loops[i] = &loops[i];
+    }
+
+    char url[128];
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/", port);
+
+#ifdef SNOW_TLS_SESSION_REUSE
+    if (resume) snow_addWantedSession(&global, url);
+#endif
+
+    snow_init(&global);
+    snow_spawnLoops(&global);
+    if (resume) usleep(500000); // first renewal
+
+    startNs.resize(requestN);
+    latencyNs.resize(requestN);
+    uint64_t begin = bench_now_ns(), cpuBegin = bench_cpu_ns();
+
+    for (int i = 0; i < requestN; i++) {
+        startNs[i] = bench_now_ns();
+        while (!snow_enqueue(&global, GET, url, http_cb, err_cb, (void *) (size_t) i))
+            usleep(10); // queue full, back off
+    }
+
+    snow_joinLoops(&global);
+    uint64_t elapsed = bench_now_ns() - begin, cpu = bench_cpu_ns() - cpuBegin;
+
+    snow_histogram_snapshot_t tls = {};
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    snow_latencySnapshot(&global, PHASE_TLS, -1, -1, &tls); // handshake alone, without connect & queueing
+#endif
+    snow_destroy(&global);
+
+    std::vector<uint64_t> ok;
+    for (uint64_t l : latencyNs) if (l) ok.push_back(l);
+
+    printf("{\"bench\":\"handshake\",\"loops\":%d,\"per_loop_ctx\":%d,\"resume\":%d,\"requests\":%d,\"errors\":%d,"
+           "\"handshakes_per_s\":%.0f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"tls_p50_us\":%.1f,\"tls_p99_us\":%.1f,"
+           "\"cpu_us_per_handshake\":%.2f}\n",
+           loopN, tlsCtxPerLoop, resume, requestN, failed.load(), ok.size() / (elapsed / 1e9),
+           bench_percentile(ok, 0.5) / 1e3, bench_percentile(ok, 0.99) / 1e3, bench_percentile(ok, 1.0) / 1e3,
+           snow_histogram_percentile(&tls, 0.5) / 1e3, snow_histogram_percentile(&tls, 0.99) / 1e3, cpu / 1e3 / requestN);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *loopList = bench_arg(argc, argv, "--loops", "1,2,4,8");
+    requestN = (int) bench_arg(argc, argv, "--requests", 5000L);
+    tlsCtxPerLoop = bench_arg(argc, argv, "--per-loop-ctx", 1L) != 0;
+    int serverN = (int) bench_arg(argc, argv, "--servers", 4L);
+    bool resume = bench_arg(argc, argv, "--resume", 0L) != 0;
+
+    // servers and every run get their own process, snowhttp is initialized once per process
+    int port = 0;
+    pid_t server = bench_server_fork(serverN, &port, [](bench_server_t *srv) { srv->tls = true; });
+    if (server < 0) {
+        fprintf(stderr, "could not start server\n");
+        return 1;
+    }
+
+    for (const char *it = loopList; *it;) {
+        int loopN = (int) strtol(it, (char **) &it, 10);
+        if (*it == ',') it++;
+        assert(loopN > 0 && loopN <= multi_loop_max);
+
+        pid_t child = fork();
+        if (child == 0) {
+            run(loopN, port, resume);
+            _exit(0);
+        }
+        waitpid(child, nullptr, 0);
+    }
+
+    bench_server_kill(server);
+    return 0;
+}
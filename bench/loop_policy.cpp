@@ -0,0 +1,103 @@
+/*
+ * Tail latency of the loop assignment policies under skewed load, against loopback servers.
+ * Every server is a distinct host:port, --skew of the requests go to the first one which answers after --delay us.
+ *
+ * bench_policy --policy=rr|least|p2c|affinity --loops=8 --requests=20000 --hosts=8 --skew=0.8 --delay=200 --steal=0
+ *
+ * Prints one JSON line.
+ */
+
+#include <cassert>
+#include <atomic>
+
+#include "../lib/snowhttp.h"
+#include "bench.h"
+#include "bench_server.h"
+
+snow_global_t global = {};
+ev_loop loops[multi_loop_max];
+
+std::vector<uint64_t> startNs, latencyNs;
+std::atomic<int> completed = 0, failed = 0;
+int requestN;
+
+void finish() {
+    if (completed.fetch_add(1) + 1 == requestN)
+        for (int i = 0; i < multi_loop_n_runtime; i++) loops[i].brk = 1;
+}
+
+void http_cb(char *data, size_t len, void *extra) {
+    latencyNs[(size_t) extra] = bench_now_ns() - startNs[(size_t) extra];
+    finish();
+}
+
+void err_cb(int err, void *extra) {
+    failed++;
+    finish();
+}
+
+int main(int argc, char **argv) {
+    const char *policy = bench_arg(argc, argv, "--policy", "rr");
+    multi_loop_n_runtime = (int) bench_arg(argc, argv, "--loops", 8L);
+    requestN = (int) bench_arg(argc, argv, "--requests", 20000L);
+    int hostN = (int) bench_arg(argc, argv, "--hosts", 8L);
+    double skew = bench_arg(argc, argv, "--skew", 0.8);
+    int delayUs = (int) bench_arg(argc, argv, "--delay", 200L);
+    loopStealThreshold = (int) bench_arg(argc, argv, "--steal", 0L);
+    assert(multi_loop_n_runtime <= multi_loop_max && hostN > 0);
+
+    if (strcmp(policy, "least") == 0) loopPolicy = LOOP_LEAST_OUTSTANDING;
+    else if (strcmp(policy, "p2c") == 0) loopPolicy = LOOP_POWER_OF_TWO;
+    else if (strcmp(policy, "affinity") == 0) loopPolicy = LOOP_HOST_AFFINITY;
+    else loopPolicy = LOOP_ROUND_ROBIN;
+
+    std::vector<bench_server_t> servers(hostN);
+    for (auto &srv : servers) {
+        if (!bench_server_start(&srv)) {
+            fprintf(stderr, "could not start server\n");
+            return 1;
+        }
+    }
+
+    loopTopologyReport = false;
+    for (int i = 0; i < multi_loop_n_runtime; i++) {
+        loops[i] = {-1, 0, nullptr, nullptr};
+        global.loops[i] = &loops[i];
+    }
+    snow_init(&global);
+    snow_spawnLoops(&global);
+
+    startNs.resize(requestN);
+    latencyNs.resize(requestN);
+
+    srand(42);
+    char url[128];
+    uint64_t begin = bench_now_ns(), cpuBegin = bench_cpu_ns();
+
+    for (int i = 0; i < requestN; i++) {
+        bool hot = hostN == 1 || rand() < skew * RAND_MAX;
+        int host = hot ? 0 : 1 + rand() % (hostN - 1);
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d/?d=%d", servers[host].port, hot ? delayUs : 0);
+
+        startNs[i] = bench_now_ns();
+        while (!snow_enqueue(&global, GET, url, http_cb, err_cb, (void *) (size_t) i))
+            usleep(10); // queue full, back off
+    }
+
+    snow_joinLoops(&global);
+    uint64_t elapsed = bench_now_ns() - begin, cpu = bench_cpu_ns() - cpuBegin;
+
+    for (auto &srv : servers) bench_server_stop(&srv);
+    snow_destroy(&global);
+
+    std::vector<uint64_t> ok;
+    for (uint64_t l : latencyNs) if (l) ok.push_back(l);
+
+    printf("{\"bench\":\"loop_policy\",\"policy\":\"%s\",\"loops\":%d,\"hosts\":%d,\"skew\":%.2f,\"delay_us\":%d,\"steal\":%d,"
+           "\"requests\":%d,\"errors\":%d,\"rps\":%.0f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"cpu_us_per_req\":%.2f}\n",
+           policy, multi_loop_n_runtime, hostN, skew, delayUs, loopStealThreshold, requestN, failed.load(),
+           requestN / (elapsed / 1e9), bench_percentile(ok, 0.5) / 1e3, bench_percentile(ok, 0.99) / 1e3,
+           bench_percentile(ok, 0.999) / 1e3, bench_percentile(ok, 1.0) / 1e3, cpu / 1e3 / requestN);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Throughput & latency against loopback stand-in servers, no network needed.
+ * Servers run in a child process, cpu per request only counts the client.
+ *
+ * bench_loopback --loops=2 --requests=20000 --concurrency=128 --rate=0 --size=64 --chunked=0 --chunk-size=4096
+ *                --delay=0 --tls=0 --servers=1 --h2=0 --batch=0 --individual=0
+ *
+ * --rate=0 keeps --concurrency requests in flight, otherwise requests are sent at --rate per second (at most
+ * --concurrency in flight). Latency is measured from the send. Prints one JSON line, run from the repo root for --tls=1.
+ * --h2=1 with --tls=1 has the servers offer h2, requests become streams if snowhttp is built with SNOW_HTTP2.
+ * --batch=N sends requests N at a time with one snow_doBatch, or with N snow_do calls with --individual=1, instead of
+ * snow_enqueue one by one. submit_ns_per_req is the time spent in those calls.
+ */
+
+#include <cassert>
+#include <atomic>
+
+#include "../lib/snowhttp.h"
+#include "bench.h"
+#include "bench_server.h"
+
+snow_global_t global = {};
+ev_loop loops[multi_loop_max];
+
+std::vector<uint64_t> startNs, latencyNs;
+std::atomic<int> completed = 0, failed = 0, inFlight = 0;
+int requestN;
+
+void finish() {
+    inFlight--;
+    if (completed.fetch_add(1) + 1 == requestN)
+        for (int i = 0; i < multi_loop_n_runtime; i++) loops[i].brk = 1;
+}
+
+void http_cb(char *data, size_t len, void *extra) {
+    latencyNs[(size_t) extra] = bench_now_ns() - startNs[(size_t) extra];
+    finish();
+}
+
+void err_cb(int err, void *extra) {
+    failed++;
+    finish();
+}
+
+static void sleep_until(uint64_t ns) {
+    uint64_t now;
+    while ((now = bench_now_ns()) < ns) {
+        if (ns - now > 50000) usleep((ns - now) / 1000 - 20);
+        else std::this_thread::yield();
+    }
+}
+
+static double phase_us(int phase, double q) {
+    snow_histogram_snapshot_t h = {};
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    snow_latencySnapshot(&global, phase, -1, -1, &h);
+#endif
+    return snow_histogram_percentile(&h, q) / 1e3;
+}
+
+int main(int argc, char **argv) {
+    multi_loop_n_runtime = (int) bench_arg(argc, argv, "--loops", 2L);
+    requestN = (int) bench_arg(argc, argv, "--requests", 20000L);
+    int concurrency = (int) bench_arg(argc, argv, "--concurrency", 128L);
+    double rate = bench_arg(argc, argv, "--rate", 0.0);
+    static size_t bodySize = bench_arg(argc, argv, "--size", 64L);
+    static bool chunked = bench_arg(argc, argv, "--chunked", 0L) != 0;
+    static size_t chunkSize = bench_arg(argc, argv, "--chunk-size", 4096L);
+    static int delayUs = (int) bench_arg(argc, argv, "--delay", 0L);
+    static bool tls = bench_arg(argc, argv, "--tls", 0L) != 0;
+    static bool h2 = bench_arg(argc, argv, "--h2", 0L) != 0;
+    int serverN = (int) bench_arg(argc, argv, "--servers", 1L);
+    int batch = (int) bench_arg(argc, argv, "--batch", 0L);
+    bool individual = bench_arg(argc, argv, "--individual", 0L) != 0;
+    assert(multi_loop_n_runtime <= multi_loop_max && concurrency > 0 && batch <= concurrency);
+
+    int port = 0;
+    pid_t server = bench_server_fork(serverN, &port, [](bench_server_t *srv) {
+        srv->bodySize = bodySize;
+        srv->chunked = chunked;
+        srv->chunkSize = chunkSize;
+        srv->delayUs = delayUs;
+        srv->tls = tls;
+        srv->h2 = h2;
+    });
+    if (server < 0) {
+        fprintf(stderr, "could not start server\n");
+        return 1;
+    }
+
+    loopTopologyReport = false;
+    for (int i = 0; i < multi_loop_n_runtime; i++) {
+        loops[i] = {-1, 0, nullptr, nullptr};
+        global.loops[i] = &loops[i];
+    }
+    snow_init(&global);
+    snow_spawnLoops(&global);
+
+    startNs.resize(requestN);
+    latencyNs.resize(requestN);
+
+    char url[128];
+    snprintf(url, sizeof(url), "%s://127.0.0.1:%d/", tls ? "https" : "http", port);
+
+    std::vector<snow_batchRequest_t> group(batch);
+    uint64_t submitNs = 0;
+
+    uint64_t begin = bench_now_ns(), cpuBegin = bench_cpu_ns();
+
+    for (int i = 0; i < requestN && batch > 0; i += batch) {
+        int n = std::min(batch, requestN - i);
+        if (rate > 0) sleep_until(begin + (uint64_t) (i * 1e9 / rate));
+        while (inFlight.load() + n > concurrency) std::this_thread::yield();
+
+        inFlight += n;
+        uint64_t now = bench_now_ns();
+        for (int j = 0; j < n; j++) {
+            startNs[i + j] = now;
+            group[j] = {GET, url, http_cb, err_cb, (void *) (size_t) (i + j)};
+        }
+
+        if (individual)
+            for (int j = 0; j < n; j++) snow_do(&global, GET, url, http_cb, err_cb, group[j].extra);
+        else snow_doBatch(&global, group.data(), n);
+        submitNs += bench_now_ns() - now;
+    }
+
+    for (int i = 0; i < requestN && batch == 0; i++) {
+        if (rate > 0) sleep_until(begin + (uint64_t) (i * 1e9 / rate));
+        while (inFlight.load() >= concurrency) std::this_thread::yield();
+
+        inFlight++;
+        startNs[i] = bench_now_ns();
+        while (!snow_enqueue(&global, GET, url, http_cb, err_cb, (void *) (size_t) i))
+            usleep(10); // queue full, back off
+        submitNs += bench_now_ns() - startNs[i];
+    }
+
+    snow_joinLoops(&global);
+    uint64_t elapsed = bench_now_ns() - begin, cpu = bench_cpu_ns() - cpuBegin;
+    bench_server_kill(server);
+
+    snow_stats_t stats;
+    snow_stats(&global, &stats);
+
+    std::vector<uint64_t> ok;
+    for (uint64_t l : latencyNs) if (l) ok.push_back(l);
+
+    printf("{\"bench\":\"loopback\",\"loops\":%d,\"requests\":%d,\"concurrency\":%d,\"rate\":%.0f,\"size\":%zu,\"chunked\":%d,"
+           "\"delay_us\":%d,\"tls\":%d,\"h2_connections\":%lu,\"servers\":%d,\"errors\":%d,\"rps\":%.0f,\"p50_us\":%.1f,"
+           "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"cpu_us_per_req\":%.2f,\"connect_p50_us\":%.1f,\"tls_p50_us\":%.1f,"
+           "\"ttfb_p50_us\":%.1f,\"ttfb_p99_us\":%.1f,\"batch\":%d,\"individual\":%d,\"submit_ns_per_req\":%.0f}\n",
+           multi_loop_n_runtime, requestN, concurrency, rate, bodySize, chunked, delayUs, tls, stats.counters[STAT_H2_CONNECTIONS],
+           serverN, failed.load(),
+           ok.size() / (elapsed / 1e9), bench_percentile(ok, 0.5) / 1e3, bench_percentile(ok, 0.99) / 1e3,
+           bench_percentile(ok, 0.999) / 1e3, bench_percentile(ok, 1.0) / 1e3, cpu / 1e3 / requestN,
+           phase_us(PHASE_CONNECT, 0.5), phase_us(PHASE_TLS, 0.5), phase_us(PHASE_TTFB, 0.5), phase_us(PHASE_TTFB, 0.99),
+           batch, individual, (double) submitNs / requestN);
+
+    snow_destroy(&global);
+    return 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * Microbenchmarks for the request path primitives, google-benchmark style: every case runs doubling iteration
+ * counts until it takes --min-time seconds, then reports time per iteration.
+ *
+ * bench_micro [--filter=substring] [--min-time=0.2] [--json=1]
+ *
+ * The responses are captured from real servers (headers verbatim, bodies trimmed). Any change to these paths
+ * should come with before / after numbers from here, run on an idle machine, pinned: taskset -c 2 bin/bench_micro
+ */
+
+#include <cassert>
+#include <string>
+#include <functional>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../lib/snowhttp.h"
+#include "bench.h"
+
+// internal, not in snowhttp.h
+void snow_parseUrl(snow_connection_t *conn);
+void snow_processFirstResponse(snow_connection_t *conn);
+void snow_parseChunks(snow_connection_t *conn);
+void snow_bufferRequest(snow_connection_t *conn);
+
+// keeps the compiler from dropping the work
+static inline void bench_escape(void *p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+static const char *filter = "";
+static double minTime = 0.2;
+static bool json = false;
+static bool firstJson = true;
+
+// body(n) runs n iterations
+template<class body_t>
+static void bench(const char *name, body_t body) {
+    if (!strstr(name, filter)) return;
+
+    body(16); // warm up caches & branch predictors
+
+    uint64_t n = 1, elapsed = 0, cpu = 0;
+    for (;;) {
+        uint64_t begin = bench_now_ns(), cpuBegin = bench_cpu_ns();
+        body(n);
+        elapsed = bench_now_ns() - begin;
+        cpu = bench_cpu_ns() - cpuBegin;
+        if (elapsed >= minTime * 1e9 || n >= (1ULL << 40)) break;
+        n *= elapsed ? std::min<uint64_t>(std::max<uint64_t>(minTime * 1.4e9 / elapsed, 2), 100) : 100;
+    }
+
+    if (json)
+        printf("%s\n    {\"name\":\"%s\",\"iterations\":%lu,\"real_time_ns\":%.2f,\"cpu_time_ns\":%.2f}", firstJson ? "" : ",",
+               name, n, (double) elapsed / n, (double) cpu / n);
+    else
+        printf("%-40s %12.1f ns %12.1f ns %12lu\n", name, (double) elapsed / n, (double) cpu / n, n);
+    firstJson = false;
+    fflush(stdout);
+}
+
+// api.github.com/repos/..., Content-Length
+static const char *responseLength =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: GitHub.com\r\n"
+        "Date: Tue, 14 Mar 2023 09:21:07 GMT\r\n"
+        "Content-Type: application/json; charset=utf-8\r\n"
+        "Cache-Control: public, max-age=60, s-maxage=60\r\n"
+        "Vary: Accept, Accept-Encoding, Accept, X-Requested-With\r\n"
+        "ETag: W/\"3bb8a8a0ad2c4bc4d1c9e0a6bb2b5dd2c1b4ccd6d4f5e5c0a1c0f7b2e7a7b0f1\"\r\n"
+        "Last-Modified: Mon, 13 Mar 2023 17:02:55 GMT\r\n"
+        "X-GitHub-Media-Type: github.v3; format=json\r\n"
+        "x-github-api-version-selected: 2022-11-28\r\n"
+        "Access-Control-Expose-Headers: ETag, Link, Location, Retry-After, X-GitHub-OTP, X-RateLimit-Limit, X-RateLimit-Remaining\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Strict-Transport-Security: max-age=31536000; includeSubdomains; preload\r\n"
+        "X-Frame-Options: deny\r\n"
+        "X-Content-Type-Options: nosniff\r\n"
+        "X-XSS-Protection: 0\r\n"
+        "Referrer-Policy: origin-when-cross-origin, strict-origin-when-cross-origin\r\n"
+        "Content-Security-Policy: default-src 'none'\r\n"
+        "X-RateLimit-Limit: 60\r\n"
+        "X-RateLimit-Remaining: 57\r\n"
+        "X-RateLimit-Reset: 1678788067\r\n"
+        "X-RateLimit-Resource: core\r\n"
+        "X-RateLimit-Used: 3\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "Content-Length: 402\r\n"
+        "X-GitHub-Request-Id: C2A4:6B0D:1C3E2A5:1C8F3B1:64103C23\r\n"
+        "\r\n"
+        "{\"id\":1296269,\"node_id\":\"MDEwOlJlcG9zaXRvcnkxMjk2MjY5\",\"name\":\"Hello-World\",\"full_name\":\"octocat/Hello-World\","
+        "\"private\":false,\"owner\":{\"login\":\"octocat\",\"id\":1,\"type\":\"User\",\"site_admin\":false},"
+        "\"html_url\":\"https://github.com/octocat/Hello-World\",\"description\":\"This your first repo!\",\"fork\":false,"
+        "\"created_at\":\"2011-01-26T19:01:12Z\",\"updated_at\":\"2011-01-26T19:14:43Z\",\"pushed_at\":\"2011-01-26T19:06:43Z\","
+        "\"size\":108,\"stargazers_count\":80,\"watchers_count\":80,\"language\":null}";
+
+// nginx in front of an exchange REST api, Transfer-Encoding: chunked
+static const char *responseChunkedHeader =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx\r\n"
+        "Date: Tue, 14 Mar 2023 09:24:51 GMT\r\n"
+        "Content-Type: application/json;charset=UTF-8\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Connection: keep-alive\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "x-mbx-uuid: 2f6b1c1e-8a0e-4c2b-9d4e-6a3c0f1b7e55\r\n"
+        "x-mbx-used-weight: 5\r\n"
+        "x-mbx-used-weight-1m: 5\r\n"
+        "Strict-Transport-Security: max-age=31536000; includeSubdomains\r\n"
+        "X-Frame-Options: SAMEORIGIN\r\n"
+        "X-Xss-Protection: 1; mode=block\r\n"
+        "X-Content-Type-Options: nosniff\r\n"
+        "Content-Security-Policy: default-src 'self'\r\n"
+        "X-Content-Security-Policy: default-src 'self'\r\n"
+        "X-WebKit-CSP: default-src 'self'\r\n"
+        "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+        "Pragma: no-cache\r\n"
+        "Expires: 0\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"
+        "\r\n";
+
+// order book levels as the server sends them, split into chunks of chunkSize
+static std::string chunkedResponse(size_t levels, size_t chunkSize) {
+    std::string body = "{\"lastUpdateId\":31264372131,\"bids\":[";
+    char level[64];
+    for (size_t i = 0; i < levels; i++) {
+        snprintf(level, sizeof(level), "%s[\"24731.%02zu000000\",\"0.%05zu000\"]", i ? "," : "", 99 - i % 100, 1 + i * 37 % 99999);
+        body += level;
+    }
+    body += "],\"asks\":[]}";
+
+    std::string out = responseChunkedHeader;
+    char size[16];
+    for (size_t off = 0; off < body.size(); off += chunkSize) {
+        size_t len = std::min(chunkSize, body.size() - off);
+        snprintf(size, sizeof(size), "%zx\r\n", len);
+        out += size;
+        out.append(body, off, len);
+        out += "\r\n";
+    }
+    return out + "0\r\n\r\n";
+}
+
+static snow_global_t global = {};
+static snow_connection_t conn;
+
+static void resetConn() {
+    conn.content = nullptr;
+    conn.contentLen = 0;
+    conn.expectedContentLen = 0;
+    conn.chunked = false;
+    conn.readBuff.tail = conn.readBuff.head = 0;
+    conn.writeBuff.tail = conn.writeBuff.head = 0;
+}
+
+static void benchParseUrl(const char *name, const char *url) {
+    bench(name, [url](uint64_t n) {
+        size_t len = strlen(url) + 1;
+        for (uint64_t i = 0; i < n; i++) {
+            memcpy(conn.requestUrl, url, len); // parseUrl splits the url in place
+            conn.port = 0;
+            conn.secure = false;
+            snow_parseUrl(&conn);
+            bench_escape(conn.path);
+        }
+    });
+}
+
+static void benchFirstResponse(const char *name, const std::string &response) {
+    resetConn();
+    memcpy(conn.readBuff.buff, response.c_str(), response.size() + 1);
+    conn.readBuff.head = response.size();
+
+    bench(name, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            conn.readBuff.tail = 0;
+            snow_processFirstResponse(&conn);
+            bench_escape(conn.content);
+        }
+    });
+}
+
+// parseChunks compacts the body in place, every iteration starts from a fresh copy, compare with the copy case
+static void benchChunks(const char *name, const std::string &response, bool copyOnly) {
+    resetConn();
+    memcpy(conn.readBuff.buff, response.c_str(), response.size() + 1);
+    conn.readBuff.head = response.size();
+    snow_processFirstResponse(&conn);
+    assert(conn.chunked);
+
+    size_t bodyOffset = conn.content - conn.readBuff.buff, bodyLen = response.size() - bodyOffset;
+    const char *body = response.c_str() + bodyOffset;
+
+    bench(name, [=](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            memcpy(conn.content, body, bodyLen + 1);
+            conn.readBuff.head = bodyOffset + bodyLen;
+            conn.contentLen = 0;
+            if (!copyOnly) snow_parseChunks(&conn);
+            bench_escape(conn.content);
+        }
+    });
+}
+
+static void benchBufferRequest(const char *name, const char *url, const char *headers) {
+    resetConn();
+    strcpy(conn.requestUrl, url);
+    snow_parseUrl(&conn);
+    conn.method = GET;
+    conn.extraHeaders = headers;
+    conn.extraHeaders_size = headers ? strlen(headers) : 0;
+
+    bench(name, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            conn.writeBuff.head = 0;
+            snow_bufferRequest(&conn);
+            bench_escape(conn.writeBuff.buff);
+        }
+    });
+}
+
+#ifdef SNOW_WEBSOCKET
+
+// masking of a payload of size bytes, as for every frame sent
+static void benchWsMask(size_t size) {
+    std::vector<char> payload(size, 'x');
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+    char name[64];
+    snprintf(name, sizeof(name), "wsMask/%zu", size);
+    bench(name, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            snow_ws_mask(payload.data(), size, mask);
+            bench_escape(payload.data());
+        }
+    });
+}
+
+static void benchWsParseHeader() {
+    char frame[wsMaxHeaderSize];
+    snow_ws_frameHeader(frame, WS_TEXT, true, 1000, nullptr);
+
+    bench("wsParseHeader", [&](uint64_t n) {
+        snow_ws_frame_t parsed;
+        for (uint64_t i = 0; i < n; i++) {
+            snow_ws_parseHeader((const uint8_t *) frame, sizeof(frame), &parsed);
+            bench_escape(&parsed);
+        }
+    });
+}
+
+#endif
+
+// storing & calling a capturing callable the way snow_do does, against std::function which allocates past 16 bytes
+static void benchCallback() {
+    static uint64_t sink = 0;
+    uint64_t a = 1, b = 2, c = 3;
+    snow_response_t response = {-1, 200, nullptr, 8};
+
+    bench("callback/inline", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            snow_callback_t callback = snow_callback_t::from([a, b, c, i](const snow_response_t &r) { sink += a + b + c + i + r.len; });
+            bench_escape(&callback);
+            callback.invoke(callback.storage, &response);
+        }
+    });
+    bench("callback/std_function", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            std::function<void(const snow_response_t &)> callback = [a, b, c, i](const snow_response_t &r) { sink += a + b + c + i + r.len; };
+            bench_escape(&callback);
+            callback(response);
+        }
+    });
+}
+
+static void noop_timer_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {}
+
+static void noop_io_cb(struct ev_loop *loop, struct ev_io *w, int revents) {}
+
+// start & stop of one timer in the middle of a list of size running timers
+static void benchTimers(size_t size) {
+    ev_loop loop = {-1, 0, nullptr, nullptr};
+    std::vector<ev_timer> timers(size + 1);
+
+    for (size_t i = 0; i < size; i++) {
+        ev_timer_init(&timers[i], noop_timer_cb, 1 + (double) i / size, 0);
+        ev_timer_start(&loop, &timers[i]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "ev_timer_start_stop/%zu", size);
+    bench(name, [&](uint64_t n) {
+        ev_timer &t = timers[size];
+        for (uint64_t i = 0; i < n; i++) {
+            ev_timer_init(&t, noop_timer_cb, 1.5, 0);
+            ev_timer_start(&loop, &t);
+            ev_timer_stop(&loop, &t);
+        }
+    });
+    close(loop.pfd);
+}
+
+// start & stop of a read watcher on one fd, with fds other watchers registered
+static void benchIo(size_t fds) {
+    ev_loop loop = {-1, 0, nullptr, nullptr};
+    std::vector<ev_io> ios(fds + 1);
+
+    for (size_t i = 0; i <= fds; i++) {
+        int fd = eventfd(0, EFD_NONBLOCK);
+        assert(fd >= 0);
+        ev_io_init(&ios[i], noop_io_cb, fd, EV_READ);
+        if (i < fds) ev_io_start(&loop, &ios[i]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "ev_io_start_stop/%zu", fds);
+    bench(name, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            ev_io_start(&loop, &ios[fds]);
+            ev_io_stop(&loop, &ios[fds]);
+        }
+    });
+
+    for (auto &io : ios) close(io.fd);
+    close(loop.pfd);
+}
+
+// read & write watchers of new connections' sockets, one ev_io_start each or all with ev_io_start_batch, then stopped
+static void benchIoPairs(size_t sockets, bool batch) {
+    ev_loop loop = {-1, 0, nullptr, nullptr};
+    std::vector<ev_io> ios(2 * sockets);
+    std::vector<ev_io *> evs(2 * sockets);
+
+    for (size_t i = 0; i < sockets; i++) {
+        int fd = eventfd(0, EFD_NONBLOCK);
+        assert(fd >= 0);
+        ev_io_init(&ios[2 * i], noop_io_cb, fd, EV_READ);
+        ev_io_init(&ios[2 * i + 1], noop_io_cb, fd, EV_WRITE);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%zu", batch ? "ev_io_start_batch" : "ev_io_start_pairs", sockets);
+    bench(name, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            if (batch) {
+                for (size_t j = 0; j < ios.size(); j++) evs[j] = &ios[j];
+                ev_io_start_batch(&loop, evs.data(), (int) evs.size());
+            } else {
+                for (auto &io : ios) ev_io_start(&loop, &io);
+            }
+            for (auto &io : ios) ev_io_stop(&loop, &io);
+        }
+    });
+
+    for (size_t i = 0; i < sockets; i++) close(ios[2 * i].fd);
+    close(loop.pfd);
+}
+
+int main(int argc, char **argv) {
+    filter = bench_arg(argc, argv, "--filter", "");
+    minTime = bench_arg(argc, argv, "--min-time", 0.2);
+    json = bench_arg(argc, argv, "--json", 0L) != 0;
+
+    conn.global = &global;
+
+    if (json) printf("{\"benchmarks\":[");
+    else printf("%-40s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+
+    benchParseUrl("parseUrl/https", "https://api.binance.com/api/v3/depth?symbol=BTCUSDT&limit=100");
+    benchParseUrl("parseUrl/port", "http://127.0.0.1:8080/v1/orders/open");
+
+    std::string length = responseLength, chunkedSmall = chunkedResponse(20, 1024), chunkedLarge = chunkedResponse(500, 4096);
+    benchFirstResponse("processFirstResponse/length", length);
+    benchFirstResponse("processFirstResponse/chunked", chunkedSmall);
+
+    benchChunks("parseChunks/copy_only/small", chunkedSmall, true);
+    benchChunks("parseChunks/small", chunkedSmall, false);
+    benchChunks("parseChunks/copy_only/large", chunkedLarge, true);
+    benchChunks("parseChunks/large", chunkedLarge, false);
+
+    benchBufferRequest("bufferRequest/plain", "https://api.binance.com/api/v3/depth?symbol=BTCUSDT&limit=100", nullptr);
+    benchBufferRequest("bufferRequest/headers", "https://api.binance.com/api/v3/order?symbol=BTCUSDT",
+                       "X-MBX-APIKEY: vmPUZE6mv9SD5VNHk4HlWFsOr6aKE2zvsw0MuIgwCIPy6utIco14y7Ju91duEh8A\r\n"
+                       "Accept: application/json\r\nUser-Agent: snowhttp\r\n");
+
+    benchCallback();
+
+#ifdef SNOW_WEBSOCKET
+    for (size_t size : {64, 16384})
+        benchWsMask(size);
+    benchWsParseHeader();
+#endif
+
+    for (size_t size : {1, 16, 256, 4096})
+        benchTimers(size);
+
+    for (size_t fds : {1, 16, 256, 4096})
+        benchIo(fds);
+
+    for (size_t sockets : {1, 32}) {
+        benchIoPairs(sockets, false);
+        benchIoPairs(sockets, true);
+    }
+
+    if (json) printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <cstring>
+#include <cassert>
+
+#include "lib/snowco.h"
+
+// build with -std=c++20, see `make example_co`
+
+snow_global_t global = {};
+ev_loop loops[multi_loop_max];
+
+std::atomic<int> finished = 0;
+constexpr int task_n = 10;
+
+snow::task fetch(int id) {
+    snow::response_t ping = co_await snow::get(&global, "https://api.binance.com/api/v3/ping");
+    if (ping.err >= 0) fprintf(stderr, "task %d, error: %d\n", id, ping.err);
+
+    // both at once, the bodies are copied since the first connection is reused before the second one finishes
+    char btc[256], eth[256];
+    auto [b, e] = co_await snow::when_all(snow::get(&global, "https://api.binance.com/api/v3/ticker/price?symbol=BTCUSDT").into(btc, sizeof(btc)),
+                                          snow::get(&global, "https://api.binance.com/api/v3/ticker/price?symbol=ETHUSDT").into(eth, sizeof(eth)));
+    if (b.err < 0 && e.err < 0) printf("%.*s %.*s\n", (int) b.len, b.data, (int) e.len, e.data);
+
+    if (++finished == task_n)
+        for (int i = 0; i < multi_loop_n_runtime; i++) loops[i].brk = 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2) {
+        multi_loop_n_runtime = atoi(argv[1]);
+        assert(multi_loop_n_runtime <= multi_loop_max);
+    }
+
+    for (int i = 0; i < multi_loop_n_runtime; i++) {
+        loops[i] = {-1, 0, nullptr, nullptr};
+        global.loops[i] = &loops[i];
+    }
+    snow_addWantedSession(&global, "https://api.binance.com");
+    snow_init(&global);
+    snow_spawnLoops(&global);
+
+    sleep(1);
+
+    for (int id = 0; id < task_n; id++) fetch(id); // runs until its first co_await, then continues on the loops
+
+    snow_joinLoops(&global);
+    snow_destroy(&global);
+
+    return 0;
+}
@@ -26,7 +26,12 @@ SOFTWARE.
 
 #include <mutex>
 #include <queue>
+#include <algorithm>
 #include <map>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
 namespace atomic {
     template<class value_type, class container>
@@ -39,6 +44,15 @@ namespace atomic {
 
         void pop() { queue.pop(); }
 
+        // front() + pop() under the lock, returns false if empty
+        bool pop(value_type &val) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty()) return false;
+            val = queue.front();
+            queue.pop();
+            return true;
+        }
+
         auto front() { return queue.front(); }
 
         bool empty() { return queue.empty(); }
@@ -48,6 +62,273 @@ namespace atomic {
         std::queue<value_type, container> queue;
     };
 
+    // bounded FIFO, statically allocated
+    template<class value_type, size_t capacity>
+    class ring {
+    public:
+        // returns false if full
+        bool push(const value_type &val) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == capacity) return false;
+
+            buff[(head + count) % capacity] = val;
+            count++;
+            total.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(value_type &val) {
+            if (total.load(std::memory_order_acquire) == 0) return false; // cheap check for pollers
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == 0) return false;
+
+            val = buff[head];
+            head = (head + 1) % capacity;
+            count--;
+            total.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+
+        // pushes as many of vals as fit under one lock, returns how many
+        size_t push_bulk(const value_type *vals, size_t n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            n = std::min(n, capacity - count);
+
+            for (size_t i = 0; i < n; i++) buff[(head + count + i) % capacity] = vals[i];
+            count += n;
+            total.fetch_add(n, std::memory_order_release);
+            return n;
+        }
+
+        // pops up to max values under one lock, returns how many
+        size_t pop_bulk(value_type *vals, size_t max) {
+            if (total.load(std::memory_order_acquire) == 0) return 0;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t n = std::min(max, count);
+
+            for (size_t i = 0; i < n; i++) vals[i] = buff[(head + i) % capacity];
+            head = (head + n) % capacity;
+            count -= n;
+            total.fetch_sub(n, std::memory_order_release);
+            return n;
+        }
+
+        size_t size() { return total.load(std::memory_order_relaxed); }
+
+        bool empty() { return size() == 0; }
+
+    private:
+        std::mutex mutex;
+        std::atomic<size_t> total = 0;
+        size_t head = 0;
+        size_t count = 0;
+        value_type buff[capacity];
+    };
+
+    /*
+     * Bounded FIFO with priority classes, statically allocated.
+     * Priority 0 is served first, each class holds up to capacity elements,
+     * plus up to reserve elements put back with push_front.
+     */
+    template<class value_type, size_t capacity, int priorities, size_t reserve = 0>
+    class priority_queue {
+    public:
+        // returns false if the priority class is full
+        bool push(const value_type &val, int priority) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count[priority] >= capacity) return false;
+
+            ring[priority][(head[priority] + count[priority]) % slots] = val;
+            count[priority]++;
+            total.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        // puts a popped element back at the front of its class, can use the reserve if the class filled up meanwhile
+        bool push_front(const value_type &val, int priority) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count[priority] == slots) return false;
+
+            head[priority] = (head[priority] + slots - 1) % slots;
+            ring[priority][head[priority]] = val;
+            count[priority]++;
+            total.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        // pops the oldest element of the highest non-empty priority class
+        bool pop(value_type &val, int *priority = nullptr) {
+            if (total.load(std::memory_order_acquire) == 0) return false;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int p = 0; p < priorities; p++) {
+                if (count[p] == 0) continue;
+
+                val = ring[p][head[p]];
+                head[p] = (head[p] + 1) % slots;
+                count[p]--;
+                total.fetch_sub(1, std::memory_order_release);
+                if (priority) *priority = p;
+                return true;
+            }
+            return false;
+        }
+
+        // moves up to max elements matching pred to out, keeping the order of the rest
+        template<class predicate>
+        size_t extract_if(predicate pred, value_type *out, size_t max) {
+            if (total.load(std::memory_order_acquire) == 0) return 0;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t n = 0;
+            for (int p = 0; p < priorities; p++) {
+                size_t kept = 0;
+                for (size_t i = 0; i < count[p]; i++) {
+                    value_type &v = ring[p][(head[p] + i) % slots];
+                    if (n < max && pred(v)) out[n++] = v;
+                    else ring[p][(head[p] + kept++) % slots] = v;
+                }
+                total.fetch_sub(count[p] - kept, std::memory_order_release);
+                count[p] = kept;
+            }
+            return n;
+        }
+
+        size_t size() { return total.load(std::memory_order_relaxed); }
+
+        bool empty() { return size() == 0; }
+
+        bool full(int priority) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return count[priority] >= capacity;
+        }
+
+    private:
+        static constexpr size_t slots = capacity + reserve;
+
+        std::mutex mutex;
+        std::atomic<size_t> total = 0;
+        size_t head[priorities] = {};
+        size_t count[priorities] = {};
+        value_type ring[priorities][slots];
+    };
+
+    /*
+     * Read-mostly open addressing table, statically allocated, keys are byte strings up to key_size.
+     * Readers never lock nor allocate: every slot has a sequence counter which is odd while a writer
+     * copies into it, readers copy the slot out and retry if the counter moved meanwhile.
+     * Writers are serialized by a mutex, slots are never emptied - an existing key is overwritten in place.
+     */
+    template<class value_type, size_t capacity, size_t key_size>
+    class seqlock_map {
+        static_assert((capacity & (capacity - 1)) == 0, "capacity has to be a power of two");
+        static_assert(std::is_trivially_copyable<value_type>::value, "values are copied while they may be written");
+
+    public:
+        // copies the value out, returns false if the key is missing
+        bool find(const char *key, size_t len, value_type &val) const {
+            if (len > key_size) return false;
+            uint64_t hash = hash_of(key, len);
+
+            for (size_t probe = 0; probe < capacity; probe++) {
+                const slot_t &slot = slots[(hash + probe) & (capacity - 1)];
+
+                for (;;) {
+                    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                    if (seq & 1U) continue; // writer inside
+
+                    uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+                    bool match = slotHash == hash && slot.len == len && memcmp(slot.key, key, len) == 0;
+                    if (match) memcpy((void *) &val, &slot.value, sizeof(value_type));
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.seq.load(std::memory_order_relaxed) != seq) continue; // torn copy
+
+                    if (match) return true;
+                    if (slotHash == 0) return false; // end of the probe chain
+                    break;
+                }
+            }
+            return false;
+        }
+
+        // inserts or overwrites, returns false if the key is too long or the table is full
+        bool insert(const char *key, size_t len, const value_type &val) {
+            if (len > key_size) return false;
+            uint64_t hash = hash_of(key, len);
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (size_t probe = 0; probe < capacity; probe++) {
+                slot_t &slot = slots[(hash + probe) & (capacity - 1)];
+                uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+                if (slotHash != 0 && (slotHash != hash || slot.len != len || memcmp(slot.key, key, len) != 0)) continue;
+
+                uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+                slot.seq.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                memcpy(slot.key, key, len);
+                slot.len = len;
+                memcpy((void *) &slot.value, &val, sizeof(value_type));
+                slot.hash.store(hash, std::memory_order_relaxed);
+
+                slot.seq.store(seq + 2, std::memory_order_release);
+                return true;
+            }
+            return false;
+        }
+
+        // calls fn(key, len, value) with a copy of every entry, entries inserted meanwhile may be missed
+        template<class function>
+        void for_each(function fn) const {
+            char key[key_size];
+            value_type val;
+
+            for (const slot_t &slot : slots) {
+                uint64_t slotHash;
+                size_t len;
+
+                for (;;) {
+                    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                    if (seq & 1U) continue;
+
+                    slotHash = slot.hash.load(std::memory_order_relaxed);
+                    len = slot.len;
+                    if (slotHash != 0 && len <= key_size) {
+                        memcpy(key, slot.key, len);
+                        memcpy((void *) &val, &slot.value, sizeof(value_type));
+                    }
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.seq.load(std::memory_order_relaxed) == seq) break;
+                }
+
+                if (slotHash != 0) fn((const char *) key, len, (const value_type &) val);
+            }
+        }
+
+    private:
+        struct slot_t {
+            std::atomic<uint32_t> seq = 0;
+            std::atomic<uint64_t> hash = 0; // 0 - empty
+            size_t len = 0;
+            char key[key_size] = {};
+            value_type value = {};
+        };
+
+        // FNV-1a, never 0
+        static uint64_t hash_of(const char *key, size_t len) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < len; i++) hash = (hash ^ (uint8_t) key[i]) * 1099511628211ULL;
+            return hash ? hash : 1;
+        }
+
+        std::mutex mutex;
+        slot_t slots[capacity];
+    };
+
     template<class key_type, class value_type, class compare = std::less<key_type>, class alloc = std::allocator<std::pair<const key_type, value_type>>>
     class map {
 
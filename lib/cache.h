@@ -0,0 +1,185 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * HTTP response cache, everything preallocated: slots of a set-associative table, CLOCK eviction within a set.
+ * Like atomic::seqlock_map, lookups never lock - every slot has a sequence counter which is odd while a writer
+ * copies into it, readers copy out and retry if it moved meanwhile. Stores are serialized by a mutex.
+ * A pinned slot (a revalidation in flight) is never evicted, so its body is still there when the 304 arrives.
+ */
+
+constexpr size_t cacheValidatorSize = 128; // responses with a longer ETag / Last-Modified are not cached
+
+struct snow_cache_entry_t {
+    int slot;
+    uint64_t expiry; // monotonic ms, fresh until then
+    char etag[cacheValidatorSize]; // "" - none
+    char lastModified[cacheValidatorSize]; // "" - none
+    size_t len;
+};
+
+template<int sets, int ways, size_t body_size, size_t url_size>
+class snow_cache_t {
+    static_assert((sets & (sets - 1)) == 0, "sets has to be a power of two");
+
+public:
+    // copies url's entry out, and its body if body is not null (body_size + 1 bytes, terminated), false if not cached
+    bool find(uint64_t hash, const char *url, snow_cache_entry_t *out, char *body) {
+        for (int way = 0; way < ways; way++) {
+            int index = (int) (hash & (sets - 1)) * ways + way;
+            slot_t &slot = slots[index];
+
+            for (;;) {
+                uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq & 1U) continue; // writer inside
+
+                bool match = slot.hash.load(std::memory_order_relaxed) == hash && strncmp(slot.url, url, url_size) == 0;
+                if (match) {
+                    out->slot = index;
+                    out->expiry = slot.expiry;
+                    out->len = std::min(slot.len, body_size);
+                    memcpy(out->etag, slot.etag, cacheValidatorSize);
+                    memcpy(out->lastModified, slot.lastModified, cacheValidatorSize);
+                    if (body) memcpy(body, slot.body, out->len);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != seq) continue; // torn copy
+
+                if (!match) break;
+                out->etag[cacheValidatorSize - 1] = out->lastModified[cacheValidatorSize - 1] = 0;
+                if (body) body[out->len] = 0;
+                if (!slot.referenced.load(std::memory_order_relaxed)) slot.referenced.store(true, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // inserts or replaces url's entry, false if it does not fit or every way of the set is pinned
+    bool store(uint64_t hash, const char *url, uint64_t expiry, const char *etag, size_t etagLen, const char *lastModified,
+               size_t lastModifiedLen, const char *body, size_t len) {
+        if (len > body_size || strlen(url) >= url_size || etagLen >= cacheValidatorSize || lastModifiedLen >= cacheValidatorSize)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        int set = (int) (hash & (sets - 1));
+        int index = -1;
+        for (int way = 0; way < ways && index < 0; way++) { // same url first, then an empty way
+            slot_t &slot = slots[set * ways + way];
+            if (slot.hash.load(std::memory_order_relaxed) == hash && strcmp(slot.url, url) == 0) index = set * ways + way;
+        }
+        for (int way = 0; way < ways && index < 0; way++)
+            if (slots[set * ways + way].hash.load(std::memory_order_relaxed) == 0) index = set * ways + way;
+
+        for (int step = 0; step < 2 * ways && index < 0; step++) { // CLOCK, referenced ways get a second chance
+            slot_t &slot = slots[set * ways + hands[set]];
+            if (slot.pins.load(std::memory_order_acquire) == 0 && !slot.referenced.exchange(false, std::memory_order_relaxed))
+                index = set * ways + hands[set];
+            hands[set] = (hands[set] + 1) % ways;
+        }
+        if (index < 0) return false;
+
+        slot_t &slot = slots[index];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.hash.store(hash, std::memory_order_relaxed);
+        strcpy(slot.url, url);
+        slot.expiry = expiry;
+        if (etagLen) memcpy(slot.etag, etag, etagLen); // a missing validator comes as nullptr
+        slot.etag[etagLen] = 0;
+        if (lastModifiedLen) memcpy(slot.lastModified, lastModified, lastModifiedLen);
+        slot.lastModified[lastModifiedLen] = 0;
+        memcpy(slot.body, body, len);
+        slot.len = len;
+        slot.referenced.store(false, std::memory_order_relaxed);
+
+        slot.seq.store(seq + 2, std::memory_order_release);
+        return true;
+    }
+
+    // new expiry after a 304, if the slot still holds the same entry
+    void refresh(int index, uint64_t hash, uint64_t expiry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot_t &slot = slots[index];
+        if (slot.hash.load(std::memory_order_relaxed) != hash) return;
+
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.expiry = expiry;
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // keeps the slot from being evicted, false if it no longer holds hash
+    bool pin(int index, uint64_t hash) {
+        std::lock_guard<std::mutex> lock(mutex); // not while store picks a victim
+        slot_t &slot = slots[index];
+        if (slot.hash.load(std::memory_order_relaxed) != hash) return false;
+        slot.pins.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unpin(int index) {
+        slots[index].pins.fetch_sub(1, std::memory_order_release);
+    }
+
+    // copies the body of a pinned slot to out (body_size + 1 bytes, terminated), returns its length
+    size_t body(int index, char *out) {
+        std::lock_guard<std::mutex> lock(mutex); // a store of the same url may rewrite it
+        slot_t &slot = slots[index];
+        memcpy(out, slot.body, slot.len);
+        out[slot.len] = 0;
+        return slot.len;
+    }
+
+private:
+    struct slot_t {
+        std::atomic<uint32_t> seq = 0;
+        std::atomic<uint64_t> hash = 0; // 0 - empty
+        std::atomic<bool> referenced = false;
+        std::atomic<int> pins = 0;
+        uint64_t expiry = 0;
+        char url[url_size] = {};
+        char etag[cacheValidatorSize] = {};
+        char lastModified[cacheValidatorSize] = {};
+        size_t len = 0;
+        char body[body_size];
+    };
+
+    std::mutex mutex;
+    int hands[sets] = {};
+    slot_t slots[sets * ways];
+};
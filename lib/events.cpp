@@ -6,6 +6,7 @@
 #include <time.h>
 #include <string.h>
 #include "events.h"
+#include "trace.h"
 
 
 static uint64_t ev_now_us() {
@@ -64,7 +65,9 @@ static uint64_t ev_timer_check_expired(struct ev_loop *loop) {
         }
 
         // call the timer fn
+        SNOW_TRACE_EVENT(TRACE_TIMER_BEGIN, 0, 0);
         tmr->cb(loop, tmr, 1);
+        SNOW_TRACE_EVENT(TRACE_TIMER_END, 0, 0);
 
         // If timer is still running (user did not cancel it)
         if (tmr->running) {
@@ -110,6 +113,7 @@ static int ev_loop(void *arg) {
 
     // Poll for events
     int event_count = epoll_wait(loop->pfd, events, MAX_EVENTS, 0);
+    if (event_count > 0) SNOW_TRACE_EVENT(TRACE_EPOLL, 0, event_count);
 
 //#define TEST
 #ifdef TEST
@@ -136,7 +140,9 @@ static int ev_loop(void *arg) {
 
                 while (p && p->fd == fd) {
                     if (p->mode == EV_READ) {
+                        SNOW_TRACE_EVENT(TRACE_IO_BEGIN, fd, EV_READ);
                         p->cb(loop, p, 1);
+                        SNOW_TRACE_EVENT(TRACE_IO_END, fd, EV_READ);
                         break;
                     }
                     p = p->next;
@@ -148,7 +154,9 @@ static int ev_loop(void *arg) {
 
                 while (p && p->fd == fd) {
                     if (p->mode == EV_WRITE) {
+                        SNOW_TRACE_EVENT(TRACE_IO_BEGIN, fd, EV_WRITE);
                         p->cb(loop, p, 1);
+                        SNOW_TRACE_EVENT(TRACE_IO_END, fd, EV_WRITE);
                         break;
                     }
                     p = p->next;
@@ -294,6 +302,65 @@ void ev_io_start(struct ev_loop *loop, struct ev_io *ev) {
     }
 }
 
+// Starts n watchers with one pass over the list & one epoll_ctl per fd (a read & a write watcher of a new socket share it),
+// evs is sorted by fd in place. Watchers already started are skipped.
+void ev_io_start_batch(struct ev_loop *loop, struct ev_io **evs, int n) {
+    struct ev_io *p, *pp, *q;
+    int i, j;
+
+    struct epoll_event event;
+    loop = ev_setup(loop);
+
+    // Sort by fd like the list, batches are small
+    for (i = 1; i < n; i++) {
+        struct ev_io *ev = evs[i];
+        for (j = i; j > 0 && evs[j - 1]->fd > ev->fd; j--) evs[j] = evs[j - 1];
+        evs[j] = ev;
+    }
+
+    pp = NULL, p = loop->ihead;
+    for (i = 0; i < n;) {
+        int fd = evs[i]->fd, registered, inserted = 0;
+        uint32_t events = 0;
+
+        // Move to the fd's position, p is the first monitor of the fd if there is one
+        while (p && p->fd < fd) {
+            pp = p;
+            p = p->next;
+        }
+        registered = p && p->fd == fd;
+        for (q = p; q && q->fd == fd; q = q->next) events |= q->mode == EV_READ ? EPOLLIN : EPOLLOUT;
+
+        for (; i < n && evs[i]->fd == fd; i++) {
+            struct ev_io *ev = evs[i];
+
+            // Make sure it is NOT already registered
+            for (q = p; q && q->fd == fd && q != ev; q = q->next);
+            if (q == ev) continue;
+
+            // Insert it first for the fd, as ev_io_start does
+            ev->next = p;
+            if (pp) pp->next = ev;
+            else loop->ihead = ev;
+            p = ev;
+
+            events |= ev->mode == EV_READ ? EPOLLIN : EPOLLOUT;
+            inserted = 1;
+        }
+        if (!inserted) continue;
+
+        event.events = events;
+        event.data.ptr = p; // Lets store the descriptor to the first
+
+        if (epoll_ctl(loop->pfd, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0) {
+            // The watchers stay listed but never fire, their owner's timeout catches it
+#ifdef TEST
+            wsc_log_err("EPOLL_CTL_%s failed fc:%d\n", registered ? "MOD" : "ADD", fd);
+#endif
+        }
+    }
+}
+
 void ev_io_stop(struct ev_loop *loop, struct ev_io *ev) {
 
     struct ev_io *p, *pp;
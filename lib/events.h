@@ -79,6 +79,8 @@ void ev_io_init(struct ev_io *ev, ev_io_cb_t cb, int fd, int mode);
 
 void ev_io_start(struct ev_loop *loop, struct ev_io *ev);
 
+void ev_io_start_batch(struct ev_loop *loop, struct ev_io **evs, int n);
+
 void ev_io_stop(struct ev_loop *loop, struct ev_io *ev);
 
 void ev_signal_init(struct ev_signal *sgn, ev_signal_cb_t signal_cb, int signum);
@@ -93,6 +95,10 @@ void ev_signal_stop(struct ev_loop *loop, struct ev_signal *sgn);
 #include <ev.h>
 #define ev_init(argc, argv)
 
+static inline void ev_io_start_batch(struct ev_loop *loop, struct ev_io **evs, int n) {
+    for (int i = 0; i < n; i++) ev_io_start(loop, evs[i]);
+}
+
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,123 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Log-linear latency histograms, HDR style: every power of two is split into histogramSubBuckets
+ * linear sub-buckets, so values are kept with ~1/16 relative precision from 1ns up to 2^64.
+ *
+ * A snow_histogram_t has a single writer (its loop), readers take snapshots with relaxed loads
+ * at any time without stopping the writer, a snapshot may miss the records in flight.
+ */
+
+constexpr int histogramSubBits = 4;
+constexpr int histogramSubBuckets = 1 << histogramSubBits;
+constexpr int histogramBuckets = (64 - histogramSubBits + 1) * histogramSubBuckets;
+
+struct snow_histogram_t {
+    std::atomic<uint64_t> counts[histogramBuckets];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+struct snow_histogram_snapshot_t {
+    uint64_t counts[histogramBuckets];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+inline int snow_histogram_bucket(uint64_t value) {
+    if (value < histogramSubBuckets) return (int) value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - histogramSubBits;
+    return (shift + 1) * histogramSubBuckets + (int) ((value >> shift) & (histogramSubBuckets - 1));
+}
+
+// lowest value that lands in bucket
+inline uint64_t snow_histogram_lowest(int bucket) {
+    if (bucket < histogramSubBuckets) return bucket;
+
+    int shift = bucket / histogramSubBuckets - 1;
+    return (uint64_t) (histogramSubBuckets + bucket % histogramSubBuckets) << shift;
+}
+
+// writer side, only ever called by the owning loop
+inline void snow_histogram_record(snow_histogram_t *h, uint64_t value) {
+    std::atomic<uint64_t> &count = h->counts[snow_histogram_bucket(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    h->sum.store(h->sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > h->max.load(std::memory_order_relaxed)) h->max.store(value, std::memory_order_relaxed);
+    h->total.store(h->total.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// safe from any thread
+inline void snow_histogram_snapshot(const snow_histogram_t *h, snow_histogram_snapshot_t *out) {
+    out->total = h->total.load(std::memory_order_acquire);
+    out->sum = h->sum.load(std::memory_order_relaxed);
+    out->max = h->max.load(std::memory_order_relaxed);
+    for (int i = 0; i < histogramBuckets; i++)
+        out->counts[i] = h->counts[i].load(std::memory_order_relaxed);
+}
+
+inline void snow_histogram_clear(snow_histogram_snapshot_t *s) {
+    memset(s, 0, sizeof(snow_histogram_snapshot_t));
+}
+
+inline void snow_histogram_merge(snow_histogram_snapshot_t *into, const snow_histogram_snapshot_t *from) {
+    for (int i = 0; i < histogramBuckets; i++)
+        into->counts[i] += from->counts[i];
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) into->max = from->max;
+}
+
+// value at quantile q in [0, 1], the lowest value of its bucket, the exact max for q = 1
+inline uint64_t snow_histogram_percentile(const snow_histogram_snapshot_t *s, double q) {
+    uint64_t total = 0;
+    for (int i = 0; i < histogramBuckets; i++) total += s->counts[i]; // total may lag the buckets
+    if (total == 0) return 0;
+    if (q >= 1.0) return s->max;
+
+    uint64_t rank = (uint64_t) (q * (double) total) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < histogramBuckets; i++) {
+        seen += s->counts[i];
+        if (seen >= rank) return snow_histogram_lowest(i);
+    }
+    return s->max;
+}
+
+inline double snow_histogram_mean(const snow_histogram_snapshot_t *s) {
+    return s->total ? (double) s->sum / (double) s->total : 0.0;
+}
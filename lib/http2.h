@@ -0,0 +1,464 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/*
+ * HTTP/2 framing (RFC 9113) & HPACK (RFC 7541) for SNOW_HTTP2, no allocations.
+ * The dynamic tables live as long as their connection, both sides keep the default 4096 byte size.
+ */
+
+constexpr char h2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t h2FrameHeaderSize = 9;
+constexpr uint32_t h2MaxFrameSize = 16384; // SETTINGS_MAX_FRAME_SIZE, the minimum, never raised on either side
+constexpr uint32_t h2DefaultWindow = 65535;
+constexpr size_t hpackTableSize = 4096; // SETTINGS_HEADER_TABLE_SIZE
+
+enum h2_frame_enum {
+    H2_DATA, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS, H2_PUSH_PROMISE, H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION
+};
+
+enum h2_flag_enum {
+    H2_END_STREAM = 0x1, H2_ACK = 0x1, H2_END_HEADERS = 0x4, H2_PADDED = 0x8, H2_PRIORITY_FLAG = 0x20
+};
+
+enum h2_setting_enum {
+    H2_HEADER_TABLE_SIZE = 1, H2_ENABLE_PUSH, H2_MAX_CONCURRENT_STREAMS, H2_INITIAL_WINDOW_SIZE, H2_MAX_FRAME_SIZE, H2_MAX_HEADER_LIST_SIZE
+};
+
+enum h2_error_code_enum {
+    H2_NO_ERROR, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR, H2_FLOW_CONTROL_ERROR, H2_SETTINGS_TIMEOUT, H2_STREAM_CLOSED, H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM, H2_CANCEL, H2_COMPRESSION_ERROR
+};
+
+static inline uint32_t snow_h2_read32(const uint8_t *in) {
+    return (uint32_t) in[0] << 24U | (uint32_t) in[1] << 16U | (uint32_t) in[2] << 8U | in[3];
+}
+
+static inline char *snow_h2_write32(char *out, uint32_t value) {
+    out[0] = (char) (value >> 24U);
+    out[1] = (char) (value >> 16U);
+    out[2] = (char) (value >> 8U);
+    out[3] = (char) value;
+    return out + 4;
+}
+
+// writes a frame header, the payload goes right after it
+static inline char *snow_h2_frameHeader(char *out, size_t len, int type, int flags, uint32_t streamId) {
+    out[0] = (char) (len >> 16U);
+    out[1] = (char) (len >> 8U);
+    out[2] = (char) len;
+    out[3] = (char) type;
+    out[4] = (char) flags;
+    return snow_h2_write32(out + 5, streamId);
+}
+
+static inline size_t snow_h2_frameLen(const uint8_t *frame) {
+    return (size_t) frame[0] << 16U | (size_t) frame[1] << 8U | frame[2];
+}
+
+enum h2_block_enum {
+    H2_BLOCK_PARTIAL, // frames of the block are still on their way
+    H2_BLOCK_COMPLETE,
+    H2_BLOCK_ERROR // the HEADERS frame is followed by something else than CONTINUATION frames of its stream
+};
+
+/*
+ * Finds the end of the header block starting with the complete HEADERS frame at frame, len bytes are there from frame on.
+ * Only reads within them, H2_BLOCK_COMPLETE sets *end past the block's last CONTINUATION frame.
+ */
+static inline int snow_h2_blockEnd(const uint8_t *frame, size_t len, size_t *end) {
+    uint32_t streamId = snow_h2_read32(frame + 5) & 0x7fffffffU;
+    size_t at = h2FrameHeaderSize + snow_h2_frameLen(frame);
+
+    for (int flags = frame[4]; !(flags & H2_END_HEADERS);) {
+        if (at > len || len - at < h2FrameHeaderSize) return H2_BLOCK_PARTIAL;
+
+        const uint8_t *cont = frame + at;
+        size_t contLen = snow_h2_frameLen(cont);
+        if (cont[3] != H2_CONTINUATION || (snow_h2_read32(cont + 5) & 0x7fffffffU) != streamId || contLen > h2MaxFrameSize)
+            return H2_BLOCK_ERROR;
+
+        flags = cont[4];
+        at += h2FrameHeaderSize + contLen;
+    }
+
+    if (at > len) return H2_BLOCK_PARTIAL;
+    *end = at;
+    return H2_BLOCK_COMPLETE;
+}
+
+/*
+ * Joins a complete header block in place, see snow_h2_blockEnd: the HEADERS fragment without padding & priority, the
+ * CONTINUATION fragments moved right after it, from frame + h2FrameHeaderSize on. Returns its length, -1 if malformed.
+ */
+static inline long snow_h2_joinBlock(uint8_t *frame, size_t end) {
+    uint8_t *payload = frame + h2FrameHeaderSize;
+    size_t len = snow_h2_frameLen(frame);
+    int flags = frame[4];
+
+    if ((flags & H2_PADDED) && len == 0) return -1;
+    size_t offset = flags & H2_PADDED ? 1 : 0, padding = flags & H2_PADDED ? payload[0] : 0;
+    if (flags & H2_PRIORITY_FLAG) offset += 5;
+    if (offset + padding > len) return -1;
+
+    size_t blockLen = len - offset - padding;
+    memmove(payload, payload + offset, blockLen);
+
+    for (size_t at = h2FrameHeaderSize + len; at < end;) {
+        uint8_t *cont = frame + at;
+        size_t contLen = snow_h2_frameLen(cont);
+        memmove(payload + blockLen, cont + h2FrameHeaderSize, contLen);
+        blockLen += contLen;
+        at += h2FrameHeaderSize + contLen;
+    }
+    return (long) blockLen;
+}
+
+///// HPACK
+
+inline constexpr const char *hpackStaticTable[61][2] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+        {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+        {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+        {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""},
+        {"cache-control", ""}, {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""}, {"etag", ""},
+        {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""},
+        {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""},
+        {"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+        {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""}, {"user-agent", ""},
+        {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+};
+constexpr uint32_t hpackStaticSize = 61;
+
+// code length of every symbol, 256 - EOS, the code is canonical so the lengths are all it takes
+inline constexpr uint8_t hpackHuffmanLengths[257] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10, 13, 6, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6,
+        6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24,
+        24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21,
+        21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19,
+        21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26,
+        27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30
+};
+
+// canonical decoding tables, per code length
+struct snow_hpack_huffman_t {
+    uint32_t firstCode[31] = {};
+    int firstIndex[31] = {};
+    int count[31] = {};
+    uint16_t symbols[257] = {}; // by code length, then symbol
+
+    snow_hpack_huffman_t() {
+        uint32_t code = 0;
+        int index = 0;
+        for (int len = 1; len <= 30; len++) {
+            firstCode[len] = code;
+            firstIndex[len] = index;
+            for (int symbol = 0; symbol < 257; symbol++)
+                if (hpackHuffmanLengths[symbol] == len) symbols[index++] = symbol;
+            count[len] = index - firstIndex[len];
+            code = (code + count[len]) << 1U;
+        }
+    }
+};
+
+// decoded length, -1 if in is not a valid Huffman string or does not fit out
+static inline long snow_hpack_huffmanDecode(const uint8_t *in, size_t len, char *out, size_t outSize) {
+    static const snow_hpack_huffman_t huffman;
+    uint32_t code = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code = code << 1U | ((in[i] >> bit) & 1U);
+            if (++bits > 30) return -1;
+
+            if (code - huffman.firstCode[bits] < (uint32_t) huffman.count[bits]) {
+                int symbol = huffman.symbols[huffman.firstIndex[bits] + code - huffman.firstCode[bits]];
+                if (symbol == 256 || n == outSize) return -1; // EOS must not be encoded
+                out[n++] = (char) symbol;
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    if (bits > 7 || code != (1U << bits) - 1) return -1; // padding is the most significant bits of EOS, all ones
+    return (long) n;
+}
+
+// integer with an N bit prefix, false if it does not end before end or does not fit 28 bits
+static inline bool snow_hpack_decodeInt(const uint8_t **it, const uint8_t *end, int prefix, uint32_t *out) {
+    if (*it >= end) return false;
+
+    uint32_t max = (1U << prefix) - 1, value = **it & max;
+    (*it)++;
+    if (value < max) {
+        *out = value;
+        return true;
+    }
+
+    for (int shift = 0; *it < end && shift <= 21; shift += 7) {
+        uint8_t b = **it;
+        (*it)++;
+        value += (b & 0x7fU) << shift;
+        if (!(b & 0x80U)) {
+            *out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline char *snow_hpack_encodeInt(char *out, uint8_t flags, int prefix, uint32_t value) {
+    uint32_t max = (1U << prefix) - 1;
+    if (value < max) {
+        *out++ = (char) (flags | value);
+        return out;
+    }
+
+    *out++ = (char) (flags | max);
+    for (value -= max; value >= 0x80; value >>= 7U) *out++ = (char) ((value & 0x7fU) | 0x80U);
+    *out++ = (char) value;
+    return out;
+}
+
+// string literal, Huffman coded or not, copied to out - false if malformed or longer than outSize
+static inline bool snow_hpack_decodeString(const uint8_t **it, const uint8_t *end, char *out, size_t outSize, size_t *len) {
+    if (*it >= end) return false;
+
+    bool huffman = **it & 0x80U;
+    uint32_t size;
+    if (!snow_hpack_decodeInt(it, end, 7, &size) || size > (size_t) (end - *it)) return false;
+
+    if (huffman) {
+        long n = snow_hpack_huffmanDecode(*it, size, out, outSize);
+        if (n < 0) return false;
+        *len = n;
+    } else {
+        if (size > outSize) return false;
+        memcpy(out, *it, size);
+        *len = size;
+    }
+
+    *it += size;
+    return true;
+}
+
+// raw, the requests we send are short and Huffman coding them would cost more cpu than the bytes it saves
+static inline char *snow_hpack_encodeString(char *out, const char *value, size_t len) {
+    out = snow_hpack_encodeInt(out, 0, 7, len);
+    memcpy(out, value, len);
+    return out + len;
+}
+
+// dynamic table, one per direction of a connection - the encoder's mirrors the peer's decoder
+class snow_hpack_table_t {
+public:
+    size_t maxSize = hpackTableSize;
+
+    void clear() {
+        maxSize = hpackTableSize;
+        first = count = 0;
+        size = dataEnd = 0;
+    }
+
+    // name & value must not point into the table
+    void add(const char *name, size_t nameLen, const char *value, size_t valueLen) {
+        size_t entrySize = nameLen + valueLen + 32;
+        if (entrySize > maxSize) { // empties the table, see RFC 7541 4.4
+            count = 0;
+            size = dataEnd = 0;
+            return;
+        }
+        evict(maxSize - entrySize);
+
+        // live entries are contiguous from the oldest one, move them to the front once the end is reached
+        if (dataEnd + nameLen + valueLen > sizeof(data)) {
+            uint32_t base = count ? entries[(first + count - 1) % entriesMax].offset : dataEnd;
+            memmove(data, data + base, dataEnd - base);
+            for (int i = 0; i < count; i++) entries[(first + i) % entriesMax].offset -= base;
+            dataEnd -= base;
+        }
+
+        first = (first + entriesMax - 1) % entriesMax;
+        entries[first] = {(uint32_t) dataEnd, (uint32_t) nameLen, (uint32_t) valueLen};
+        memcpy(data + dataEnd, name, nameLen);
+        memcpy(data + dataEnd + nameLen, value, valueLen);
+        dataEnd += nameLen + valueLen;
+        size += entrySize;
+        count++;
+    }
+
+    void resize(size_t max) {
+        maxSize = max;
+        evict(max);
+    }
+
+    // HPACK index, static entries first, false if out of range
+    bool get(uint32_t index, const char **name, size_t *nameLen, const char **value, size_t *valueLen) const {
+        if (index == 0) return false;
+        if (index <= hpackStaticSize) {
+            *name = hpackStaticTable[index - 1][0];
+            *value = hpackStaticTable[index - 1][1];
+            *nameLen = strlen(*name);
+            *valueLen = strlen(*value);
+            return true;
+        }
+
+        index -= hpackStaticSize + 1;
+        if (index >= (uint32_t) count) return false;
+        const entry_t &entry = entries[(first + index) % entriesMax];
+        *name = data + entry.offset;
+        *nameLen = entry.nameLen;
+        *value = data + entry.offset + entry.nameLen;
+        *valueLen = entry.valueLen;
+        return true;
+    }
+
+    // HPACK index of the field, *exact - the value matches too, 0 if not even the name is there
+    uint32_t find(const char *name, size_t nameLen, const char *value, size_t valueLen, bool *exact) const {
+        uint32_t nameIndex = 0;
+        *exact = false;
+
+        for (uint32_t i = 0; i < hpackStaticSize; i++) {
+            if (strlen(hpackStaticTable[i][0]) != nameLen || memcmp(hpackStaticTable[i][0], name, nameLen) != 0) continue;
+            if (strlen(hpackStaticTable[i][1]) == valueLen && memcmp(hpackStaticTable[i][1], value, valueLen) == 0) {
+                *exact = true;
+                return i + 1;
+            }
+            if (!nameIndex) nameIndex = i + 1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            const entry_t &entry = entries[(first + i) % entriesMax];
+            if (entry.nameLen != nameLen || memcmp(data + entry.offset, name, nameLen) != 0) continue;
+            if (entry.valueLen == valueLen && memcmp(data + entry.offset + nameLen, value, valueLen) == 0) {
+                *exact = true;
+                return hpackStaticSize + 1 + i;
+            }
+            if (!nameIndex) nameIndex = hpackStaticSize + 1 + i;
+        }
+        return nameIndex;
+    }
+
+private:
+    struct entry_t {
+        uint32_t offset, nameLen, valueLen;
+    };
+    static constexpr int entriesMax = hpackTableSize / 32;
+
+    void evict(size_t max) {
+        while (count && size > max) {
+            const entry_t &oldest = entries[(first + count - 1) % entriesMax];
+            size -= oldest.nameLen + oldest.valueLen + 32;
+            count--;
+        }
+        if (!count) dataEnd = 0;
+    }
+
+    entry_t entries[entriesMax] = {}; // ring, newest at first
+    int first = 0, count = 0;
+    size_t size = 0, dataEnd = 0;
+    char data[2 * hpackTableSize] = {};
+};
+
+enum hpack_indexing_enum {
+    HPACK_INDEXED, // added to the dynamic table, later ones are sent as a single index
+    HPACK_NOT_INDEXED,
+    HPACK_NEVER_INDEXED // intermediaries must not index it either, credentials
+};
+
+// appends a header field, HPACK_INDEXED ones are added to the encoder's table like the peer's decoder will
+static inline char *snow_hpack_encode(snow_hpack_table_t *table, char *out, const char *name, size_t nameLen, const char *value,
+                                      size_t valueLen, int indexing) {
+    bool exact;
+    uint32_t index = table->find(name, nameLen, value, valueLen, &exact);
+    if (exact && indexing != HPACK_NEVER_INDEXED) return snow_hpack_encodeInt(out, 0x80, 7, index);
+
+    if (indexing == HPACK_INDEXED) out = snow_hpack_encodeInt(out, 0x40, 6, index);
+    else out = snow_hpack_encodeInt(out, indexing == HPACK_NEVER_INDEXED ? 0x10 : 0x00, 4, index);
+
+    if (!index) out = snow_hpack_encodeString(out, name, nameLen);
+    out = snow_hpack_encodeString(out, value, valueLen);
+
+    if (indexing == HPACK_INDEXED) table->add(name, nameLen, value, valueLen);
+    return out;
+}
+
+/*
+ * Decodes a header block, calling on_header(name, nameLen, value, valueLen) for every field, strings are only valid
+ * during the call. scratch holds the literals, a field longer than scratchSize fails the block.
+ * Returns false on a malformed block, the connection has to go then, the table is out of sync.
+ */
+template<class on_header_t>
+static inline bool snow_hpack_decode(snow_hpack_table_t *table, const uint8_t *it, const uint8_t *end, char *scratch, size_t scratchSize,
+                                     on_header_t on_header) {
+    bool fieldSeen = false;
+
+    while (it < end) {
+        uint8_t b = *it;
+        uint32_t index;
+        const char *name, *value;
+        size_t nameLen, valueLen;
+
+        if (b & 0x80U) { // indexed field
+            if (!snow_hpack_decodeInt(&it, end, 7, &index) || !table->get(index, &name, &nameLen, &value, &valueLen)) return false;
+            on_header(name, nameLen, value, valueLen);
+            fieldSeen = true;
+            continue;
+        }
+
+        if ((b & 0xe0U) == 0x20) { // dynamic table size update, only before the first field
+            if (fieldSeen || !snow_hpack_decodeInt(&it, end, 5, &index) || index > hpackTableSize) return false;
+            table->resize(index);
+            continue;
+        }
+
+        // literal, with incremental indexing (01) or without (0000 / 0001)
+        bool indexing = b & 0x40U;
+        if (!snow_hpack_decodeInt(&it, end, indexing ? 6 : 4, &index)) return false;
+
+        if (index) {
+            if (!table->get(index, &name, &nameLen, &value, &valueLen) || nameLen > scratchSize) return false;
+            memcpy(scratch, name, nameLen); // the table may evict it while adding this field
+        } else if (!snow_hpack_decodeString(&it, end, scratch, scratchSize, &nameLen)) return false;
+
+        if (!snow_hpack_decodeString(&it, end, scratch + nameLen, scratchSize - nameLen, &valueLen)) return false;
+
+        on_header(scratch, nameLen, scratch + nameLen, valueLen);
+        if (indexing) table->add(scratch, nameLen, scratch + nameLen, valueLen);
+        fieldSeen = true;
+    }
+    return true;
+}
@@ -0,0 +1,285 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+#pragma once
+
+#include <coroutine>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "snowhttp.h"
+
+/*
+ * C++20 coroutine interface over snow_do, needs -std=c++20 (snowhttp itself stays C++17):
+ *
+ *     snow::task fetch(snow_global_t *global) {
+ *         snow::response_t r = co_await snow::get(global, "https://hostname.com/a");
+ *         if (r.err >= 0) co_return;
+ *         ... r.data is valid until the next co_await
+ *
+ *         char b[4096], c[4096];
+ *         auto [rb, rc] = co_await snow::when_all(snow::get(global, urlB).into(b, sizeof(b)), snow::get(global, urlC).into(c, sizeof(c)));
+ *     }
+ *
+ * A coroutine resumes right inside write_cb / err_cb, on the loop thread of the connection that served the request,
+ * without a thread hop or an allocation. Frames come from a per-thread pool, in practice per loop, and go back to the
+ * pool they came from wherever they are freed, see snow::co_alloc.
+ * A task is detached: it starts right away and frees its frame when it returns.
+ */
+
+SNOW_NAMESPACE_BEGIN
+
+namespace snow {
+    constexpr size_t coFrameGranularity = 128; // frame size classes
+    constexpr int coFrameClasses = 32; // up to 4KiB, larger frames come from operator new
+    constexpr size_t coPoolChunk = 1 << 16U; // frames are carved from chunks this large, which are never given back
+
+    // -1 if the request succeeded, otherwise an error_enum
+    struct response_t {
+        int err = -1;
+        const char *data = nullptr; // without into(): valid until the next suspension, nullptr in when_all
+        size_t len = 0; // of the body, what was copied with into()
+    };
+
+    namespace detail {
+        struct frame_pool_t;
+
+        // in front of every pooled frame, a coroutine frame needs no more than the default new alignment
+        struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_header_t {
+            frame_pool_t *owner; // the pool of the thread which carved the frame
+            size_t sizeClass;
+        };
+
+        // a free frame, the link lives right behind the header
+        struct pool_block_t {
+            frame_header_t header;
+            pool_block_t *next;
+        };
+
+        /*
+         * Size class free lists of one thread. A frame freed on another thread (a task spawned off-loop, resumed on
+         * a loop) is pushed on its owner's returned list, which the owner drains once its own list of the class runs dry.
+         */
+        struct frame_pool_t {
+            pool_block_t *free[coFrameClasses] = {};
+            std::atomic<pool_block_t *> returned = nullptr; // multiple producers, the owner takes the whole list
+            char *chunk = nullptr;
+            size_t chunkLeft = 0;
+        };
+
+        // created by the first co_alloc of the thread, never freed: its frames may still return after the thread exited
+        inline thread_local frame_pool_t *framePool = nullptr;
+
+        inline void drainReturned(frame_pool_t &pool) {
+            pool_block_t *block = pool.returned.exchange(nullptr, std::memory_order_acquire);
+            while (block) {
+                pool_block_t *next = block->next;
+                block->next = pool.free[block->header.sizeClass - 1];
+                pool.free[block->header.sizeClass - 1] = block;
+                block = next;
+            }
+        }
+    }
+
+    inline void *co_alloc(size_t size) {
+        size_t sizeClass = (size + sizeof(detail::frame_header_t) + coFrameGranularity - 1) / coFrameGranularity;
+        if (SNOW_UNLIKELY(sizeClass > coFrameClasses)) return ::operator new(size);
+
+        if (SNOW_UNLIKELY(!detail::framePool)) detail::framePool = new detail::frame_pool_t;
+        detail::frame_pool_t &pool = *detail::framePool;
+        detail::pool_block_t *block = pool.free[sizeClass - 1];
+        if (SNOW_UNLIKELY(!block && pool.returned.load(std::memory_order_relaxed))) {
+            detail::drainReturned(pool);
+            block = pool.free[sizeClass - 1];
+        }
+        if (SNOW_LIKELY(block)) {
+            pool.free[sizeClass - 1] = block->next;
+            return &block->header + 1;
+        }
+
+        size_t blockSize = sizeClass * coFrameGranularity;
+        if (pool.chunkLeft < blockSize) {
+            pool.chunk = (char *) ::operator new(coPoolChunk, std::align_val_t(64)); // the rest of the old chunk is lost
+            pool.chunkLeft = coPoolChunk;
+        }
+        auto *header = (detail::frame_header_t *) pool.chunk;
+        pool.chunk += blockSize;
+        pool.chunkLeft -= blockSize;
+
+        header->owner = &pool;
+        header->sizeClass = sizeClass;
+        return header + 1;
+    }
+
+    inline void co_free(void *frame, size_t size) {
+        size_t sizeClass = (size + sizeof(detail::frame_header_t) + coFrameGranularity - 1) / coFrameGranularity;
+        if (SNOW_UNLIKELY(sizeClass > coFrameClasses)) {
+            ::operator delete(frame);
+            return;
+        }
+
+        auto *block = (detail::pool_block_t *) ((detail::frame_header_t *) frame - 1);
+        detail::frame_pool_t *owner = block->header.owner;
+
+        if (SNOW_LIKELY(owner == detail::framePool)) {
+            block->next = owner->free[sizeClass - 1];
+            owner->free[sizeClass - 1] = block;
+            return;
+        }
+
+        block->next = owner->returned.load(std::memory_order_relaxed);
+        while (!owner->returned.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // detached coroutine, started eagerly, its frame is freed once it returns
+    struct task {
+        struct promise_type {
+            task get_return_object() noexcept { return {}; }
+
+            std::suspend_never initial_suspend() noexcept { return {}; }
+
+            std::suspend_never final_suspend() noexcept { return {}; }
+
+            void return_void() noexcept {}
+
+            void unhandled_exception() noexcept { std::terminate(); }
+
+            static void *operator new(size_t size) { return co_alloc(size); }
+
+            static void operator delete(void *frame, size_t size) { co_free(frame, size); }
+        };
+    };
+
+    // one snow_do, awaited on its own or through when_all
+    struct request_t {
+        snow_global_t *global;
+        int method;
+        const char *url; // copied by snow_do
+        const char *extraHeaders; // must outlive the request
+        size_t extraHeaders_size;
+
+        char *buffer = nullptr;
+        size_t bufferSize = 0;
+
+        response_t result;
+        std::coroutine_handle<> waiting;
+        std::atomic<int> *remaining = nullptr; // when_all, the last request to finish resumes
+
+        // the body is copied into buffer (truncated to size), data stays valid as long as buffer
+        request_t &&into(char *out, size_t size) && {
+            buffer = out;
+            bufferSize = size;
+            return std::move(*this);
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        // a request that fails right away (no free connection) resumes the coroutine inside snow_do, this is not
+        // touched once snow_do returns, the frame holding it may be gone by then
+        void await_suspend(std::coroutine_handle<> h) {
+            waiting = h;
+            start();
+        }
+
+        response_t await_resume() const noexcept { return result; }
+
+        void start() {
+            snow_do(global, method, url, on_write, on_err, this, extraHeaders, extraHeaders_size);
+        }
+
+        void complete(int err, char *data, size_t len) {
+            result.err = err;
+            result.len = len;
+            result.data = data;
+
+            if (buffer && data) {
+                result.len = len < bufferSize ? len : bufferSize;
+                memcpy(buffer, data, result.len);
+                result.data = buffer;
+            } else if (remaining) result.data = nullptr; // the connection is reused before the others finish
+
+            if (!remaining || remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) waiting.resume();
+        }
+
+        static void on_write(char *data, size_t len, void *extra) {
+            ((request_t *) extra)->complete(-1, data, len);
+        }
+
+        static void on_err(int err, void *extra) {
+            ((request_t *) extra)->complete(err, nullptr, 0);
+        }
+    };
+
+    inline request_t get(snow_global_t *global, const char *url, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0) {
+        return {global, GET, url, extraHeaders, extraHeaders_size};
+    }
+
+    inline request_t post(snow_global_t *global, const char *url, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0) {
+        return {global, POST, url, extraHeaders, extraHeaders_size};
+    }
+
+    inline request_t del(snow_global_t *global, const char *url, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0) {
+        return {global, DELETE, url, extraHeaders, extraHeaders_size};
+    }
+
+    // sends every request at once, resumes with their responses in order once all of them finished
+    template<size_t N>
+    struct when_all_t {
+        request_t requests[N];
+        std::atomic<int> remaining;
+
+        bool await_ready() const noexcept { return false; }
+
+        // holds one count itself, so requests finishing while the rest are started never resume the coroutine early
+        bool await_suspend(std::coroutine_handle<> h) {
+            remaining.store(N + 1, std::memory_order_relaxed);
+            for (request_t &r : requests) {
+                r.waiting = h;
+                r.remaining = &remaining;
+            }
+            for (request_t &r : requests) r.start();
+
+            return remaining.fetch_sub(1, std::memory_order_acq_rel) != 1; // all done already, go on without suspending
+        }
+
+        std::array<response_t, N> await_resume() const noexcept {
+            std::array<response_t, N> results;
+            for (size_t i = 0; i < N; i++) results[i] = requests[i].result;
+            return results;
+        }
+    };
+
+    template<class... requests_t>
+    when_all_t<sizeof...(requests_t)> when_all(requests_t &&... requests) {
+        return {{std::move(requests)...}};
+    }
+}
+
+SNOW_NAMESPACE_END
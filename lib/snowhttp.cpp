@@ -32,15 +32,531 @@ SOFTWARE.
 #include <climits>
 #include <chrono>
 #include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/mempolicy.h>
+
+#ifdef SNOW_WEBSOCKET
+#include <sys/random.h>
+#include "wolfssl/wolfcrypt/hash.h"
+#endif
 
-void snow_processConnError(snow_connection_t *conn, int err) {
-    if (conn->err_cb) conn->err_cb(err, conn->extra_cb);
+#ifdef SNOW_KTLS
+#include <linux/tls.h>
+#endif
+
+#ifdef SNOW_SNAPSHOT
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+SNOW_NAMESPACE_BEGIN
+
+static uint64_t snow_monotonic_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// vdso, no syscall
+static inline uint64_t snow_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static inline void snow_setStatus(snow_connection_t *conn, int status) {
+    conn->connectionStatus = status;
+    conn->statusTime[status] = snow_now_ns();
+    SNOW_TRACE_EVENT(TRACE_STATUS, conn->id, status);
+}
+
+#ifdef SNOW_MULTI_LOOP
+static thread_local snow_global_t *snow_currentGlobal = nullptr;
+static thread_local int snow_currentLoop = -1; // index of the loop running on this thread
+#endif
+
+static inline void snow_count(snow_loop_stats_t *stats, int stat, uint64_t n = 1) {
+    stats->counters[stat].fetch_add(n, std::memory_order_relaxed);
+}
+
+static inline snow_loop_stats_t *snow_connStats(snow_connection_t *conn) {
+    return &conn->global->stats[conn->loopId];
+}
+
+// the calling thread's cell
+static inline snow_loop_stats_t *snow_threadStats(snow_global_t *global) {
+#ifdef SNOW_MULTI_LOOP
+    return &global->stats[snow_currentLoop >= 0 ? snow_currentLoop : multi_loop_max];
+#else
+    return &global->stats[0];
+#endif
+}
+
+static inline void snow_countError(snow_loop_stats_t *stats, int err) {
+    stats->errors[err].fetch_add(1, std::memory_order_relaxed);
+}
+
+// hands the response, or err if >= 0, to the request's callable if it came with one, to write_cb / err_cb otherwise
+static void snow_deliver(const snow_callback_t *callback, void (*write_cb)(char *data, size_t data_len, void *extra),
+                         void (*err_cb)(int err, void *extra), void *extra, int err, char *data, size_t data_len, int statusCode) {
+    if (callback && callback->invoke) {
+        snow_response_t response = {err, err < 0 ? statusCode : 0, data, data_len};
+        callback->invoke((void *) callback->storage, &response); // the request's own copy
+    } else if (err < 0) {
+        if (write_cb) write_cb(data, data_len, extra);
+    } else if (err_cb) err_cb(err, extra);
+}
+
+snow_handle_t snow_start(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                         void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback, const char *extraHeaders,
+                         size_t extraHeaders_size, int hedgeDelay, uint64_t flightHash);
+
+void snow_startHedge(snow_connection_t *conn);
+
+#ifdef SNOW_HTTP2
+static bool snow_h2_attach(snow_connection_t *conn);
+static void snow_h2_begin(snow_connection_t *transport);
+static void snow_h2_read(snow_connection_t *transport);
+static void snow_h2_flush(snow_connection_t *transport);
+static void snow_h2_closeSession(snow_connection_t *transport, int err);
+static void snow_h2_closeStream(snow_connection_t *conn);
+
+constexpr int h2Transports = h2SessionsMax; // connections per loop kept out of freeConnections for sessions
+#else
+constexpr int h2Transports = 0;
+#endif
+
+#ifdef SNOW_WEBSOCKET
+static void snow_ws_bufferUpgrade(snow_connection_t *conn);
+static void snow_ws_read(snow_connection_t *conn);
+static void snow_ws_flush(snow_connection_t *conn);
+#endif
+
+#ifdef SNOW_MULTI_LOOP
+
+// connections [first, last) of loop id
+static int snow_loopFirstConn(int id) {
+    return id * concurrentConnections / multi_loop_n_runtime;
+}
+
+#endif
+
+// the arena bytes of share (a loop's connections, the last one the request queue), rounded up to whole pages
+static size_t snow_arenaShareSize(snow_global_t *global, int share) {
+#ifdef SNOW_MULTI_LOOP
+    int shares = multi_loop_n_runtime;
+    size_t size = share < shares ? sizeof(snow_connection_t) * (snow_loopFirstConn(share + 1) - snow_loopFirstConn(share))
+                                 : sizeof(*global->requestQueue);
+#else
+    int shares = 1;
+    size_t size = share < shares ? sizeof(snow_connection_t) * concurrentConnections : sizeof(*global->requestQueue);
+#endif
+    return (size + global->arena.pageSize - 1) & ~(global->arena.pageSize - 1);
+}
+
+static bool snow_hasFreeConn(snow_global_t *global) {
+#ifdef SNOW_MULTI_LOOP
+    for (int id = 0; id < multi_loop_n_runtime; id++)
+        if (!global->freeConnections[id].empty()) return true;
+    return false;
+#else
+    return !global->freeConnections.empty();
+#endif
+}
+
+#ifdef SNOW_QUEUEING_ENABLED
+
+// hands free connections to the highest priority queued requests, dropping the expired ones
+void snow_dispatchQueued(snow_global_t *global) {
+    snow_bareRequest_t req;
+    int priority;
+
+    while (snow_hasFreeConn(global) && global->requestQueue->pop(req, &priority)) {
+        if (req.deadline && snow_monotonic_ms() > req.deadline) {
+            snow_countError(snow_threadStats(global), DEADLINE_EXCEEDED);
+            snow_deliver(&req.callback, req.write_cb, req.err_cb, req.extra_cb, DEADLINE_EXCEEDED, nullptr, 0, 0);
+            continue;
+        }
+
+        if (!snow_start(global, req.method, req.requestUrl, req.write_cb, req.err_cb, req.extra_cb, &req.callback, req.extraHeaders,
+                        req.extraHeaders_size, 0, 0)) {
+            // lost the free connection to another thread
+            if (!global->requestQueue->push_front(req, priority)) {
+                snow_countError(snow_threadStats(global), NO_FREE_CONN);
+                snow_deliver(&req.callback, req.write_cb, req.err_cb, req.extra_cb, NO_FREE_CONN, nullptr, 0, 0);
+            }
+            return;
+        }
+    }
+}
+
+// drops queued requests whose deadline passed, even while no connection is free
+void snow_expireQueued(snow_global_t *global) {
+    constexpr size_t maxExpired = 16;
+    snow_bareRequest_t expired[maxExpired];
+
+    uint64_t now = snow_monotonic_ms();
+    size_t n;
+
+    do {
+        n = global->requestQueue->extract_if([now](const snow_bareRequest_t &req) { return req.deadline && now > req.deadline; },
+                                            expired, maxExpired);
+        for (size_t i = 0; i < n; i++) {
+            snow_countError(snow_threadStats(global), DEADLINE_EXCEEDED);
+            snow_deliver(&expired[i].callback, expired[i].write_cb, expired[i].err_cb, expired[i].extra_cb, DEADLINE_EXCEEDED, nullptr, 0, 0);
+        }
+    } while (n == maxExpired);
+}
+
+#endif
+
+// must be the last use of conn, another thread may take it over right after
+void snow_releaseConn(snow_connection_t *conn) {
+    snow_global_t *global = conn->global;
+
+    SNOW_TRACE_EVENT(TRACE_STATUS, conn->id, CONN_DONE);
+    conn->connectionStatus = CONN_DONE;
+#ifdef SNOW_RESPONSE_CACHE
+    if (conn->cacheSlot) global->responseCache.unpin(conn->cacheSlot - 1);
+#endif
+#ifdef SNOW_MULTI_LOOP
+    global->loopActive[conn->loopId][conn->id / 64] &= ~(1ULL << (conn->id % 64U));
+    global->loopLoad[conn->loopId].fetch_sub(1, std::memory_order_relaxed);
+#endif
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION) return; // its slot belongs to the session, see snow_h2_transportId
+#endif
+#ifdef SNOW_MULTI_LOOP
+    global->freeConnections[conn->loopId].push(conn->id);
+#else
+    global->freeConnections.push(conn->id);
+#endif
+}
+
+#ifdef SNOW_MULTI_LOOP
+
+// FNV-1a over the host[:port] part of the url
+static uint32_t snow_hostHash(const char *url) {
+    const char *it = strstr(url, "://");
+    it = it ? it + 3 : url;
+
+    uint32_t hash = 2166136261U;
+    for (; *it != '/' && *it != '\0'; it++) {
+        hash ^= (uint8_t) *it;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static int snow_leastLoadedLoop(snow_global_t *global) {
+    unsigned start = global->rr_loop.fetch_add(1, std::memory_order_relaxed); // rotate the start so ties are spread
+    int best = (int) (start % multi_loop_n_runtime);
+    int bestLoad = global->loopLoad[best].load(std::memory_order_relaxed);
+
+    for (int i = 1; i < multi_loop_n_runtime && bestLoad > 0; i++) {
+        int id = (int) ((start + i) % multi_loop_n_runtime);
+        int load = global->loopLoad[id].load(std::memory_order_relaxed);
+        if (load < bestLoad) best = id, bestLoad = load;
+    }
+    return best;
+}
+
+int snow_selectLoop(snow_global_t *global, const char *url) {
+    if (global->loopSelect) return global->loopSelect(global, url);
+
+    switch (loopPolicy) {
+        case LOOP_LEAST_OUTSTANDING:
+            return snow_leastLoadedLoop(global);
+
+        case LOOP_POWER_OF_TWO: {
+            static thread_local uint32_t seed = 2463534242U ^ (uint32_t) (uintptr_t) &seed;
+            seed ^= seed << 13U, seed ^= seed >> 17U, seed ^= seed << 5U; // xorshift32
+            int a = (int) (seed % multi_loop_n_runtime);
+            int b = (int) ((seed >> 16U) % multi_loop_n_runtime);
+            return global->loopLoad[a].load(std::memory_order_relaxed) <= global->loopLoad[b].load(std::memory_order_relaxed) ? a : b;
+        }
+
+        case LOOP_HOST_AFFINITY: {
+            int id = (int) (snow_hostHash(url) % multi_loop_n_runtime);
+            if (loopStealThreshold) {
+                int least = snow_leastLoadedLoop(global);
+                if (global->loopLoad[id].load(std::memory_order_relaxed) - global->loopLoad[least].load(std::memory_order_relaxed) >= loopStealThreshold)
+                    return least; // affine loop is overloaded, let another one take the request
+            }
+            return id;
+        }
+
+        default:
+            return (int) (global->rr_loop.fetch_add(1, std::memory_order_relaxed) % multi_loop_n_runtime);
+    }
+}
+
+#endif
+
+// FNV-1a over url & extraHeaders, never 0 - coalescing & response cache key
+static uint64_t snow_flightHash(const char *url, const char *extraHeaders, size_t extraHeaders_size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *it = url; *it; it++) hash = (hash ^ (uint8_t) *it) * 1099511628211ULL;
+    for (size_t i = 0; i < extraHeaders_size; i++) hash = (hash ^ (uint8_t) extraHeaders[i]) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+// attaches the GET to an identical one in flight & returns the waiter's handle, 0 if there is none
+static snow_handle_t snow_joinFlight(snow_global_t *global, uint64_t hash, const char *url, const char *extraHeaders, size_t extraHeaders_size,
+                                     void (*write_cb)(char *data, size_t data_len, void *extra), void (*err_cb)(int err, void *extra),
+                                     void *extra, const snow_callback_t *callback) {
+    snow_flight_t *flight = &global->flights[hash & (coalesceIndexSize - 1)];
+    if (flight->hash.load(std::memory_order_relaxed) != hash) return 0; // nothing in flight for the key, no lock taken
+
+    std::lock_guard<std::mutex> lock(flight->lock);
+    if (flight->hash.load(std::memory_order_relaxed) != hash || strcmp(flight->url, url) != 0 || flight->extraHeaders_size != extraHeaders_size ||
+        (extraHeaders_size && memcmp(flight->extraHeaders, extraHeaders, extraHeaders_size) != 0))
+        return 0;
+    if (flight->leaderCancelled && flight->waiters < 0) return 0; // being aborted, nobody waits for it anymore
+
+    int id;
+    if (!global->freeWaiters.pop(id)) return 0;
+
+    snow_waiter_t *waiter = &global->waiters[id];
+    waiter->write_cb = write_cb;
+    waiter->err_cb = err_cb;
+    waiter->extra = extra;
+    waiter->callback.invoke = nullptr;
+    if (callback) waiter->callback = *callback;
+    waiter->next = flight->waiters;
+    __atomic_store_n(&waiter->flight, (int) (flight - global->flights), __ATOMIC_RELAXED);
+    waiter->generation++;
+    flight->waiters = id;
+    snow_count(snow_threadStats(global), STAT_COALESCED);
+    return (snow_handle_t) waiter->generation << 32U | (unsigned) (concurrentConnections + id);
+}
+
+// lets identical GETs attach to conn's request, unless its index slot is taken
+static void snow_startFlight(snow_connection_t *conn, uint64_t hash, const char *url, snow_handle_t handle) {
+    int index = (int) (hash & (coalesceIndexSize - 1));
+    snow_flight_t *flight = &conn->global->flights[index];
+
+    std::lock_guard<std::mutex> lock(flight->lock);
+    if (flight->hash.load(std::memory_order_relaxed) != 0) return;
+
+    strcpy(flight->url, url);
+    flight->extraHeaders = conn->extraHeaders;
+    flight->extraHeaders_size = conn->extraHeaders_size;
+    flight->handle = handle;
+    flight->waiters = -1;
+    flight->leaderCancelled = false;
+    flight->hash.store(hash, std::memory_order_relaxed);
+    conn->flight = index + 1;
+}
+
+// detaches the GETs waiting on conn's response, identical GETs start a new flight from here on
+static int snow_endFlight(snow_connection_t *conn) {
+    if (!conn->flight) return -1;
+
+    snow_flight_t *flight = &conn->global->flights[conn->flight - 1];
+    conn->flight = 0;
+
+    std::lock_guard<std::mutex> lock(flight->lock);
+    int waiters = flight->waiters;
+    flight->waiters = -1;
+    flight->hash.store(0, std::memory_order_relaxed);
+    return waiters;
+}
+
+// snow_cancel of an attached GET, only its callbacks go, the request in flight too once its first GET was cancelled
+// & nobody else waits. False if the waiter was detached already, its response or error is on the way
+static bool snow_cancelWaiter(snow_global_t *global, int id, uint32_t generation) {
+    snow_waiter_t *waiter = &global->waiters[id];
+    snow_flight_t *flight = &global->flights[__atomic_load_n(&waiter->flight, __ATOMIC_RELAXED)];
+    snow_waiter_t cancelled;
+    snow_handle_t abandoned = 0;
+    {
+        std::lock_guard<std::mutex> lock(flight->lock);
+        int *link = &flight->waiters;
+        while (*link >= 0 && *link != id) link = &global->waiters[*link].next;
+        if (*link < 0 || waiter->generation != generation) return false; // not on this flight (anymore), or a later GET's
+
+        *link = waiter->next;
+        cancelled = *waiter;
+        if (flight->waiters < 0 && flight->leaderCancelled) abandoned = flight->handle;
+    }
+    global->freeWaiters.push(id);
+
+    snow_deliver(&cancelled.callback, cancelled.write_cb, cancelled.err_cb, cancelled.extra, CANCELLED, nullptr, 0, 0);
+    if (abandoned) snow_cancel(global, abandoned);
+    return true;
+}
+
+// snow_cancel of a GET others wait on, true if it goes on for them, its own callbacks are then the caller's to drop
+static bool snow_detachLeader(snow_connection_t *conn) {
+    if (!conn->flight) return false;
+
+    snow_flight_t *flight = &conn->global->flights[conn->flight - 1];
+    std::lock_guard<std::mutex> lock(flight->lock);
+    if (flight->waiters < 0) return false;
+    flight->leaderCancelled = true; // the last waiter's snow_cancel aborts it
+    return true;
+}
+
+// hands the response, or err if >= 0, to the detached waiters
+static void snow_notifyWaiters(snow_global_t *global, int id, char *data, size_t data_len, int err, int statusCode) {
+    while (id >= 0) {
+        snow_waiter_t waiter = global->waiters[id];
+        global->freeWaiters.push(id);
+
+        snow_deliver(&waiter.callback, waiter.write_cb, waiter.err_cb, waiter.extra, err, data, data_len, statusCode);
+
+        id = waiter.next;
+    }
+}
+
+#if defined(SNOW_RESPONSE_CACHE) || defined(SNOW_WEBSOCKET)
+
+// value of the response header name (with its colon) in [begin, end), case-insensitive, nullptr if absent
+static const char *snow_findHeader(const char *begin, const char *end, const char *name, size_t *len) {
+    size_t nameLen = strlen(name);
+
+    for (const char *line = begin; line < end;) {
+        const char *eol = (const char *) memchr(line, '\n', end - line);
+        if (!eol) eol = end;
+
+        if ((size_t) (eol - line) > nameLen && strncasecmp(line, name, nameLen) == 0) {
+            const char *value = line + nameLen, *valueEnd = eol;
+            while (value < valueEnd && (*value == ' ' || *value == '\t')) value++;
+            while (valueEnd > value && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ')) valueEnd--;
+            *len = valueEnd - value;
+            return value;
+        }
+        line = eol + 1;
+    }
+    return nullptr;
+}
+
+#endif
+
+#ifdef SNOW_RESPONSE_CACHE
+
+static thread_local char snow_cacheBody[cacheBodySize + 1]; // cached bodies handed to write_cb
+static_assert(cacheBodySize < connBufferSize, "a revalidated body is copied into the connection's readBuff");
+
+
+// answers the GET from the response cache if its entry is fresh, on the calling thread
+static bool snow_serveCached(snow_global_t *global, uint64_t hash, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                             void *extra, const snow_callback_t *callback) {
+    snow_cache_entry_t entry;
+    if (!global->responseCache.find(hash, url, &entry, snow_cacheBody) || entry.expiry <= snow_monotonic_ms()) return false;
+
+    snow_count(snow_threadStats(global), STAT_CACHE_HITS);
+    snow_deliver(callback, write_cb, nullptr, extra, -1, snow_cacheBody, entry.len, 200); // only 200s are cached
+    return true;
+}
+
+// keys the GET for the cache & pins its entry if it can be revalidated, before snow_parseUrl splits the url
+static bool snow_cacheLookup(snow_connection_t *conn, snow_cache_entry_t *entry) {
+    if (conn->hedge) return false; // snow_startHedge copied the key, the duplicate asks unconditionally
+
+    conn->cacheHash = snow_flightHash(conn->requestUrl, conn->extraHeaders, conn->extraHeaders_size);
+    strcpy(conn->cacheUrl, conn->requestUrl);
+
+    snow_cache_t<cacheSets, cacheWays, cacheBodySize, connUrlSize> &cache = conn->global->responseCache;
+    if (!cache.find(conn->cacheHash, conn->requestUrl, entry, nullptr) || (!entry->etag[0] && !entry->lastModified[0]))
+        return false;
+
+    if (!cache.pin(entry->slot, conn->cacheHash)) return false; // evicted meanwhile
+    conn->cacheSlot = entry->slot + 1;
+    return true;
+}
+
+// makes the buffered GET conditional, the validators go in front of the blank line ending its headers
+static void snow_bufferValidators(snow_connection_t *conn, const snow_cache_entry_t *entry) {
+    char *it = conn->writeBuff.buff + conn->writeBuff.head - 2;
+
+    if (entry->etag[0]) it += sprintf(it, "If-None-Match: %s\r\n", entry->etag);
+    if (entry->lastModified[0]) it += sprintf(it, "If-Modified-Since: %s\r\n", entry->lastModified);
+    it += sprintf(it, "\r\n");
+
+    conn->writeBuff.head = it - conn->writeBuff.buff;
+}
+
+// stores a 200 as Cache-Control allows, or swaps a 304 for the cached body
+static void snow_cacheResponse(snow_connection_t *conn) {
+    snow_cache_t<cacheSets, cacheWays, cacheBodySize, connUrlSize> &cache = conn->global->responseCache;
+    const char *headers = conn->readBuff.buff, *headersEnd = conn->content;
+    uint64_t now = snow_monotonic_ms();
+
+    bool noStore = false, noCache = false, hasMaxAge = false;
+    long maxAge = 0;
+    size_t len = 0;
+
+    const char *cacheControl = snow_findHeader(headers, headersEnd, "Cache-Control:", &len);
+    for (const char *it = cacheControl, *end = cacheControl + len; it && it < end;) {
+        while (it < end && (*it == ' ' || *it == ',')) it++;
+
+        if (strncasecmp(it, "no-store", 8) == 0) noStore = true;
+        else if (strncasecmp(it, "no-cache", 8) == 0) noCache = true;
+        else if (strncasecmp(it, "max-age=", 8) == 0) hasMaxAge = true, maxAge = strtol(it + 8, nullptr, 10);
+
+        it = (const char *) memchr(it, ',', end - it);
+    }
+    uint64_t expiry = hasMaxAge && !noCache && maxAge > 0 ? now + maxAge * 1000 : now; // now - revalidate every time
+
+    if (conn->statusCode == 304 && conn->cacheSlot) {
+        if (expiry > now) cache.refresh(conn->cacheSlot - 1, conn->cacheHash, expiry);
+        // into the connection's own buffer, the headers are parsed already & snow_cacheBody may be reused by a callback
+        conn->contentLen = cache.body(conn->cacheSlot - 1, conn->readBuff.buff);
+        conn->content = conn->readBuff.buff;
+        snow_count(snow_connStats(conn), STAT_CACHE_REVALIDATED);
+        return;
+    }
+
+    if (conn->statusCode != 200 || noStore || conn->contentLen > (size_t) cacheBodySize) return;
+
+    size_t etagLen = 0, lastModifiedLen = 0;
+    const char *etag = snow_findHeader(headers, headersEnd, "ETag:", &etagLen);
+    const char *lastModified = snow_findHeader(headers, headersEnd, "Last-Modified:", &lastModifiedLen);
+    if (!etag && !lastModified && expiry == now) return; // could never be used
+
+    cache.store(conn->cacheHash, conn->cacheUrl, expiry, etag, etagLen, lastModified, lastModifiedLen, conn->content, conn->contentLen);
+}
+
+#endif
+
+// while collecting (>= 0), snow_initConnection leaves its watchers to snow_startConns, which registers them in one pass
+static thread_local struct ev_io *snow_pendingIo[2 * batchChunkSize];
+static thread_local int snow_pendingIoN = -1;
+
+#ifdef SNOW_TLS_READ_AHEAD
+// ciphertext of the connection being read on this thread, wolfSSL takes it record by record, see snow_tls_recv
+struct snow_readAhead_t {
+    snow_connection_t *conn;
+    bool drained; // the last recv came back short, the socket is empty until its next readiness event
+    size_t head, tail;
+    char buff[tlsReadAheadSize];
+};
+static thread_local snow_readAhead_t snow_readAhead;
+#endif
+
+// closes the connection without any callback
+static void snow_closeConn(snow_connection_t *conn) {
+#ifdef SNOW_HTTP2
+    if (conn->h2Session) { // a stream gives its place to a waiting one, a connection fails its streams
+        if (conn->method == __H2_SESSION) snow_h2_closeSession(conn, HTTP2_ERROR);
+        else snow_h2_closeStream(conn);
+    }
+#endif
 
     if (conn->connectionStatus > CONN_UNREADY) {
         ev_io_stop(conn->loop, (ev_io *) &conn->ior);
         ev_io_stop(conn->loop, (ev_io *) &conn->iow);
     }
 
+    for (int i = 0; i < snow_pendingIoN; i++) // failed before snow_startConns registered it
+        if (snow_pendingIo[i] == (struct ev_io *) &conn->ior || snow_pendingIo[i] == (struct ev_io *) &conn->iow) snow_pendingIo[i] = nullptr;
+
+#ifdef SNOW_TLS_READ_AHEAD
+    if (snow_readAhead.conn == conn) snow_readAhead.conn = nullptr, snow_readAhead.head = snow_readAhead.tail = 0;
+#endif
+
     if (conn->sockfd != 0) {
         setsockopt(conn->sockfd, SOL_SOCKET, SO_LINGER, &sock_linger0, sizeof(struct linger));
         close(conn->sockfd);
@@ -48,10 +564,224 @@ void snow_processConnError(snow_connection_t *conn, int err) {
 
     if (conn->secure && conn->ssl) wolfSSL_free(conn->ssl);
 
-    conn->connectionStatus = CONN_DONE;
-    conn->global->freeConnections.push(conn->id);  // atomic if multi loop
+    snow_releaseConn(conn);
+}
+
+void snow_processConnError(snow_connection_t *conn, int err) {
+    snow_countError(snow_connStats(conn), err);
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION) snow_h2_closeSession(conn, err); // its streams get the error
+#endif
+
+    if (conn->hedgePeer) { // the other connection of the pair is still running, it reports instead
+        snow_connection_t *peer = &conn->global->connections[conn->hedgePeer - 1];
+        peer->hedgePeer = 0;
+        // snow_cancel of this request's handle now has to reach the peer
+        conn->hedgeSuccessor.store((snow_handle_t) peer->generation.load(std::memory_order_relaxed) << 32U | (unsigned) peer->id,
+                                   std::memory_order_release);
+    } else {
+        int waiters = snow_endFlight(conn);
+        snow_deliver(&conn->callback, conn->write_cb, conn->err_cb, conn->extra_cb, err, nullptr, 0, 0);
+        snow_notifyWaiters(conn->global, waiters, nullptr, 0, err, 0);
+    }
+
+    snow_closeConn(conn);
+}
+
+static inline bool snow_cancelRequested(snow_connection_t *conn) {
+    return conn->cancelGeneration.load(std::memory_order_acquire) == conn->generation.load(std::memory_order_relaxed);
+}
+
+// false if the request runs on without its callbacks, for the coalesced GETs waiting on it
+static bool snow_cancelConn(snow_connection_t *conn) {
+    if (snow_detachLeader(conn)) {
+        snow_callback_t callback = conn->callback;
+        void (*err_cb)(int err, void *extra) = conn->err_cb;
+        void *extra = conn->extra_cb;
+
+        conn->callback.invoke = nullptr;
+        conn->write_cb = nullptr;
+        conn->err_cb = nullptr;
+        if (conn->hedgePeer) { // the duplicate reports to the same callbacks
+            snow_connection_t *peer = &conn->global->connections[conn->hedgePeer - 1];
+            peer->callback.invoke = nullptr;
+            peer->write_cb = nullptr;
+            peer->err_cb = nullptr;
+        }
+        snow_deliver(&callback, nullptr, err_cb, extra, CANCELLED, nullptr, 0, 0);
+        return false;
+    }
+
+    if (conn->hedgePeer) { // the duplicate goes too
+        snow_connection_t *peer = &conn->global->connections[conn->hedgePeer - 1];
+        peer->hedgePeer = conn->hedgePeer = 0;
+        snow_closeConn(peer);
+    }
+    snow_processConnError(conn, CANCELLED);
+    return true;
+}
+
+// cancels the running requests snow_cancel marked for this loop, runs on the loop between iterations
+static void snow_processCancels(snow_global_t *global, int loopId) {
+    for (int word = 0; word < (concurrentConnections + 63) / 64; word++) {
+        if (!global->loopCancel[loopId][word].load(std::memory_order_relaxed)) continue;
+
+        uint64_t marked = global->loopCancel[loopId][word].exchange(0, std::memory_order_acquire);
+        while (marked) {
+            snow_connection_t *conn = &global->connections[word * 64 + __builtin_ctzll(marked)];
+            marked &= marked - 1;
+
+            // not picked up yet - snow_startConn checks, done - too late
+            if (conn->loopId == loopId && conn->connectionStatus > CONN_UNREADY && conn->connectionStatus < CONN_DONE && snow_cancelRequested(conn))
+                snow_cancelConn(conn);
+        }
+    }
+}
+
+#ifdef SNOW_KTLS
+
+static thread_local bool snow_ktlsMissing = false; // no tls module, not asked again by this thread
+
+// TLS_TX gets our (client) write key, TLS_RX the server's
+template<class info_t>
+static bool snow_ktls_set(snow_connection_t *conn, int direction, uint16_t cipher, uint64_t seq) {
+    bool tx = direction == TLS_TX;
+
+    info_t info = {};
+    info.info.version = TLS_1_2_VERSION;
+    info.info.cipher_type = cipher;
+    memcpy(info.key, tx ? wolfSSL_GetClientWriteKey(conn->ssl) : wolfSSL_GetServerWriteKey(conn->ssl), sizeof(info.key));
+    memcpy(info.salt, tx ? wolfSSL_GetClientWriteIV(conn->ssl) : wolfSSL_GetServerWriteIV(conn->ssl), sizeof(info.salt));
+    memcpy(info.iv, &seq, sizeof(info.iv)); // explicit nonce of the next record, the kernel counts on from it
+    memcpy(info.rec_seq, &seq, sizeof(info.rec_seq));
+
+    bool set = setsockopt(conn->sockfd, SOL_TLS, direction, &info, sizeof(info)) == 0;
+    explicit_bzero(&info, sizeof(info));
+    return set;
+}
+
+// hands the record layer of a finished TLS 1.2 AES-GCM handshake to the kernel, wolfSSL carries on otherwise
+static void snow_ktls_enable(snow_connection_t *conn) {
+    WOLFSSL *ssl = conn->ssl;
+    int keySize = wolfSSL_GetKeySize(ssl);
+
+    if (snow_ktlsMissing || wolfSSL_GetVersion(ssl) != WOLFSSL_TLSV1_2 || wolfSSL_GetBulkCipher(ssl) != wolfssl_aes_gcm ||
+        (keySize != 16 && keySize != 32) || wolfSSL_GetIVSize(ssl) != TLS_CIPHER_AES_GCM_128_SALT_SIZE || wolfSSL_pending(ssl))
+        return;
+
+    if (setsockopt(conn->sockfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+        if (errno == ENOENT) snow_ktlsMissing = true;
+        return;
+    }
+
+    // the next record numbers of both directions, the kernel counts on from them
+    word64 txSeq = 0, rxSeq = 0;
+    if (wolfSSL_GetSequenceNumber(ssl, &txSeq) < 0 || wolfSSL_GetPeerSequenceNumber(ssl, &rxSeq) < 0) return;
+    uint64_t tx = htobe64(txSeq), rx = htobe64(rxSeq);
+
+    if (keySize == 16) {
+        conn->ktlsTx = snow_ktls_set<tls12_crypto_info_aes_gcm_128>(conn, TLS_TX, TLS_CIPHER_AES_GCM_128, tx);
+        conn->ktlsRx = conn->ktlsTx && ktlsReceive && snow_ktls_set<tls12_crypto_info_aes_gcm_128>(conn, TLS_RX, TLS_CIPHER_AES_GCM_128, rx);
+    } else {
+        conn->ktlsTx = snow_ktls_set<tls12_crypto_info_aes_gcm_256>(conn, TLS_TX, TLS_CIPHER_AES_GCM_256, tx);
+        conn->ktlsRx = conn->ktlsTx && ktlsReceive && snow_ktls_set<tls12_crypto_info_aes_gcm_256>(conn, TLS_RX, TLS_CIPHER_AES_GCM_256, rx);
+    }
+    // RX only came in 4.17, TX alone still moves the encryption, the tls ulp passes plain data through if neither is set
+
+    if (conn->ktlsTx) snow_count(snow_connStats(conn), STAT_KTLS);
+}
+
+// read() of a kTLS RX socket, records other than application data are told apart: close_notify reads as closed
+static ssize_t snow_ktls_read(snow_connection_t *conn, char *buff, size_t len) {
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov = {buff, len};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t ret = recvmsg(conn->sockfd, &msg, 0);
+    if (ret <= 0) return ret;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_TLS || cmsg->cmsg_type != TLS_GET_RECORD_TYPE) return ret;
+
+    unsigned char type = *CMSG_DATA(cmsg);
+    if (type == 23) return ret; // application data
+    if (type == 21 && ret == 2 && buff[1] == 0) return 0; // close_notify alert
+
+    errno = EPROTO; // other alerts, handshake records - renegotiation is not supported
+    return -1;
+}
+
+#endif
+
+// the connection's records go through wolfSSL, not handed to the kernel (SNOW_KTLS)
+static inline bool snow_tlsWrites(const snow_connection_t *conn) {
+#ifdef SNOW_KTLS
+    return conn->secure && !conn->ktlsTx;
+#else
+    return conn->secure;
+#endif
+}
+
+static inline bool snow_tlsReads(const snow_connection_t *conn) {
+#ifdef SNOW_KTLS
+    return conn->secure && !conn->ktlsRx;
+#else
+    return conn->secure;
+#endif
+}
+
+#ifdef SNOW_TLS_READ_AHEAD
+
+// conn is readable, its records are read ahead - unless another connection's are still there, its reads then go straight to the socket
+static inline void snow_tls_readable(snow_connection_t *conn) {
+    snow_readAhead_t *ahead = &snow_readAhead;
+    if (ahead->head != ahead->tail && ahead->conn != conn) return;
+
+    ahead->conn = conn;
+    ahead->drained = false;
+}
+
+// recv with wolfSSL's error codes
+static int snow_tls_recvInto(snow_connection_t *conn, char *buf, size_t len) {
+    ssize_t ret = recv(conn->sockfd, buf, len, 0);
+    if (ret > 0) return (int) ret;
+    if (ret == 0) return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return WOLFSSL_CBIO_ERR_WANT_READ;
+    if (errno == EINTR) return WOLFSSL_CBIO_ERR_ISR;
+    if (errno == ECONNRESET) return WOLFSSL_CBIO_ERR_CONN_RST;
+    return WOLFSSL_CBIO_ERR_GENERAL;
+}
+
+// wolfSSL's recv after the handshake, it asks for a record header then its body - both come out of one large recv
+static int snow_tls_recv(WOLFSSL *ssl, char *buf, int sz, void *ctx) {
+    auto *conn = (snow_connection_t *) ctx;
+    snow_readAhead_t *ahead = &snow_readAhead;
+
+    if (ahead->conn != conn) return snow_tls_recvInto(conn, buf, sz); // not its readiness event, as wolfSSL would
+
+    if (ahead->head == ahead->tail) {
+        if (ahead->drained) return WOLFSSL_CBIO_ERR_WANT_READ; // level triggered, the loop comes back if more arrived meanwhile
+
+        int ret = snow_tls_recvInto(conn, ahead->buff, sizeof(ahead->buff));
+        if (ret < 0) return ret;
+
+        ahead->head = 0, ahead->tail = ret;
+        ahead->drained = ret < (int) sizeof(ahead->buff);
+    }
+
+    size_t n = std::min((size_t) sz, ahead->tail - ahead->head);
+    memcpy(buf, ahead->buff + ahead->head, n);
+    ahead->head += n;
+    return (int) n;
 }
 
+#endif
+
 size_t snow_buff_to_pull(struct buff_static_t *buff) {
     return buff->head - buff->tail;
 }
@@ -71,12 +801,14 @@ size_t snow_buff_pull_to_sock(struct buff_static_t *buff, snow_connection_t *con
     while (remain > 0) {
         ssize_t ret;
 
-        if (conn->secure) {
+        if (snow_tlsWrites(conn)) {
             ret = wolfSSL_write(conn->ssl, &buff->buff[buff->tail], remain);
             if (ret == -1) {
                 int err = wolfSSL_get_error(conn->ssl, ret);
-                if (SNOW_LIKELY(err == WOLFSSL_ERROR_WANT_WRITE))
+                if (SNOW_LIKELY(err == WOLFSSL_ERROR_WANT_WRITE)) {
+                    SNOW_TRACE_EVENT(TRACE_TLS_WANT_WRITE, conn->id, 0);
                     break;
+                }
                 else {
                     snow_processConnError(conn, SOCK_WRITE_ERR);
 #ifdef SNOW_DEBUG
@@ -88,7 +820,7 @@ size_t snow_buff_pull_to_sock(struct buff_static_t *buff, snow_connection_t *con
                 }
             }
         } else {
-            ret = write(conn->sockfd, &buff->buff[buff->tail], remain);
+            ret = send(conn->sockfd, &buff->buff[buff->tail], remain, conn->secure ? MSG_NOSIGNAL : 0); // kTLS, as wolfSSL would
             if (ret < 0) {
                 if (errno == EINTR) continue;
                 if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN) break;
@@ -99,6 +831,8 @@ size_t snow_buff_pull_to_sock(struct buff_static_t *buff, snow_connection_t *con
         remain -= ret;
         buff->tail += ret;
     }
+    snow_count(snow_connStats(conn), STAT_BYTES_OUT, size - remain);
+    SNOW_TRACE_EVENT(TRACE_WRITE, conn->id, size - remain);
     return remain;
 }
 
@@ -110,19 +844,21 @@ size_t snow_buff_put_from_sock(struct buff_static_t *buff, snow_connection_t *co
 
     while (remain) {
         ssize_t ret;
-        size_t head_room = connBufferSize - buff->head;
+        size_t head_room = connBufferSize - 1 - buff->head; // keep room for the terminator
 
         if (head_room <= 0) {
             snow_processConnError(conn, BUFF_READ_SMALL);
             return 0;
         }
 
-        if (conn->secure) {
+        if (snow_tlsReads(conn)) {
             ret = wolfSSL_read(conn->ssl, &buff->buff[buff->head], head_room);
             if (ret == -1) {
                 int err = wolfSSL_get_error(conn->ssl, ret);
-                if (SNOW_LIKELY(err == WOLFSSL_ERROR_WANT_READ))
+                if (SNOW_LIKELY(err == WOLFSSL_ERROR_WANT_READ)) {
+                    SNOW_TRACE_EVENT(TRACE_TLS_WANT_READ, conn->id, 0);
                     break;
+                }
                 else {
                     snow_processConnError(conn, SOCK_READ_ERR);
 #ifdef SNOW_DEBUG
@@ -134,6 +870,10 @@ size_t snow_buff_put_from_sock(struct buff_static_t *buff, snow_connection_t *co
                 }
             }
         } else {
+#ifdef SNOW_KTLS
+            if (conn->ktlsRx) ret = snow_ktls_read(conn, &buff->buff[buff->head], head_room);
+            else
+#endif
             ret = read(conn->sockfd, &buff->buff[buff->head], head_room);
             if (ret < 0) {
                 if (errno == EINTR) continue;
@@ -144,6 +884,7 @@ size_t snow_buff_put_from_sock(struct buff_static_t *buff, snow_connection_t *co
         }
 
         if (SNOW_UNLIKELY(ret == 0)) {
+            if (total) break; // what came before is handled first (e.g. a WebSocket close frame), the next read reports it
             snow_processConnError(conn, SOCK_READ_CLOSED);
 #ifdef SNOW_DEBUG
             char buffer[256];
@@ -159,9 +900,12 @@ size_t snow_buff_put_from_sock(struct buff_static_t *buff, snow_connection_t *co
         }
 
         buff->head += ret;
+        buff->buff[buff->head] = 0; // buffers are not cleared between requests, parsing relies on this
         remain -= ret;
         total += ret;
     }
+    snow_count(snow_connStats(conn), STAT_BYTES_IN, total);
+    SNOW_TRACE_EVENT(TRACE_READ, conn->id, total);
     return total;
 }
 
@@ -204,45 +948,311 @@ void snow_parseUrl(snow_connection_t *conn) {
     conn->query = strchr(conn->path, '?');
 #endif
 
-    if (conn->port == 0) {
-        if (strcmp(conn->protocol, "http") == 0)
-            conn->port = 80, conn->portPtr = "80", conn->secure = false;
-        else if (strcmp(conn->protocol, "https") == 0)
-            conn->port = 443, conn->portPtr = "443", conn->secure = true;
-        else
-            snow_processConnError(conn, URL_MALFORMATTED);
+    bool ws = conn->method == __WEBSOCKET;
+    if (strcmp(conn->protocol, ws ? "wss" : "https") == 0)
+        conn->secure = true;
+    else if (strcmp(conn->protocol, ws ? "ws" : "http") != 0) {
+        snow_processConnError(conn, URL_MALFORMATTED);
+        return;
+    }
+
+    if (conn->port == 0) { // default port
+        if (conn->secure) conn->port = 443, conn->portPtr = "443";
+        else conn->port = 80, conn->portPtr = "80";
     }
 }
 
 void snow_resolveHost(snow_connection_t *conn) {
-    auto it = conn->global->addrCache.find(host_port_t<char *>{conn->hostname, conn->port}); // atomic if multi loop
+    char key[addrCacheKeySize];
+    size_t hostLen = strlen(conn->hostname), portLen = strlen(conn->portPtr);
+    size_t keyLen = hostLen + 1 + portLen; // host:port, not cached if too long
+
+    if (keyLen <= sizeof(key)) {
+        memcpy(key, conn->hostname, hostLen);
+        key[hostLen] = ':';
+        memcpy(key + hostLen + 1, conn->portPtr, portLen);
+    }
 
-    if (it != conn->global->addrCache.end()) {
-        conn->addrinfo = it->second;
-    } else {
-        conn->hints.ai_family = AF_INET;
-        conn->hints.ai_socktype = SOCK_STREAM;
-        conn->hints.ai_flags |= AI_NUMERICSERV;
+    uint64_t now = snow_monotonic_ms();
+    bool cached = keyLen <= sizeof(key) && conn->global->addrCache.find(key, keyLen, conn->address);
 
-        int ret = getaddrinfo(conn->hostname, conn->portPtr, &conn->hints, &conn->addrinfo);
+    if (cached && conn->address.expiry > now) {
+        snow_count(snow_connStats(conn), STAT_DNS_HITS);
+        return;
+    }
 
-        if (SNOW_UNLIKELY(ret != 0)) {
-            snow_processConnError(conn, HOSTNAME_RESOLVE);
-            return;
+    snow_count(snow_connStats(conn), STAT_DNS_MISSES);
+
+    struct addrinfo hints = {}, *result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    int ret = getaddrinfo(conn->hostname, conn->portPtr, &hints, &result);
+
+    if (SNOW_UNLIKELY(ret != 0)) {
+        if (!cached) snow_processConnError(conn, HOSTNAME_RESOLVE);
+        return; // keep using the expired address
+    }
+
+    conn->address.family = result->ai_family;
+    conn->address.socktype = result->ai_socktype;
+    conn->address.protocol = result->ai_protocol;
+    conn->address.len = result->ai_addrlen;
+    memcpy(&conn->address.addr, result->ai_addr, result->ai_addrlen);
+    conn->address.expiry = now + addrCacheTtl;
+    freeaddrinfo(result);
+
+    if (keyLen <= sizeof(key)) conn->global->addrCache.insert(key, keyLen, conn->address);
+}
+
+#ifdef SNOW_SNAPSHOT
+
+static int64_t snow_realtime_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// header, addrN address records, sessionN session records - fixed sizes, read in place from the mapped file
+struct snow_snapshotHeader_t {
+    char magic[8];
+    uint32_t addrSize, sessionSize; // record sizes, a file written with other cache key or session sizes is ignored
+    uint32_t addrN, sessionN;
+    int64_t savedAt; // realtime ms
+};
+
+struct snow_snapshotAddr_t {
+    uint32_t keyLen;
+    char key[addrCacheKeySize]; // host:port
+    int64_t expiry; // realtime ms, address.expiry is monotonic
+    snow_address_t address;
+};
+
+struct snow_snapshotSession_t {
+    uint32_t keyLen;
+    char key[addrCacheKeySize]; // host:port
+    snow_sessionBlob_t blob;
+};
+
+constexpr char snapshotMagic[8] = {'S', 'N', 'O', 'W', 'S', 'N', 'P', '1'};
+
+#ifdef SNOW_TLS_SESSION_REUSE
+
+// keeps the renewed session of the connection's host for the next snapshot
+static void snow_snapshotSession(snow_connection_t *conn, WOLFSSL_SESSION *session) {
+    snow_sessionBlob_t blob;
+    char key[addrCacheKeySize];
+
+    int len = wolfSSL_i2d_SSL_SESSION(session, nullptr);
+    int keyLen = snprintf(key, sizeof(key), "%s:%d", conn->hostname, conn->port);
+    if (len <= 0 || len > snapshotSessionSize || keyLen <= 0 || keyLen >= (int) sizeof(key)) return;
+
+    unsigned char *der = blob.der;
+    blob.len = wolfSSL_i2d_SSL_SESSION(session, &der);
+    blob.savedAt = snow_realtime_ms();
+    if (blob.len == (uint32_t) len) conn->global->sessionSnapshots.insert(key, keyLen, blob);
+}
+
+// every connection gets its own copy, snow_continueTLSHandshake frees them one by one on renewal
+static bool snow_restoreSession(snow_global_t *global, const snow_snapshotSession_t *record) {
+    const char *colon = (const char *) memrchr(record->key, ':', record->keyLen);
+    if (!colon) return false;
+
+    std::string host(record->key, colon - record->key);
+    int port = atoi(colon + 1);
+
+    for (int id = 0; id < concurrentConnections; id++) {
+        snow_connection_t &conn = global->connections[id];
+        const unsigned char *der = record->blob.der;
+        WOLFSSL_SESSION *session = wolfSSL_d2i_SSL_SESSION(nullptr, &der, record->blob.len);
+        if (!session) return false;
+
+        auto old = conn.sessions.find(host_port_t<char *>{(char *) host.c_str(), port});
+        if (old != conn.sessions.end()) {
+            wolfSSL_SESSION_free(old->second);
+            conn.sessions.erase(old);
         }
+        conn.sessions.insert({host_port_t<std::string>{host, port}, session});
+    }
+
+    global->sessionSnapshots.insert(record->key, record->keyLen, record->blob); // carried over to the next snapshot
+    return true;
+}
+
+#endif
+
+bool snow_saveSnapshot(snow_global_t *global, const char *path) {
+    // renamed over path once complete, readers never see half a file, a unique name per call as
+    // snow_destroy & the snapshot timer, or the application, may save at the same time
+    std::string tmpPath = std::string(path) + ".XXXXXX";
+    int fd = mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (fd < 0) return false;
+
+    FILE *out = fdopen(fd, "wb");
+    if (!out) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    int64_t wallNow = snow_realtime_ms();
+    auto monotonicNow = (int64_t) snow_monotonic_ms();
+
+    snow_snapshotHeader_t header = {};
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.addrSize = sizeof(snow_snapshotAddr_t);
+    header.sessionSize = sizeof(snow_snapshotSession_t);
+    header.savedAt = wallNow;
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    global->addrCache.for_each([&](const char *key, size_t len, const snow_address_t &address) {
+        snow_snapshotAddr_t record = {};
+        record.keyLen = len;
+        memcpy(record.key, key, len);
+        record.expiry = wallNow + ((int64_t) address.expiry - monotonicNow);
+        record.address = address;
+        ok = ok && fwrite(&record, sizeof(record), 1, out) == 1;
+        header.addrN++;
+    });
+
+    global->sessionSnapshots.for_each([&](const char *key, size_t len, const snow_sessionBlob_t &blob) {
+        snow_snapshotSession_t record = {};
+        record.keyLen = len;
+        memcpy(record.key, key, len);
+        record.blob = blob;
+        ok = ok && fwrite(&record, sizeof(record), 1, out) == 1;
+        header.sessionN++;
+    });
+
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+
+    if (ok) ok = rename(tmpPath.c_str(), path) == 0;
+    if (!ok) unlink(tmpPath.c_str());
+    return ok;
+}
+
+// fills addrCache & the connections' sessions from a file written by snow_saveSnapshot, before the loops run,
+// oldestSession is set to when the oldest restored session was saved (realtime ms), left alone if none was
+static bool snow_loadSnapshot(snow_global_t *global, const char *path, int64_t *oldestSession) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snow_snapshotHeader_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    auto *header = (const snow_snapshotHeader_t *) map;
+    bool valid = memcmp(header->magic, snapshotMagic, sizeof(header->magic)) == 0 &&
+                 header->addrSize == sizeof(snow_snapshotAddr_t) && header->sessionSize == sizeof(snow_snapshotSession_t) &&
+                 header->addrN <= addrCacheSize && header->sessionN <= snapshotSessionsMax &&
+                 size == sizeof(*header) + header->addrN * sizeof(snow_snapshotAddr_t) + header->sessionN * sizeof(snow_snapshotSession_t);
+
+    auto *addrs = (const snow_snapshotAddr_t *) (header + 1);
+
+    int64_t wallNow = snow_realtime_ms();
+    uint64_t monotonicNow = snow_monotonic_ms();
+    uint32_t addrN = 0, sessionN = 0;
+
+    for (uint32_t i = 0; valid && i < header->addrN; i++) {
+        const snow_snapshotAddr_t &record = addrs[i];
+        if (record.expiry <= wallNow || record.keyLen > addrCacheKeySize || record.address.len > sizeof(record.address.addr)) continue;
+
+        snow_address_t address = record.address;
+        address.expiry = monotonicNow + (record.expiry - wallNow);
+        addrN += global->addrCache.insert(record.key, record.keyLen, address);
+    }
+
+#ifdef SNOW_TLS_SESSION_REUSE
+    auto *sessions = (const snow_snapshotSession_t *) (addrs + (valid ? header->addrN : 0));
+    for (uint32_t i = 0; valid && i < header->sessionN; i++) {
+        const snow_snapshotSession_t &record = sessions[i];
+        if (record.blob.savedAt + (int64_t) (sessionRenewInterval * 1000) <= wallNow) continue; // would be renewed anyway
+        if (record.keyLen > addrCacheKeySize || record.blob.len > snapshotSessionSize) continue;
+
+        if (!snow_restoreSession(global, &record)) continue;
+        if (sessionN++ == 0 || record.blob.savedAt < *oldestSession) *oldestSession = record.blob.savedAt;
+    }
+#endif
+
+    munmap(map, size);
+
+    if (valid && loopTopologyReport) printf("INFO: snapshot %s: %u addresses, %u sessions\n", path, addrN, sessionN);
+    return valid;
+}
+
+// hands the write to snapshotWriter, skipped while the previous one is still going (a slow disk)
+void snow_timer_snapshot_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {
+    auto *global = (struct snow_global_t *) ((struct ev_timer_snow *) w)->data;
+    if (global->snapshotWriting.exchange(true, std::memory_order_acquire)) return;
+
+    if (global->snapshotWriter.joinable()) global->snapshotWriter.join(); // finished already
+    global->snapshotWriter = std::thread([](snow_global_t *global) {
+        if (!snow_saveSnapshot(global, snapshotPath)) fprintf(stderr, "WARN: could not write snapshot %s\n", snapshotPath);
+        global->snapshotWriting.store(false, std::memory_order_release);
+    }, global);
+}
+
+#endif
+
+// client context with the configured session & certificate settings
+static WOLFSSL_CTX *snow_newTlsCtx(long sessionCacheMode) {
+    WOLFSSL_CTX *ctx = wolfSSL_CTX_new(wolfTLSv1_2_client_method());
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "ERR: wolfSSL_CTX_new error.\n");
+        assert(0);
+    }
+
+#ifdef SNOW_TLS_SESSION_REUSE
+    if (wolfSSL_CTX_UseSessionTicket(ctx) != SSL_SUCCESS) {
+        fprintf(stderr, "ERR: ticket enable error.\n");
+        assert(0);
+    }
+
+    if (wolfSSL_CTX_set_session_cache_mode(ctx, sessionCacheMode) != SSL_SUCCESS) {
+        fprintf(stderr, "ERR: could not set session cache mode.\n");
+        assert(0);
+    }
+#endif
 
-        conn->global->addrCache.insert({{std::string(conn->hostname), conn->port}, conn->addrinfo});  // atomic if multi loop
+#ifdef SNOW_NO_CERT_VERIFY
+    wolfSSL_CTX_set_verify(ctx, WOLFSSL_VERIFY_NONE, nullptr);
+#else
+    // Load CA certificates into WOLFSSL_CTX
+    if (wolfSSL_CTX_load_verify_locations(ctx, sslCertPath, nullptr) != SSL_SUCCESS) {
+        fprintf(stderr, "ERR: Error loading %s", sslCertPath);
+        assert(0);
     }
+#endif
+
+    return ctx;
+}
+
+// the loop's own context if tlsCtxPerLoop, the shared one otherwise
+static inline WOLFSSL_CTX *snow_tlsCtx(snow_connection_t *conn) {
+#ifdef SNOW_MULTI_LOOP
+    if (conn->global->loopCtx[conn->loopId] != nullptr) return conn->global->loopCtx[conn->loopId];
+#endif
+    return conn->global->wolfCtx;
 }
 
 void snow_startTLSHandshake(snow_connection_t *conn) {
-    if ((SNOW_UNLIKELY((conn->ssl = wolfSSL_new(conn->global->wolfCtx)) == nullptr))) {
+    if ((SNOW_UNLIKELY((conn->ssl = wolfSSL_new(snow_tlsCtx(conn))) == nullptr))) {
         snow_processConnError(conn, WOLFSSL_NEW);
         return;
     }
 
     // set SNI
-    int ret = wolfSSL_UseSNI(conn->ssl, WOLFSSL_SNI_HOST_NAME, conn->hostname, conn->path - conn->hostname - 1);
+    int ret = wolfSSL_UseSNI(conn->ssl, WOLFSSL_SNI_HOST_NAME, conn->hostname, strlen(conn->hostname)); // hostname ends before the port
     if (SNOW_UNLIKELY(ret != WOLFSSL_SUCCESS)) {
         char error_buff[100];
         fprintf(stderr, "Setting host name failed with error condition: %d and reason %s\n", ret, wolfSSL_ERR_error_string(ret, error_buff));
@@ -253,30 +1263,108 @@ void snow_startTLSHandshake(snow_connection_t *conn) {
     if (conn->method != __TLS_DUMMY) {
         auto session = conn->sessions.find(host_port_t<char *>{conn->hostname, conn->port});
 
-        if (session != conn->sessions.end()) {
-            if (wolfSSL_set_session(conn->ssl, session->second) != SSL_SUCCESS) {
-                fprintf(stderr, "ERR: failed to set cached session\n");
-            }
-        } else fprintf(stderr, "WARN: could not find resumable session\n");
+        // a missing or rejected session shows up as STAT_SESSION_MISSES once the handshake is done
+        if (session != conn->sessions.end()) wolfSSL_set_session(conn->ssl, session->second);
     }
 #endif
 
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION) wolfSSL_UseALPN(conn->ssl, (char *) "h2", 2, WOLFSSL_ALPN_CONTINUE_ON_MISMATCH);
+#endif
+
     wolfSSL_set_fd(conn->ssl, conn->sockfd);
     wolfSSL_set_using_nonblock(conn->ssl, 1);
 
-    conn->connectionStatus = CONN_TLS_HANDSHAKE; // will be processed in write cb & read cb
+    snow_setStatus(conn, CONN_TLS_HANDSHAKE); // will be processed in write cb & read cb
+}
+
+#ifdef SNOW_LATENCY_HISTOGRAMS
+
+static void snow_recordLatency(snow_connection_t *conn) {
+    const uint64_t *t = conn->statusTime;
+    const uint64_t phases[PHASE_COUNT] = {
+            conn->pickupTime - t[CONN_UNREADY], // PHASE_DISPATCH
+            t[CONN_IN_PROGRESS] - conn->pickupTime, // PHASE_DNS
+            t[CONN_ACK] - t[CONN_IN_PROGRESS], // PHASE_CONNECT
+            t[CONN_READY] - t[CONN_ACK], // PHASE_TLS
+            t[CONN_WAITING] - t[CONN_READY], // PHASE_SEND
+            t[CONN_RECEIVING] - t[CONN_WAITING], // PHASE_TTFB
+            t[CONN_DONE] - t[CONN_RECEIVING], // PHASE_BODY
+            t[CONN_DONE] - t[CONN_UNREADY] // PHASE_TOTAL
+    };
+
+    snow_histogram_t (*latency)[PHASE_COUNT] = conn->global->latency[conn->loopId];
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        snow_histogram_record(&latency[0][phase], phases[phase]);
+        if (conn->trackedHost) snow_histogram_record(&latency[conn->trackedHost][phase], phases[phase]);
+    }
+}
+
+// recomputes the HEDGE_P95 delays of a loop from its own PHASE_TOTAL histograms, runs on that loop
+static void snow_refreshHedgeDelays(snow_global_t *global, int loop) {
+    snow_histogram_snapshot_t s;
+    for (int host = 0; host <= global->trackedHostN; host++) {
+        snow_histogram_snapshot(&global->latency[loop][host][PHASE_TOTAL], &s);
+        global->hedgeDelays[loop][host] = s.total >= hedgeMinSamples ? snow_histogram_percentile(&s, 0.95) : 0;
+    }
+}
+
+static int snow_findTrackedHost(snow_connection_t *conn) {
+    snow_global_t *global = conn->global;
+    for (int i = 0; i < global->trackedHostN; i++)
+        if (global->trackedHosts[i].port == conn->port && strcmp(global->trackedHosts[i].host, conn->hostname) == 0)
+            return i + 1;
+    return 0;
+}
+
+int snow_trackHost(snow_global_t *global, const char *host, int port) {
+    if (global->trackedHostN == trackedHostsMax || strlen(host) >= addrCacheKeySize) return -1;
+
+    strcpy(global->trackedHosts[global->trackedHostN].host, host);
+    global->trackedHosts[global->trackedHostN].port = port;
+    return global->trackedHostN++;
 }
 
+void snow_latencySnapshot(snow_global_t *global, int phase, int loop, int host, snow_histogram_snapshot_t *out) {
+    snow_histogram_snapshot_t part;
+    snow_histogram_clear(out);
+
+#ifdef SNOW_MULTI_LOOP
+    for (int id = 0; id < multi_loop_n_runtime; id++) {
+#else
+    for (int id = 0; id < 1; id++) {
+#endif
+        if (loop >= 0 && id != loop) continue;
+        snow_histogram_snapshot(&global->latency[id][host + 1][phase], &part);
+        snow_histogram_merge(out, &part);
+    }
+}
+
+#endif
+
 void snow_terminateConn(snow_connection_t *conn) {
-    if (conn->write_cb) conn->write_cb(conn->content, conn->contentLen, conn->extra_cb);
+    conn->statusTime[CONN_DONE] = snow_now_ns();
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    if (conn->method != __TLS_DUMMY) snow_recordLatency(conn);
+#endif
+    if (conn->method != __TLS_DUMMY) snow_count(snow_connStats(conn), STAT_COMPLETED);
+
+    if (conn->hedgePeer) { // first response of a hedged pair, the other connection goes away silently
+        snow_connection_t *peer = &conn->global->connections[conn->hedgePeer - 1];
+        peer->hedgePeer = conn->hedgePeer = 0;
+        snow_closeConn(peer);
+        if (conn->hedge) snow_count(snow_connStats(conn), STAT_HEDGE_WINS);
+    }
 
-    setsockopt(conn->sockfd, SOL_SOCKET, SO_LINGER, &sock_linger0, sizeof(struct linger));
-    close(conn->sockfd);
+#ifdef SNOW_RESPONSE_CACHE
+    if (conn->cacheHash) snow_cacheResponse(conn);
+#endif
 
-    if (conn->secure) wolfSSL_free(conn->ssl);
+    int waiters = snow_endFlight(conn);
+    snow_deliver(&conn->callback, conn->write_cb, conn->err_cb, conn->extra_cb, -1, conn->content, conn->contentLen, conn->statusCode);
+    snow_notifyWaiters(conn->global, waiters, conn->content, conn->contentLen, -1, conn->statusCode);
 
-    conn->connectionStatus = CONN_DONE;
-    conn->global->freeConnections.push(conn->id);  // atomic if multi loop
+    snow_closeConn(conn);
 }
 
 void snow_parseChunks(snow_connection_t *conn) {
@@ -297,7 +1385,7 @@ void snow_parseChunks(snow_connection_t *conn) {
 
         chunkData += 2; // skip \r\n
 
-        memcpy(newCopyStart, chunkData, chunkLen); // copy & compute next copy location
+        memmove(newCopyStart, chunkData, chunkLen); // copy (the ranges overlap) & compute next copy location
         newCopyStart += chunkLen;
 
         if (!(chunkData[chunkLen] == '\r' && chunkData[chunkLen + 1] == '\n')) {  // end of chunk
@@ -334,8 +1422,27 @@ void snow_continueTLSHandshake(snow_connection_t *conn) {
             return;
         }
 
+        SNOW_TRACE_EVENT(err == SSL_ERROR_WANT_READ ? TRACE_TLS_WANT_READ : TRACE_TLS_WANT_WRITE, conn->id, 0);
+
     } else {
-        conn->connectionStatus = CONN_READY;
+        snow_setStatus(conn, CONN_READY);
+
+        if (conn->method != __TLS_DUMMY)
+            snow_count(snow_connStats(conn), wolfSSL_session_reused(conn->ssl) ? STAT_SESSION_HITS : STAT_SESSION_MISSES);
+
+#ifdef SNOW_KTLS
+        if (conn->method != __TLS_DUMMY) snow_ktls_enable(conn); // session renewals are closed right away
+#endif
+#ifdef SNOW_TLS_READ_AHEAD
+        if (snow_tlsReads(conn)) { // the handshake took exactly what it needed, the rest is still in the socket
+            wolfSSL_SSLSetIORecv(conn->ssl, snow_tls_recv);
+            wolfSSL_SetIOReadCtx(conn->ssl, conn);
+        }
+#endif
+
+#ifdef SNOW_HTTP2
+        if (conn->method == __H2_SESSION) snow_h2_begin(conn);
+#endif
 
 #ifdef SNOW_TLS_SESSION_REUSE
         if (conn->method == __TLS_DUMMY) {
@@ -348,9 +1455,10 @@ void snow_continueTLSHandshake(snow_connection_t *conn) {
 
             conn->sessions.insert({host_port_t<std::string>{conn->hostname, conn->port},
                                    wolfSSL_get_session(conn->ssl)}); // insert new session
+#ifdef SNOW_SNAPSHOT
+            snow_snapshotSession(conn, wolfSSL_get_session(conn->ssl));
+#endif
 
-            ev_io_stop(conn->loop, (struct ev_io *) &conn->ior);
-            ev_io_stop(conn->loop, (struct ev_io *) &conn->iow);
             snow_terminateConn(conn);
         }
 #endif
@@ -358,7 +1466,10 @@ void snow_continueTLSHandshake(snow_connection_t *conn) {
 }
 
 void snow_processFirstResponse(snow_connection_t *conn) {
-    conn->connectionStatus = CONN_RECEIVING;
+    snow_setStatus(conn, CONN_RECEIVING);
+
+    char *status = strchr(&conn->readBuff.buff[conn->readBuff.tail], ' '); // HTTP/1.1 200 OK
+    if (status) conn->statusCode = atoi(status + 1);
 
     char *chunked = strstr(&conn->readBuff.buff[conn->readBuff.tail], "\r\nTransfer-Encoding: chunked\r\n");
     if (chunked) conn->chunked = true;
@@ -382,10 +1493,23 @@ void snow_processFirstResponse(snow_connection_t *conn) {
 static void snow_io_read_cb(struct ev_loop *loop, struct ev_io *w, int revents) {
     auto *conn = (struct snow_connection_t *) ((struct ev_io_snow *) w)->data;
 
+#ifdef SNOW_TLS_READ_AHEAD
+    if (conn->secure) snow_tls_readable(conn); // used once the handshake is done
+#endif
+
     if (conn->connectionStatus == CONN_TLS_HANDSHAKE) {
         snow_continueTLSHandshake(conn);
     }
 
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION && conn->connectionStatus == CONN_READY) snow_h2_read(conn);
+#endif
+
+#ifdef SNOW_WEBSOCKET
+    if (conn->method == __WEBSOCKET) {
+        if (conn->connectionStatus == CONN_WAITING || conn->connectionStatus == CONN_RECEIVING) snow_ws_read(conn);
+    } else
+#endif
     if (conn->connectionStatus == CONN_WAITING || conn->connectionStatus == CONN_RECEIVING) {
         size_t readSize = snow_buff_put_from_sock(&conn->readBuff, conn, -1);
 
@@ -399,40 +1523,41 @@ static void snow_io_read_cb(struct ev_loop *loop, struct ev_io *w, int revents)
             if (strcmp(&conn->readBuff.buff[conn->readBuff.head - 5], "0\r\n\r\n") == 0) {
                 snow_parseChunks(conn);
                 snow_terminateConn(conn);
-                ev_io_stop(loop, (struct ev_io *) &conn->ior);
             }
         } else {
             if (conn->expectedContentLen) { // header Content-Length was present
                 if (&conn->readBuff.buff[conn->readBuff.head] - conn->content >= conn->expectedContentLen) {
                     conn->contentLen = conn->expectedContentLen;
                     snow_terminateConn(conn);
-                    ev_io_stop(loop, (struct ev_io *) &conn->ior);
                 }
             } else if (strcmp(&conn->readBuff.buff[conn->readBuff.head - 1], "\n") == 0) {
                 conn->contentLen = &conn->readBuff.buff[conn->readBuff.head] - conn->content;
                 snow_terminateConn(conn);
-                ev_io_stop(loop, (struct ev_io *) &conn->ior);
             }
         }
 
     }
+
+#if defined(SNOW_QUEUEING_ENABLED) && !defined(SNOW_MULTI_LOOP) // multi loop hands freed slots over in snow_loop_cb
+    if (conn->connectionStatus == CONN_DONE) snow_dispatchQueued(conn->global); // hand the freed slot to the next waiter
+#endif
 }
 
 int snow_sendRequest(snow_connection_t *conn) {
     int rem = snow_buff_pull_to_sock(&conn->writeBuff, conn, snow_buff_to_pull(&conn->writeBuff));
 
-    if (rem == 0) conn->connectionStatus = CONN_WAITING;
+    if (rem == 0) snow_setStatus(conn, CONN_WAITING);
 
     return rem;
 }
 
 void snow_checkConnected(snow_connection_t *conn) {
-    int conn_r = connect(conn->sockfd, conn->addrinfo->ai_addr, conn->addrinfo->ai_addrlen);
+    int conn_r = connect(conn->sockfd, (struct sockaddr *) &conn->address.addr, conn->address.len);
     if (conn_r == 0) {
-        conn->connectionStatus = CONN_ACK;
+        snow_setStatus(conn, CONN_ACK);
         if (conn->secure)
             snow_startTLSHandshake(conn);
-        else conn->connectionStatus = CONN_READY;
+        else snow_setStatus(conn, CONN_READY);
     }
 }
 
@@ -447,25 +1572,41 @@ static void snow_io_write_cb(struct ev_loop *loop, struct ev_io *w, int revents)
         snow_continueTLSHandshake(conn);
     }
 
+#ifdef SNOW_WEBSOCKET
+    if (conn->method == __WEBSOCKET && conn->wsOpen) snow_ws_flush(conn); // the upgrade request goes out like any other
+#endif
+
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION) {
+        if (conn->connectionStatus == CONN_READY) snow_h2_flush(conn);
+    } else
+#endif
     if (conn->connectionStatus == CONN_READY && !snow_buff_empty(&conn->writeBuff)) {
         if (snow_sendRequest(conn) == 0)
             ev_io_stop(loop, (struct ev_io *) &conn->iow);
     }
+
+#if defined(SNOW_QUEUEING_ENABLED) && !defined(SNOW_MULTI_LOOP) // multi loop hands freed slots over in snow_loop_cb
+    if (conn->connectionStatus == CONN_DONE) snow_dispatchQueued(conn->global); // hand the freed slot to the next waiter
+#endif
 }
 
 void snow_initConnection(snow_connection_t *conn) {
-    conn->sockfd = socket(conn->addrinfo->ai_family, conn->addrinfo->ai_socktype, conn->addrinfo->ai_protocol);
+    conn->sockfd = socket(conn->address.family, conn->address.socktype | SOCK_NONBLOCK, conn->address.protocol);
 
     setsockopt(conn->sockfd, SOL_SOCKET, SO_PRIORITY, &connSockPriority, sizeof(int));
 
+#ifdef SNOW_MULTI_LOOP
+    if (conn->global->loopCpu[conn->loopId] >= 0)
+        setsockopt(conn->sockfd, SOL_SOCKET, SO_INCOMING_CPU, &conn->global->loopCpu[conn->loopId], sizeof(int));
+#endif
+
 #ifdef SNOW_DISABLE_NAGLE
     int nagle = 1;
     setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, (char *) &nagle, sizeof(int));
 #endif
 
-    fcntl(conn->sockfd, F_SETFL, fcntl(conn->sockfd, F_GETFL, 0) | O_NONBLOCK);
-
-    conn->connectionStatus = CONN_IN_PROGRESS;
+    snow_setStatus(conn, CONN_IN_PROGRESS);
 
     ev_io_init((struct ev_io *) &conn->ior, snow_io_read_cb, conn->sockfd, EV_READ);
     ev_io_init((struct ev_io *) &conn->iow, snow_io_write_cb, conn->sockfd, EV_WRITE);
@@ -477,15 +1618,21 @@ void snow_initConnection(snow_connection_t *conn) {
         return;
     }
 
-    int conn_r = connect(conn->sockfd, conn->addrinfo->ai_addr, conn->addrinfo->ai_addrlen);
+    int conn_r = connect(conn->sockfd, (struct sockaddr *) &conn->address.addr, conn->address.len);
 
     if (SNOW_UNLIKELY(conn_r != 0 && errno != EINPROGRESS)) {
         snow_processConnError(conn, SOCK_CONNECTION);
         return;
     }
 
-    ev_io_start(conn->loop, (struct ev_io *) &conn->ior);
-    ev_io_start(conn->loop, (struct ev_io *) &conn->iow);
+    struct ev_io *watchers[2] = {(struct ev_io *) &conn->ior, (struct ev_io *) &conn->iow};
+    if (snow_pendingIoN >= 0 && snow_pendingIoN + 2 <= 2 * batchChunkSize) {
+        snow_pendingIo[snow_pendingIoN++] = watchers[0];
+        snow_pendingIo[snow_pendingIoN++] = watchers[1];
+        return;
+    }
+
+    ev_io_start_batch(conn->loop, watchers, 2); // one epoll_ctl for both
 }
 
 void snow_bufferRequest(snow_connection_t *conn) {
@@ -503,7 +1650,6 @@ void snow_bufferRequest(snow_connection_t *conn) {
                        "%s",
                        method_strings[conn->method], conn->path, conn->hostname, strlen(conn->query + 1),
                        (int) conn->extraHeaders_size, conn->extraHeaders, conn->query + 1);
-        printf("%s", conn->writeBuff.buff);
     } else
 #endif
     {
@@ -516,39 +1662,113 @@ void snow_bufferRequest(snow_connection_t *conn) {
     conn->writeBuff.head += size;
 }
 
+void snow_checkTimeout(snow_connection_t *conn, uint64_t time) {
+#ifdef SNOW_HTTP2
+    if (conn->method == __H2_SESSION && conn->connectionStatus == CONN_READY) return; // open, its streams time out on their own
+#endif
+#ifdef SNOW_WEBSOCKET
+    if (conn->wsOpen && !conn->wsClosing) return; // open ones stay until closed, the upgrade & the closing handshake time out
+#endif
+    if (conn->connectionStatus > CONN_UNREADY && conn->connectionStatus < CONN_DONE && time - conn->creationTime > connSockTimeout)
+        snow_processConnError(conn, CONN_TIMEOUT);
+}
+
+// sends the duplicate once the hedge delay passed without a response
+void snow_checkHedge(snow_connection_t *conn, uint64_t now) {
+    if (conn->hedgeAt && now >= conn->hedgeAt && conn->connectionStatus > CONN_UNREADY && conn->connectionStatus < CONN_RECEIVING) {
+        conn->hedgeAt = 0;
+        snow_startHedge(conn);
+    }
+}
+
 void snow_timer_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {
     auto *global = (struct snow_global_t *) ((struct ev_timer_snow *) w)->data;
 
-    uint64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t time = snow_monotonic_ms(), now = snow_now_ns();
 
-    for (int id = 0; id < concurrentConnections; id++) {
-        if (global->connections[id].connectionStatus > CONN_UNREADY && global->connections[id].connectionStatus < CONN_DONE &&
-            time - global->connections[id].creationTime > connSockTimeout) {
-
-            snow_processConnError(&global->connections[id], CONN_TIMEOUT);
+#ifdef SNOW_MULTI_LOOP
+    for (int word = 0; word < (concurrentConnections + 63) / 64; word++) { // only this loop's connections
+        uint64_t active = global->loopActive[snow_currentLoop][word];
+        while (active) {
+            int id = word * 64 + __builtin_ctzll(active);
+            active &= active - 1;
+            snow_checkTimeout(&global->connections[id], time);
+            snow_checkHedge(&global->connections[id], now);
         }
     }
+#else
+    for (int id = 0; id < concurrentConnections; id++) {
+        snow_checkTimeout(&global->connections[id], time);
+        snow_checkHedge(&global->connections[id], now);
+    }
 
+    snow_processCancels(global, 0); // multi loop drains after every iteration, see snow_loop_cb
+#endif
 
-    while (!global->requestQueue.empty() && !global->freeConnections.empty()) { // check for free connections
-        snow_bareRequest_t req = global->requestQueue.front();
-        global->requestQueue.pop();
-
-        snow_do(global, req.method, req.requestUrl, req.write_cb, req.err_cb, req.extra_cb, req.extraHeaders, req.extraHeaders_size);
+#ifdef SNOW_LATENCY_HISTOGRAMS
+#ifdef SNOW_MULTI_LOOP
+    int loopId = snow_currentLoop;
+#else
+    int loopId = 0;
+#endif
+    if (time - global->hedgeRefreshed[loopId] >= hedgeRefreshInterval) {
+        global->hedgeRefreshed[loopId] = time;
+        snow_refreshHedgeDelays(global, loopId);
     }
+#endif
+
+#ifdef SNOW_QUEUEING_ENABLED
+    snow_expireQueued(global);
+    snow_dispatchQueued(global); // slots freed by timeouts or on other loops
+#endif
 }
 
 #ifdef SNOW_TLS_SESSION_REUSE
 
+// enqueues the pending renewals as long as the low priority class has room, the rest waits for the next tick
+void snow_timer_renewRetry_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {
+    auto *global = (struct snow_global_t *) ((struct ev_timer_snow *) w)->data;
+    auto &pending = global->pendingRenewals;
+
+    size_t done = 0;
+    for (; done < pending.size(); done++) {
+        for (; pending[done].second > 0; pending[done].second--) {
+            if (global->requestQueue->full(PRIORITY_LOW) ||
+                !snow_enqueue(global, __TLS_DUMMY, pending[done].first.c_str(), nullptr,
+                              [](int err, void *extra) {}, // counted in the stats
+                              nullptr, nullptr, 0, PRIORITY_LOW))
+                break;
+        }
+        if (pending[done].second > 0) break;
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+
+    if (pending.empty()) ev_timer_stop(loop, w);
+}
+
 void snow_timer_renew_cb(struct ev_loop *loop, struct ev_timer *w, int revents) {
     auto *global = (struct snow_global_t *) ((struct ev_timer_snow *) w)->data;
 
-    for (const std::string &url : global->wantedSessions) {
-        for (int i = 0; i < concurrentConnections; ++i) {
-            snow_enqueue(global, __TLS_DUMMY, url.c_str(), nullptr,
-                         [](int err, void *extra) { fprintf(stderr, "ERR: __TLS_DUMMY encountered error: %d\n", err); },
-                         nullptr, nullptr, 0);
-        }
+#ifdef SNOW_MULTI_LOOP
+    std::vector<std::string> wantedSessions;
+    {
+        std::lock_guard<std::mutex> lock(global->wantedSessionsLock);
+        wantedSessions = global->wantedSessions;
+    }
+#else
+    std::vector<std::string> &wantedSessions = global->wantedSessions;
+#endif
+
+    snow_loop_stats_t *stats = snow_threadStats(global);
+    for (auto &pending : global->pendingRenewals) snow_count(stats, STAT_RENEWALS_DROPPED, pending.second);
+    global->pendingRenewals.clear();
+
+    for (const std::string &url : wantedSessions) global->pendingRenewals.emplace_back(url, concurrentConnections);
+    snow_timer_renewRetry_cb(loop, (struct ev_timer *) &global->renewRetryTimer, revents);
+
+    if (!global->pendingRenewals.empty()) {
+        for (auto &pending : global->pendingRenewals) snow_count(stats, STAT_RENEWALS_DEFERRED, pending.second);
+        ev_timer_start(global->loop, (struct ev_timer *) &global->renewRetryTimer);
     }
 
     printf("INFO: renewing sessions\n");
@@ -556,33 +1776,97 @@ void snow_timer_renew_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
 
 #endif
 
-///// PUBLIC
+// ns after snow_do the duplicate of conn goes out
+static uint64_t snow_hedgeDelayNs(snow_connection_t *conn) {
+    if (conn->hedgeDelay > 0) return conn->hedgeDelay * 1000000ULL;
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    uint64_t delay = conn->global->hedgeDelays[conn->loopId][conn->trackedHost];
+    if (delay) return delay;
+#endif
+    return hedgeDefaultDelay * 1000000ULL;
+}
 
-void snow_do(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
-             void (*err_cb)(int err, void *extra),
-             void *extra, const char *extraHeaders, size_t extraHeaders_size) {
+// resolves & connects, the request is already buffered
+static void snow_openConn(snow_connection_t *conn) {
+    snow_resolveHost(conn);
+    if (conn->connectionStatus == CONN_DONE) return;
 
-    if (global->freeConnections.empty()) { // check for free connections
-        err_cb(NO_FREE_CONN, extra);
-        return;
-    }
+    snow_initConnection(conn);
+}
 
-    int id = global->freeConnections.front();
-    global->freeConnections.pop();
+// parses, resolves & connects, runs on the connection's loop thread
+void snow_startConn(snow_connection_t *conn) {
+#ifdef SNOW_MULTI_LOOP
+    conn->global->loopActive[conn->loopId][conn->id / 64] |= 1ULL << (conn->id % 64U);
+#endif
 
-    snow_connection_t *conn = &global->connections[id];
+    conn->pickupTime = snow_now_ns();
+    if (conn->method >= 0 && !conn->hedge) snow_count(snow_connStats(conn), STAT_STARTED);
 
-#ifdef SNOW_TLS_SESSION_REUSE
-    memset(conn, 0, sizeof(struct snow_connection_t) - (sizeof(std::map<host_port_t<std::string>, WOLFSSL_SESSION *, host_port_t_functor>)));
-#else
-    memset(conn, 0, sizeof(struct snow_connection_t));
+    if (SNOW_UNLIKELY(snow_cancelRequested(conn)) && snow_cancelConn(conn)) return; // cancelled while in the loop's inbox
+
+    conn->writeBuff.head = conn->writeBuff.tail = 0;
+    conn->readBuff.head = conn->readBuff.tail = 0;
+    conn->readBuff.buff[0] = 0;
+
+#ifdef SNOW_RESPONSE_CACHE
+    snow_cache_entry_t cached;
+    bool revalidate = conn->method == GET && snow_cacheLookup(conn, &cached);
+#endif
+
+    snow_parseUrl(conn);
+    if (conn->connectionStatus == CONN_DONE) return; // failed, err_cb was called
+
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    conn->trackedHost = snow_findTrackedHost(conn);
+#endif
+
+    if (conn->hedgeDelay && conn->method == GET) conn->hedgeAt = conn->statusTime[CONN_UNREADY] + snow_hedgeDelayNs(conn);
+
+    if (conn->method >= 0) snow_bufferRequest(conn);
+#ifdef SNOW_WEBSOCKET
+    if (conn->method == __WEBSOCKET) snow_ws_bufferUpgrade(conn);
+#endif
+#ifdef SNOW_RESPONSE_CACHE
+    if (revalidate) snow_bufferValidators(conn, &cached);
+#endif
+
+#ifdef SNOW_HTTP2
+    if (conn->secure && conn->method >= 0 && snow_h2_attach(conn)) return; // goes out as a stream
 #endif
 
+    snow_openConn(conn);
+}
+
+// starts connections of the calling loop, registering all their sockets in one pass
+static void snow_startConns(snow_global_t *global, const int *ids, size_t n) {
+    bool outer = snow_pendingIoN < 0; // otherwise called from a callback of another snow_startConns, which registers them
+    if (outer) snow_pendingIoN = 0;
+
+    for (size_t i = 0; i < n; i++) snow_startConn(&global->connections[ids[i]]);
+    if (!outer) return;
+
+    int kept = 0;
+    for (int i = 0; i < snow_pendingIoN; i++)
+        if (snow_pendingIo[i]) snow_pendingIo[kept++] = snow_pendingIo[i];
+    snow_pendingIoN = -1;
+
+    if (kept) ev_io_start_batch(((snow_connection_t *) ((struct ev_io_snow *) snow_pendingIo[0])->data)->loop, snow_pendingIo, kept);
+}
+
+// clears the free connection id & sets it up for a request on loopId, claimed at now (ns), the caller counts it in loopLoad
+static snow_connection_t *snow_claimConn(snow_global_t *global, int id, int loopId, uint64_t now, int method, const char *url,
+                                         void (*write_cb)(char *data, size_t data_len, void *extra), void (*err_cb)(int err, void *extra),
+                                         void *extra, const char *extraHeaders, size_t extraHeaders_size) {
+    snow_connection_t *conn = &global->connections[id];
+
+    memset((void *) conn, 0, (char *) &conn->writeBuff - (char *) conn); // buffers are rewound by snow_startConn on the owning loop
+
     conn->id = id;
 
 #ifdef SNOW_MULTI_LOOP
-    conn->loop = global->loops[global->rr_loop];
-    global->rr_loop = (global->rr_loop + 1) % multi_loop_n_runtime;
+    conn->loopId = loopId;
+    conn->loop = global->loops[conn->loopId];
 #else
     conn->loop = global->loop;
 #endif
@@ -599,101 +1883,1599 @@ void snow_do(snow_global_t *global, int method, const char *url, void (*write_cb
     conn->extraHeaders = extraHeaders;
     conn->extraHeaders_size = extraHeaders_size;
 
-    conn->creationTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-    snow_parseUrl(conn);
-    snow_resolveHost(conn);
-    snow_initConnection(conn);
+    conn->creationTime = now / 1000000; // steady_clock is CLOCK_MONOTONIC as well
+    conn->statusTime[CONN_UNREADY] = now;
+
+    conn->hedgeSuccessor.store(0, std::memory_order_relaxed);
+    uint32_t generation = conn->generation.load(std::memory_order_relaxed) + 1;
+    conn->generation.store(generation ? generation : 1, std::memory_order_release); // publishes the request to snow_cancel
 
-    if (conn->method != __TLS_DUMMY) snow_bufferRequest(conn);
+    return conn;
 }
 
-void snow_enqueue(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
-                  void (*err_cb)(int err, void *extra),
-                  void *extra, const char *extraHeaders, size_t extraHeaders_size) {
+// claims a free connection on the loop chosen for url, nullptr if there is none
+static snow_connection_t *snow_claimFree(snow_global_t *global, int method, const char *url,
+                                         void (*write_cb)(char *data, size_t data_len, void *extra), void (*err_cb)(int err, void *extra),
+                                         void *extra, const char *extraHeaders, size_t extraHeaders_size) {
+    int id = -1;
+#ifdef SNOW_MULTI_LOOP
+    int loopId = snow_selectLoop(global, url);
 
-    if (global->freeConnections.empty()) { // check for free connections
-        global->requestQueue.push({method, url, extra, write_cb, err_cb, extraHeaders, extraHeaders_size});
-        return;
-    }
+    // each loop owns its connections, if the chosen one has none left the next loop with a free one takes the request
+    for (int i = 0; i < multi_loop_n_runtime && !global->freeConnections[loopId].pop(id); i++)
+        loopId = (loopId + 1) % multi_loop_n_runtime;
 
-    snow_do(global, method, url, write_cb, err_cb, extra, extraHeaders, extraHeaders_size);
-}
+    if (id < 0) return nullptr; // every loop is full
+    global->loopLoad[loopId].fetch_add(1, std::memory_order_relaxed);
+#else
+    int loopId = 0;
+    if (global->freeConnections.empty()) // check for free connections
+        return nullptr;
 
-#ifdef SNOW_TLS_SESSION_REUSE
+    id = global->freeConnections.front();
+    global->freeConnections.pop();
+#endif
 
-void snow_addWantedSession(snow_global_t *global, const std::string &url) {
-    global->wantedSessions.push_back(url);
+    return snow_claimConn(global, id, loopId, snow_now_ns(), method, url, write_cb, err_cb, extra, extraHeaders, extraHeaders_size);
 }
 
-#endif
+static inline snow_handle_t snow_connHandle(snow_connection_t *conn) {
+    return (snow_handle_t) conn->generation.load(std::memory_order_relaxed) << 32U | (unsigned) conn->id;
+}
 
+// hands a claimed connection to its loop, conn must not be touched afterwards
+static void snow_launch(snow_connection_t *conn) {
 #ifdef SNOW_MULTI_LOOP
+    if (conn->loopId != snow_currentLoop) {
+        conn->global->loopInbox[conn->loopId].push(conn->id); // set up by its own loop thread
+        return;
+    }
+#endif
 
-void snow_spawnLoops(snow_global_t *global) {
-    for (int id = 0; id < multi_loop_n_runtime; id++)
-        global->threads[id] = std::thread([](ev_loop *loop) { ev_run(loop, nullptr); }, global->loops[id]);
+    snow_startConn(conn);
 }
 
-void snow_joinLoops(snow_global_t *global) {
-    for (int id = 0; id < multi_loop_n_runtime; id++)
-        global->threads[id].join();
+// the rest of a claimed request, before its launch
+static snow_handle_t snow_prepare(snow_connection_t *conn, const char *url, const snow_callback_t *callback, int hedgeDelay,
+                                  uint64_t flightHash) {
+    if (callback && callback->invoke) conn->callback = *callback;
+    conn->hedgeDelay = hedgeDelay;
+    snow_handle_t handle = snow_connHandle(conn);
+    if (flightHash) snow_startFlight(conn, flightHash, url, handle);
+    return handle;
 }
 
-#endif
+// starts the request on a free connection, returns 0 if there is none
+snow_handle_t snow_start(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                         void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback, const char *extraHeaders,
+                         size_t extraHeaders_size, int hedgeDelay, uint64_t flightHash) {
 
-void snow_init(snow_global_t *global) {
-    wolfSSL_Init();
+    snow_connection_t *conn = snow_claimFree(global, method, url, write_cb, err_cb, extra, extraHeaders, extraHeaders_size);
+    if (!conn) return 0;
 
-    global->wolfCtx = wolfSSL_CTX_new(wolfTLSv1_2_client_method());
+    snow_handle_t handle = snow_prepare(conn, url, callback, hedgeDelay, flightHash);
+    snow_launch(conn);
+    return handle;
+}
 
-    if (global->wolfCtx == nullptr) {
-        fprintf(stderr, "ERR: wolfSSL_CTX_new error.\n");
-        assert(0);
-    }
+// sends the request of conn again on another connection of its loop, runs on that loop
+void snow_startHedge(snow_connection_t *conn) {
+    snow_global_t *global = conn->global;
+    char url[connUrlSize];
+    int id;
 
-#ifdef SNOW_TLS_SESSION_REUSE
-    if (wolfSSL_CTX_UseSessionTicket(global->wolfCtx) != SSL_SUCCESS) {
-        fprintf(stderr, "ERR: ticket enable error.\n");
-        assert(0);
-    }
+    // snow_parseUrl split the original in place
+    if (snprintf(url, sizeof(url), "%s://%s:%s/%s", conn->protocol, conn->hostname, conn->portPtr, conn->path) >= (int) sizeof(url))
+        return;
 
-    if (wolfSSL_CTX_set_session_cache_mode(global->wolfCtx, SSL_SESS_CACHE_NO_AUTO_CLEAR) != SSL_SUCCESS) {
-        fprintf(stderr, "ERR: could not turn session cache flushing off.\n");
-        assert(0);
-    }
+#ifdef SNOW_MULTI_LOOP
+    if (!global->freeConnections[conn->loopId].pop(id)) return; // none to spare, the original carries on alone
+    global->loopLoad[conn->loopId].fetch_add(1, std::memory_order_relaxed);
+#else
+    if (global->freeConnections.empty()) return;
+    id = global->freeConnections.front();
+    global->freeConnections.pop();
 #endif
 
-#ifdef SNOW_NO_CERT_VERIFY
-    wolfSSL_CTX_set_verify(global->wolfCtx, WOLFSSL_VERIFY_NONE, nullptr);
+    snow_connection_t *hedge = snow_claimConn(global, id, conn->loopId, snow_now_ns(), conn->method, url, conn->write_cb, conn->err_cb,
+                                              conn->extra_cb, conn->extraHeaders, conn->extraHeaders_size);
+    hedge->callback = conn->callback;
+    hedge->hedge = true;
+    hedge->hedgePeer = conn->id + 1;
+    hedge->flight = conn->flight; // whichever of the two reports ends the flight
+#ifdef SNOW_RESPONSE_CACHE
+    hedge->cacheHash = conn->cacheHash;
+    strcpy(hedge->cacheUrl, conn->cacheUrl);
+#endif
+    hedge->statusTime[CONN_UNREADY] = conn->statusTime[CONN_UNREADY]; // PHASE_TOTAL of a winning duplicate is what the caller saw
+    conn->hedgePeer = id + 1;
+
+    snow_count(snow_connStats(conn), STAT_HEDGES);
+    snow_startConn(hedge);
+}
+
+#ifdef SNOW_HTTP2
+
+static thread_local char snow_h2Scratch[connBufferSize]; // HPACK literals being decoded
+
+static inline snow_h2_session_t *snow_h2_session(snow_connection_t *conn) {
+    return &conn->global->h2Sessions[conn->loopId][conn->h2Session - 1];
+}
+
+// false once the connection carrying session was closed, the slot may already carry another request
+static inline bool snow_h2_alive(snow_h2_session_t *session, snow_connection_t *transport) {
+    return session->conn == transport->id + 1 && session->generation == transport->generation.load(std::memory_order_relaxed);
+}
+
+// room for len more bytes at the end of the transport's writeBuff, nullptr if it is full
+static char *snow_h2_reserve(snow_connection_t *transport, size_t len) {
+    buff_static_t *buff = &transport->writeBuff;
+
+    if (buff->tail == buff->head) buff->tail = buff->head = 0;
+    else if (buff->head + len > connBufferSize && buff->tail) {
+        memmove(buff->buff, buff->buff + buff->tail, buff->head - buff->tail);
+        buff->head -= buff->tail;
+        buff->tail = 0;
+    }
+
+    return buff->head + len <= connBufferSize ? buff->buff + buff->head : nullptr;
+}
+
+// sends the len bytes written after snow_h2_reserve once the socket takes them
+static void snow_h2_queue(snow_connection_t *transport, size_t len) {
+    transport->writeBuff.head += len;
+    if (transport->connectionStatus == CONN_READY) ev_io_start(transport->loop, (struct ev_io *) &transport->iow);
+}
+
+static void snow_h2_control(snow_connection_t *transport, int type, int flags, uint32_t streamId, const char *payload, size_t len) {
+    char *frame = snow_h2_reserve(transport, h2FrameHeaderSize + len);
+    if (!frame) return; // a full buffer only ever holds frames the server still has to read, it answers those first
+
+    char *it = snow_h2_frameHeader(frame, len, type, flags, streamId);
+    if (len) memcpy(it, payload, len);
+    snow_h2_queue(transport, h2FrameHeaderSize + len);
+}
+
+static void snow_h2_windowUpdate(snow_connection_t *transport, uint32_t streamId, uint32_t increment) {
+    char payload[4];
+    snow_h2_write32(payload, increment);
+    snow_h2_control(transport, H2_WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+void snow_h2_flush(snow_connection_t *transport) {
+    size_t pending = snow_buff_to_pull(&transport->writeBuff);
+    if (pending) {
+        size_t remain = snow_buff_pull_to_sock(&transport->writeBuff, transport, pending);
+        if (remain) return; // -1 - failed & closed, otherwise the rest goes on the next write event
+    }
+
+    transport->writeBuff.head = transport->writeBuff.tail = 0;
+    ev_io_stop(transport->loop, (struct ev_io *) &transport->iow);
+}
+
+// bytes after the headers of the request buffered in conn's writeBuff
+static size_t snow_h2_bodyLen(snow_connection_t *conn) {
+    const char *end = strstr(conn->writeBuff.buff, "\r\n\r\n");
+    return end ? conn->writeBuff.buff + conn->writeBuff.head - (end + 4) : 0;
+}
+
+// sends the request buffered in conn's writeBuff as a new stream, its HTTP/1.1 text is converted to HPACK
+static void snow_h2_openStream(snow_h2_session_t *session, snow_connection_t *conn) {
+    snow_connection_t *transport = &conn->global->connections[session->conn - 1];
+    const char *text = conn->writeBuff.buff, *textEnd = text + conn->writeBuff.head;
+    size_t bodyLen = snow_h2_bodyLen(conn);
+
+    // HPACK never takes more than the text & a few bytes per field, checked up front since the encoder's table
+    // has to stay in step with the server's even if the request is dropped
+    size_t blockMax = conn->writeBuff.head + 64;
+    char *frame = blockMax <= h2MaxFrameSize ? snow_h2_reserve(transport, 2 * h2FrameHeaderSize + blockMax) : nullptr;
+    if (!frame) {
+        snow_processConnError(conn, BUFF_WRITE_SMALL);
+        return;
+    }
+
+    char *block = frame + h2FrameHeaderSize, *out = block;
+    if (session->tableResized) {
+        out = snow_hpack_encodeInt(out, 0x20, 5, session->encoder.maxSize);
+        session->tableResized = false;
+    }
+
+    const char *methodEnd = strchr(text, ' '), *path = methodEnd + 1, *pathEnd = strchr(path, ' ');
+    const char *line = strstr(pathEnd, "\r\n") + 2;
+
+    out = snow_hpack_encode(&session->encoder, out, ":method", 7, text, methodEnd - text, HPACK_INDEXED);
+    out = snow_hpack_encode(&session->encoder, out, ":scheme", 7, "https", 5, HPACK_INDEXED);
+    out = snow_hpack_encode(&session->encoder, out, ":path", 5, path, pathEnd - path, HPACK_NOT_INDEXED);
+
+    // header lines, names lowercased, the ones tied to HTTP/1.1 connections dropped, Host becomes :authority
+    while (line < textEnd && strncmp(line, "\r\n", 2) != 0) {
+        const char *colon = strchr(line, ':'), *lineEnd = strstr(line, "\r\n");
+        if (!colon || !lineEnd || colon > lineEnd) break;
+
+        const char *value = colon + 1;
+        while (*value == ' ') value++;
+        size_t valueLen = lineEnd - value;
+
+        char name[64];
+        size_t nameLen = colon - line;
+        if (nameLen < sizeof(name)) {
+            for (size_t i = 0; i < nameLen; i++) name[i] = (char) tolower(line[i]);
+            name[nameLen] = 0;
+
+            int indexing = nameLen + valueLen + 32 <= session->encoder.maxSize / 4 ? HPACK_INDEXED : HPACK_NOT_INDEXED;
+            if (strcmp(name, "authorization") == 0 || strcmp(name, "cookie") == 0) indexing = HPACK_NEVER_INDEXED;
+
+            if (strcmp(name, "host") == 0)
+                out = snow_hpack_encode(&session->encoder, out, ":authority", 10, value, valueLen, HPACK_INDEXED);
+            else if (strcmp(name, "connection") != 0 && strcmp(name, "keep-alive") != 0 && strcmp(name, "proxy-connection") != 0 &&
+                     strcmp(name, "transfer-encoding") != 0 && strcmp(name, "upgrade") != 0 && strcmp(name, "te") != 0)
+                out = snow_hpack_encode(&session->encoder, out, name, nameLen, value, valueLen, indexing);
+        }
+        line = lineEnd + 2;
+    }
+
+    uint32_t streamId = session->nextStreamId;
+    session->nextStreamId += 2;
+    if (session->nextStreamId > INT32_MAX) session->state = H2_SESSION_GOAWAY; // out of ids, new requests get a new connection
+
+    size_t blockLen = out - block;
+    snow_h2_frameHeader(frame, blockLen, H2_HEADERS, H2_END_HEADERS | (bodyLen ? 0 : H2_END_STREAM), streamId);
+    size_t len = h2FrameHeaderSize + blockLen;
+
+    if (bodyLen) { // snow_h2_pump checked the windows
+        memcpy(snow_h2_frameHeader(frame + len, bodyLen, H2_DATA, H2_END_STREAM, streamId), textEnd - bodyLen, bodyLen);
+        len += h2FrameHeaderSize + bodyLen;
+        session->sendWindow -= bodyLen;
+    }
+    snow_h2_queue(transport, len);
+
+    int slot = 0;
+    while (session->streams[slot]) slot++; // streamN < maxStreams <= h2StreamsMax
+    session->streams[slot] = conn->id + 1;
+    session->streamN++;
+    conn->h2StreamId = streamId;
+
+    snow_count(snow_connStats(conn), STAT_H2_STREAMS);
+    snow_setStatus(conn, CONN_ACK);
+    snow_setStatus(conn, CONN_READY);
+    snow_setStatus(conn, CONN_WAITING);
+}
+
+// opens streams for waiting requests while the server allows more
+static void snow_h2_pump(snow_h2_session_t *session, snow_global_t *global) {
+    while (session->state == H2_SESSION_OPEN && session->waitingFirst && session->streamN < session->maxStreams) {
+        snow_connection_t *conn = &global->connections[session->waitingFirst - 1];
+
+        auto bodyLen = (int64_t) snow_h2_bodyLen(conn);
+        if (bodyLen > session->sendWindow || bodyLen > session->peerStreamWindow) return; // until a WINDOW_UPDATE / SETTINGS
+
+        session->waitingFirst = conn->h2Next;
+        if (!session->waitingFirst) session->waitingLast = 0;
+        conn->h2Next = 0;
+
+        snow_h2_openStream(session, conn);
+    }
+}
+
+// connection id + 1 of the open stream, 0 if it is closed
+static int snow_h2_findStream(snow_h2_session_t *session, snow_global_t *global, uint32_t streamId) {
+    for (int i = 0, seen = 0; i < h2StreamsMax && seen < session->streamN; i++) {
+        if (!session->streams[i]) continue;
+        seen++;
+        if (global->connections[session->streams[i] - 1].h2StreamId == streamId) return session->streams[i];
+    }
+    return 0;
+}
+
+// takes conn's stream out of the session without telling the server
+static void snow_h2_removeStream(snow_h2_session_t *session, snow_connection_t *conn) {
+    for (int i = 0; i < h2StreamsMax; i++) {
+        if (session->streams[i] != conn->id + 1) continue;
+        session->streams[i] = 0;
+        session->streamN--;
+        break;
+    }
+    conn->h2StreamId = 0;
+}
+
+static void snow_h2_unlinkWaiting(snow_h2_session_t *session, snow_connection_t *conn) {
+    snow_connections_t &connections = conn->global->connections;
+    int *link = &session->waitingFirst, prev = 0;
+
+    while (*link && *link != conn->id + 1) {
+        prev = *link;
+        link = &connections[*link - 1].h2Next;
+    }
+    if (!*link) return;
+
+    *link = conn->h2Next;
+    if (session->waitingLast == conn->id + 1) session->waitingLast = prev;
+    conn->h2Next = 0;
+}
+
+void snow_h2_closeStream(snow_connection_t *conn) {
+    snow_h2_session_t *session = snow_h2_session(conn);
+
+    if (conn->h2StreamId) { // still open, the server can stop sending
+        uint32_t streamId = conn->h2StreamId;
+        snow_h2_removeStream(session, conn);
+
+        if (session->state == H2_SESSION_OPEN || session->state == H2_SESSION_GOAWAY) {
+            char payload[4];
+            snow_h2_write32(payload, H2_CANCEL);
+            snow_h2_control(&conn->global->connections[session->conn - 1], H2_RST_STREAM, 0, streamId, payload, sizeof(payload));
+        }
+    } else snow_h2_unlinkWaiting(session, conn);
+
+    conn->h2Session = 0;
+    snow_h2_pump(session, conn->global);
+}
+
+// sends the waiting requests somewhere else, a new connection to the host or HTTP/1.1
+static void snow_h2_requeue(snow_h2_session_t *session, snow_global_t *global) {
+    while (session->waitingFirst) {
+        snow_connection_t *conn = &global->connections[session->waitingFirst - 1];
+        snow_h2_unlinkWaiting(session, conn);
+        conn->h2Session = 0;
+        if (!snow_h2_attach(conn)) snow_openConn(conn);
+    }
+}
+
+void snow_h2_closeSession(snow_connection_t *transport, int err) {
+    snow_h2_session_t *session = snow_h2_session(transport);
+    snow_global_t *global = transport->global;
+    transport->h2Session = 0;
+    if (!snow_h2_alive(session, transport)) return;
+
+    session->conn = 0;
+    if (session->state != H2_SESSION_UNSUPPORTED) session->state = H2_SESSION_CLOSING; // no RST_STREAMs, no new streams
+
+    for (int i = 0; i < h2StreamsMax && session->streamN; i++) {
+        if (!session->streams[i]) continue;
+        snow_connection_t *conn = &global->connections[session->streams[i] - 1];
+        snow_h2_removeStream(session, conn);
+        snow_processConnError(conn, err);
+    }
+    while (session->waitingFirst) snow_processConnError(&global->connections[session->waitingFirst - 1], err);
+
+    if (session->state == H2_SESSION_CLOSING) session->state = H2_SESSION_FREE;
+}
+
+// the connection a session uses, the last ones of the loop's share are never handed to requests
+// so a burst of them can't leave a new session without one
+static int snow_h2_transportId(int loopId, int index) {
+#ifdef SNOW_MULTI_LOOP
+    return snow_loopFirstConn(loopId + 1) - 1 - index;
 #else
-    // Load CA certificates into WOLFSSL_CTX
-    if (wolfSSL_CTX_load_verify_locations(global->wolfCtx, sslCertPath, nullptr) != SSL_SUCCESS) {
-        fprintf(stderr, "ERR: Error loading %s", sslCertPath);
-        assert(0);
+    return concurrentConnections - 1 - index;
+#endif
+}
+
+// opens the connection of a new session for conn's host, on conn's loop
+static bool snow_h2_connect(snow_connection_t *conn, int index) {
+    snow_global_t *global = conn->global;
+    snow_h2_session_t *session = &global->h2Sessions[conn->loopId][index];
+    char url[connUrlSize];
+    int id = snow_h2_transportId(conn->loopId, index);
+
+    if (snprintf(url, sizeof(url), "https://%s:%d/", conn->hostname, conn->port) >= (int) sizeof(url)) return false;
+
+#ifdef SNOW_MULTI_LOOP
+    global->loopLoad[conn->loopId].fetch_add(1, std::memory_order_relaxed);
+#endif
+    snow_connection_t *transport = snow_claimConn(global, id, conn->loopId, snow_now_ns(), __H2_SESSION, url, nullptr, nullptr, nullptr,
+                                                  nullptr, 0);
+    transport->h2Session = index + 1;
+
+    session->state = H2_SESSION_CONNECTING;
+    strcpy(session->host, conn->hostname);
+    session->port = conn->port;
+    session->conn = id + 1;
+    session->generation = transport->generation.load(std::memory_order_relaxed);
+    session->nextStreamId = 1;
+    session->maxStreams = h2StreamsMax;
+    session->sendWindow = session->peerStreamWindow = h2DefaultWindow;
+    session->recvUnacked = 0;
+    session->tableResized = false;
+    session->encoder.clear();
+    session->decoder.clear();
+
+    snow_startConn(transport);
+    return snow_h2_alive(session, transport); // resolving or connecting may already have failed
+}
+
+bool snow_h2_attach(snow_connection_t *conn) {
+    snow_h2_session_t *sessions = conn->global->h2Sessions[conn->loopId];
+    uint64_t time = snow_monotonic_ms();
+    int index = -1, free = -1;
+
+    for (int i = 0; i < h2SessionsMax && index < 0; i++) {
+        snow_h2_session_t *session = &sessions[i];
+        if (session->state == H2_SESSION_UNSUPPORTED && time >= session->retryAt) session->state = H2_SESSION_FREE;
+
+        if (session->state == H2_SESSION_FREE) {
+            if (free < 0) free = i;
+        } else if (session->port == conn->port && strcmp(session->host, conn->hostname) == 0) {
+            if (session->state == H2_SESSION_UNSUPPORTED) return false;
+            if (session->state == H2_SESSION_CONNECTING || session->state == H2_SESSION_OPEN) index = i;
+        }
+    }
+
+    if (index < 0) {
+        if (free < 0 || strlen(conn->hostname) >= addrCacheKeySize || !snow_h2_connect(conn, free)) return false;
+        index = free;
+    }
+
+    snow_h2_session_t *session = &sessions[index];
+    conn->h2Session = index + 1;
+    snow_setStatus(conn, CONN_IN_PROGRESS); // until it gets a stream
+
+    if (session->waitingLast) conn->global->connections[session->waitingLast - 1].h2Next = conn->id + 1;
+    else session->waitingFirst = conn->id + 1;
+    session->waitingLast = conn->id + 1;
+
+    snow_h2_pump(session, conn->global);
+    return true;
+}
+
+void snow_h2_begin(snow_connection_t *transport) {
+    snow_h2_session_t *session = snow_h2_session(transport);
+    char *protocol = nullptr;
+    unsigned short protocolLen = 0;
+
+    if (wolfSSL_ALPN_GetProtocol(transport->ssl, &protocol, &protocolLen) != WOLFSSL_SUCCESS || protocolLen != 2 ||
+        memcmp(protocol, "h2", 2) != 0) { // HTTP/1.1 only, its requests get their own connections for a while
+        session->state = H2_SESSION_UNSUPPORTED;
+        session->retryAt = snow_monotonic_ms() + h2RetryInterval;
+        snow_h2_requeue(session, transport->global);
+
+        session->conn = 0;
+        transport->h2Session = 0;
+        snow_closeConn(transport);
+        return;
+    }
+
+    snow_count(snow_connStats(transport), STAT_H2_CONNECTIONS);
+
+    // preface, SETTINGS & a connection window as large as all the stream windows
+    char settings[3 * 6], *it = settings;
+    const uint32_t values[3][2] = {{H2_ENABLE_PUSH, 0}, {H2_INITIAL_WINDOW_SIZE, h2StreamWindow}, {H2_MAX_FRAME_SIZE, h2MaxFrameSize}};
+    for (auto &value : values) {
+        *it++ = 0;
+        *it++ = (char) value[0];
+        it = snow_h2_write32(it, value[1]);
     }
+
+    char *preface = snow_h2_reserve(transport, sizeof(h2Preface) - 1);
+    memcpy(preface, h2Preface, sizeof(h2Preface) - 1);
+    snow_h2_queue(transport, sizeof(h2Preface) - 1);
+    snow_h2_control(transport, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    snow_h2_windowUpdate(transport, 0, (uint32_t) h2StreamWindow * h2StreamsMax - h2DefaultWindow);
+
+    session->state = H2_SESSION_OPEN;
+    snow_h2_pump(session, transport->global);
+}
+
+// the stream's response is complete
+static void snow_h2_endStream(snow_h2_session_t *session, snow_connection_t *conn) {
+    snow_h2_removeStream(session, conn); // the server closed it
+
+    if (!conn->h2Headers) {
+        snow_processConnError(conn, HEADER_PARSING);
+        return;
+    }
+
+    conn->contentLen = conn->readBuff.buff + conn->readBuff.head - conn->content;
+    snow_terminateConn(conn);
+}
+
+// response headers, written to the stream's readBuff as HTTP/1.1 style text so the rest of the lib reads them as usual
+static bool snow_h2_headers(snow_connection_t *transport, snow_h2_session_t *session, snow_connection_t *conn, const uint8_t *block,
+                            size_t len, bool endStream) {
+    bool first = conn && !conn->h2Headers, overflow = false;
+    char *out = nullptr, *outEnd = nullptr;
+    int status = 0;
+
+    if (first) {
+        out = conn->readBuff.buff + conn->readBuff.head;
+        outEnd = conn->readBuff.buff + connBufferSize - 3; // final \r\n & terminator
+    }
+
+    // decoded even without a stream to write to, the table has to see every block
+    bool valid = snow_hpack_decode(&session->decoder, block, block + len, snow_h2Scratch, sizeof(snow_h2Scratch),
+                                   [&](const char *name, size_t nameLen, const char *value, size_t valueLen) {
+        if (!first) return; // trailers
+        bool isStatus = nameLen == 7 && memcmp(name, ":status", 7) == 0;
+        if (nameLen && name[0] == ':' && !isStatus) return;
+
+        if (out + nameLen + valueLen + 8 > outEnd) {
+            overflow = true;
+            return;
+        }
+
+        if (isStatus) { // HTTP/2 200
+            for (size_t i = 0; i < valueLen; i++) status = status * 10 + value[i] - '0';
+            memcpy(out, "HTTP/2 ", 7);
+            out += 7;
+        } else {
+            memcpy(out, name, nameLen);
+            memcpy(out + nameLen, ": ", 2);
+            out += nameLen + 2;
+        }
+        memcpy(out, value, valueLen);
+        memcpy(out + valueLen, "\r\n", 2);
+        out += valueLen + 2;
+    });
+
+    if (!valid) { // COMPRESSION_ERROR, the decoder is out of step for good
+        snow_processConnError(transport, HTTP2_ERROR);
+        return false;
+    }
+    if (!conn) return true;
+
+    if (first && status >= 100 && status < 200) return true; // informational, the final headers follow
+
+    if (first) {
+        if (overflow) {
+            snow_processConnError(conn, BUFF_READ_SMALL);
+            return snow_h2_alive(session, transport);
+        }
+
+        memcpy(out, "\r\n", 2);
+        out += 2;
+        *out = 0;
+
+        conn->statusCode = status;
+        conn->h2Headers = true;
+        conn->readBuff.head = conn->readBuff.tail = out - conn->readBuff.buff;
+        conn->content = out;
+        snow_setStatus(conn, CONN_RECEIVING);
+    }
+
+    if (endStream) snow_h2_endStream(session, conn);
+    return snow_h2_alive(session, transport);
+}
+
+// one frame, false once the connection is gone
+static bool snow_h2_frame(snow_connection_t *transport, snow_h2_session_t *session, int type, int flags, uint32_t streamId,
+                          const uint8_t *payload, size_t len) {
+    snow_global_t *global = transport->global;
+    int stream = streamId ? snow_h2_findStream(session, global, streamId) : 0;
+    snow_connection_t *conn = stream ? &global->connections[stream - 1] : nullptr;
+
+    switch (type) {
+        case H2_DATA: {
+            size_t padding = flags & H2_PADDED ? payload[0] + 1 : 0;
+            if (padding > len) break;
+
+            session->recvUnacked += len;
+            if (session->recvUnacked >= (uint32_t) h2StreamWindow / 2) { // streams only get their initial window, it covers their readBuff
+                snow_h2_windowUpdate(transport, 0, session->recvUnacked);
+                session->recvUnacked = 0;
+            }
+            if (!conn) break; // closed on our side, e.g. cancelled
+
+            size_t dataLen = len - padding;
+            buff_static_t *buff = &conn->readBuff;
+            if (!conn->h2Headers || buff->head + dataLen > connBufferSize - 1) {
+                snow_processConnError(conn, conn->h2Headers ? BUFF_READ_SMALL : HEADER_PARSING);
+                break;
+            }
+
+            memcpy(buff->buff + buff->head, payload + (flags & H2_PADDED ? 1 : 0), dataLen);
+            buff->head += dataLen;
+            buff->buff[buff->head] = 0;
+
+            if (flags & H2_END_STREAM) snow_h2_endStream(session, conn);
+            break;
+        }
+
+        case H2_HEADERS: // the block was joined with its CONTINUATION frames, see snow_h2_process
+            return snow_h2_headers(transport, session, conn, payload, len, flags & H2_END_STREAM);
+
+        case H2_RST_STREAM:
+            if (conn) {
+                snow_h2_removeStream(session, conn);
+                snow_processConnError(conn, HTTP2_ERROR);
+            }
+            break;
+
+        case H2_SETTINGS:
+            if (flags & H2_ACK) break;
+            if (len % 6) {
+                snow_processConnError(transport, HTTP2_ERROR);
+                return false;
+            }
+
+            for (size_t i = 0; i < len; i += 6) {
+                uint32_t value = snow_h2_read32(payload + i + 2);
+                switch (payload[i] << 8U | payload[i + 1]) {
+                    case H2_HEADER_TABLE_SIZE:
+                        value = std::min<uint32_t>(value, hpackTableSize);
+                        if (value != session->encoder.maxSize) {
+                            session->encoder.resize(value);
+                            session->tableResized = true;
+                        }
+                        break;
+                    case H2_MAX_CONCURRENT_STREAMS:
+                        session->maxStreams = (int) std::min<uint32_t>(value, h2StreamsMax);
+                        break;
+                    case H2_INITIAL_WINDOW_SIZE:
+                        session->peerStreamWindow = value;
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            snow_h2_control(transport, H2_SETTINGS, H2_ACK, 0, nullptr, 0);
+            snow_h2_pump(session, global);
+            break;
+
+        case H2_PING:
+            if (!(flags & H2_ACK) && len == 8) snow_h2_control(transport, H2_PING, H2_ACK, 0, (const char *) payload, 8);
+            break;
+
+        case H2_GOAWAY: {
+            if (len < 8) break;
+            uint32_t lastStreamId = snow_h2_read32(payload) & 0x7fffffffU;
+            session->state = H2_SESSION_GOAWAY;
+
+            // streams after lastStreamId were never processed, they go out again on a new connection
+            for (int i = 0; i < h2StreamsMax && snow_h2_alive(session, transport); i++) {
+                if (!session->streams[i]) continue;
+                snow_connection_t *retry = &global->connections[session->streams[i] - 1];
+                if (retry->h2StreamId <= lastStreamId) continue;
+
+                snow_h2_removeStream(session, retry);
+                retry->h2Session = 0;
+                if (!snow_h2_attach(retry)) snow_openConn(retry);
+            }
+            if (snow_h2_alive(session, transport)) snow_h2_requeue(session, global);
+            break;
+        }
+
+        case H2_WINDOW_UPDATE:
+            if (len == 4 && !streamId) {
+                session->sendWindow += snow_h2_read32(payload) & 0x7fffffffU;
+                snow_h2_pump(session, global);
+            }
+            break;
+
+        case H2_PUSH_PROMISE: // disabled in our SETTINGS
+        case H2_CONTINUATION: // without its HEADERS
+            snow_processConnError(transport, HTTP2_ERROR);
+            return false;
+
+        default: // PRIORITY & unknown types
+            break;
+    }
+
+    return snow_h2_alive(session, transport);
+}
+
+// processes the complete frames in the transport's readBuff, false once the connection is gone
+static bool snow_h2_process(snow_connection_t *transport, snow_h2_session_t *session) {
+    buff_static_t *buff = &transport->readBuff;
+
+    while (buff->head - buff->tail >= h2FrameHeaderSize) {
+        auto *frame = (uint8_t *) buff->buff + buff->tail;
+        size_t len = frame[0] << 16U | frame[1] << 8U | frame[2];
+        int type = frame[3], flags = frame[4];
+        uint32_t streamId = snow_h2_read32(frame + 5) & 0x7fffffffU;
+
+        if (len > h2MaxFrameSize) {
+            snow_processConnError(transport, HTTP2_ERROR);
+            return false;
+        }
+        if (buff->head - buff->tail < h2FrameHeaderSize + len) break;
+
+        uint8_t *payload = frame + h2FrameHeaderSize;
+        size_t next = buff->tail + h2FrameHeaderSize + len;
+
+        if (type == H2_HEADERS) { // joined with its CONTINUATION frames once they are all there
+            size_t end = 0;
+            int block = snow_h2_blockEnd(frame, buff->head - buff->tail, &end);
+
+            if (block == H2_BLOCK_PARTIAL) { // the rest is still on its way
+                if (buff->tail == 0 && buff->head == connBufferSize - 1) {
+                    snow_processConnError(transport, BUFF_READ_SMALL);
+                    return false;
+                }
+                break;
+            }
+
+            long blockLen = block == H2_BLOCK_COMPLETE ? snow_h2_joinBlock(frame, end) : -1;
+            if (blockLen < 0) {
+                snow_processConnError(transport, HTTP2_ERROR);
+                return false;
+            }
+
+            buff->tail += end;
+            if (!snow_h2_frame(transport, session, type, flags, streamId, payload, blockLen)) return false;
+            continue;
+        }
+
+        buff->tail = next;
+        if (!snow_h2_frame(transport, session, type, flags, streamId, payload, len)) return false;
+    }
+
+    // keeps the partial frame
+    memmove(buff->buff, buff->buff + buff->tail, buff->head - buff->tail);
+    buff->head -= buff->tail;
+    buff->tail = 0;
+    buff->buff[buff->head] = 0;
+    return true;
+}
+
+void snow_h2_read(snow_connection_t *transport) {
+    snow_h2_session_t *session = snow_h2_session(transport);
+    buff_static_t *buff = &transport->readBuff;
+
+    for (;;) {
+        size_t room = connBufferSize - 1 - buff->head;
+        size_t n = snow_buff_put_from_sock(buff, transport, (int) room);
+        if (!snow_h2_alive(session, transport) || !snow_h2_process(transport, session)) return;
+        if (n < room) break; // wolfSSL may hold more than the socket signals, read until it runs dry
+    }
+
+    // nothing more to come on it, the server closes it too
+    if (session->state == H2_SESSION_GOAWAY && !session->streamN && !session->waitingFirst) {
+        session->conn = 0;
+        transport->h2Session = 0;
+        session->state = H2_SESSION_FREE;
+        snow_closeConn(transport);
+    }
+}
+
 #endif
 
-    for (int i = 0; i < concurrentConnections; i++)
-        global->freeConnections.push(i);  // atomic if multi loop
+#ifdef SNOW_WEBSOCKET
+
+// 4 random bytes for a mask key or the upgrade nonce, taken in batches from the kernel
+static void snow_ws_maskKey(uint8_t *out) {
+    static thread_local uint32_t keys[64];
+    static thread_local int left = 0;
 
+    if (!left) {
+        if (getrandom(keys, sizeof(keys), GRND_NONBLOCK) != (ssize_t) sizeof(keys)) { // pool not ready yet, masking only needs unpredictable
+            uint64_t seed = snow_now_ns();
+            for (uint32_t &key : keys) {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                key = (uint32_t) (seed >> 32U);
+            }
+        }
+        left = sizeof(keys) / sizeof(*keys);
+    }
+    memcpy(out, &keys[--left], 4);
+}
+
+void snow_ws_bufferUpgrade(snow_connection_t *conn) {
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i += 4) snow_ws_maskKey(nonce + i);
+
+    char key[wsKeySize + 1], keyGuid[wsKeySize + sizeof(wsGuid)];
+    snow_base64Encode(nonce, sizeof(nonce), key);
+
+    // the server has to answer with base64(SHA-1(key + guid))
+    memcpy(keyGuid, key, wsKeySize);
+    memcpy(keyGuid + wsKeySize, wsGuid, sizeof(wsGuid));
+    uint8_t digest[WC_SHA_DIGEST_SIZE];
+    wc_ShaHash((const byte *) keyGuid, wsKeySize + sizeof(wsGuid) - 1, digest);
+    snow_base64Encode(digest, sizeof(digest), conn->wsAccept);
+
+    int size = sprintf(conn->writeBuff.buff, "GET /%s HTTP/1.1\r\n"
+                                             "Host: %s\r\n"
+                                             "Upgrade: websocket\r\n"
+                                             "Connection: Upgrade\r\n"
+                                             "Sec-WebSocket-Key: %s\r\n"
+                                             "Sec-WebSocket-Version: 13\r\n"
+                                             "%.*s\r\n",
+                       conn->path, conn->hostname, key, (int) conn->extraHeaders_size, conn->extraHeaders);
+
+    conn->writeBuff.head += size;
+}
+
+// false once conn was closed or reused, e.g. from ws_cb
+static inline bool snow_ws_alive(snow_connection_t *conn, uint32_t generation) {
+    return conn->generation.load(std::memory_order_relaxed) == generation && conn->connectionStatus != CONN_DONE;
+}
+
+// hands data to ws_cb terminated, the byte after it belongs to the next frame & is put back
+static bool snow_ws_deliver(snow_connection_t *conn, char *data, size_t len, int opcode, uint32_t generation) {
+    char next = data[len];
+    data[len] = 0;
+    if (conn->ws_cb) conn->ws_cb(data, len, opcode, conn->extra_cb);
+    if (!snow_ws_alive(conn, generation)) return false;
+
+    data[len] = next;
+    return true;
+}
+
+void snow_ws_flush(snow_connection_t *conn) {
+    size_t pending = snow_buff_to_pull(&conn->writeBuff);
+    if (pending) {
+        size_t remain = snow_buff_pull_to_sock(&conn->writeBuff, conn, pending);
+        if (remain == (size_t) -1) return; // failed & closed
+
+        if (remain) { // the rest goes on the next write event
+            ev_io_start(conn->loop, (struct ev_io *) &conn->iow);
+            return;
+        }
+    }
+
+    conn->writeBuff.head = conn->writeBuff.tail = 0;
+    ev_io_stop(conn->loop, (struct ev_io *) &conn->iow);
+}
+
+// frames & masks a message into writeBuff and sends it, false if the socket is not open, closing or the message does not fit
+static bool snow_ws_write(snow_connection_t *conn, int opcode, const char *data, size_t len) {
+    if (!conn->wsOpen || conn->wsClosing) return false;
+    if (opcode >= WS_CLOSE && len > 125) return false;
+
+    buff_static_t *buff = &conn->writeBuff;
+    if (buff->tail) { // part of an earlier message is still waiting for the socket
+        memmove(buff->buff, buff->buff + buff->tail, buff->head - buff->tail);
+        buff->head -= buff->tail;
+        buff->tail = 0;
+    }
+    if (buff->head + wsMaxHeaderSize + len > connBufferSize - 1) return false;
+
+    uint8_t mask[4];
+    snow_ws_maskKey(mask);
+    char *payload = snow_ws_frameHeader(buff->buff + buff->head, opcode, true, len, mask);
+    if (len) memcpy(payload, data, len);
+    snow_ws_mask(payload, len, mask);
+    buff->head = payload + len - buff->buff;
+
+    if (opcode == WS_CLOSE) {
+        conn->wsClosing = true;
+        conn->creationTime = snow_monotonic_ms(); // the server gets connSockTimeout to answer
+    }
+
+    snow_ws_flush(conn);
+    return true;
+}
+
+// checks the server's answer to the upgrade, true once the connection is open
+static bool snow_ws_processUpgrade(snow_connection_t *conn, uint32_t generation) {
+    buff_static_t *buff = &conn->readBuff;
+    char *headers = &buff->buff[buff->tail];
+    char *end = strstr(headers, "\r\n\r\n");
+
+    if (!end) {
+        if (buff->head >= connBufferSize - 1) snow_processConnError(conn, HEADER_PARSING);
+        return false;
+    }
+
+    snow_setStatus(conn, CONN_RECEIVING);
+    char *status = strchr(headers, ' '); // HTTP/1.1 101 Switching Protocols
+    if (status) conn->statusCode = atoi(status + 1);
+
+    size_t len = 0;
+    const char *accept = snow_findHeader(headers, end + 2, "Sec-WebSocket-Accept:", &len);
+    if (conn->statusCode != 101 || !accept || len != wsAcceptSize || memcmp(accept, conn->wsAccept, wsAcceptSize) != 0) {
+        snow_processConnError(conn, WEBSOCKET_ERROR);
+        return false;
+    }
+
+    buff->tail = end + 4 - buff->buff; // frames may follow right away
+    conn->wsOpen = true;
+    snow_count(snow_connStats(conn), STAT_WS_OPENED);
+
+    if (conn->ws_cb) conn->ws_cb(nullptr, 0, WS_OPEN, conn->extra_cb);
+    return snow_ws_alive(conn, generation);
+}
+
+// handles the complete frames in readBuff, fragments are joined in place, false once the connection is gone
+static bool snow_ws_process(snow_connection_t *conn, uint32_t generation) {
+    buff_static_t *buff = &conn->readBuff;
+    snow_ws_frame_t frame;
+
+    for (;;) {
+        size_t avail = buff->head - buff->tail;
+        int parsed = snow_ws_parseHeader((const uint8_t *) buff->buff + buff->tail, avail, &frame);
+        if (parsed < 0) {
+            snow_processConnError(conn, WEBSOCKET_ERROR);
+            return false;
+        }
+
+        if (!parsed || avail - frame.headerLen < frame.len) { // the rest of it is still to come
+            size_t kept = conn->wsOpcode ? conn->wsMessageLen : 0;
+            if (parsed && kept + frame.headerLen + frame.len > connBufferSize - 1) {
+                snow_processConnError(conn, BUFF_READ_SMALL);
+                return false;
+            }
+            break;
+        }
+
+        char *payload = buff->buff + buff->tail + frame.headerLen;
+        size_t len = frame.len;
+        if (frame.masked) snow_ws_mask(payload, len, frame.mask); // servers must not mask, tolerated
+        buff->tail += frame.headerLen + len;
+
+        if (frame.opcode == WS_PING) {
+            if (!conn->wsClosing) snow_ws_write(conn, WS_PONG, payload, len);
+            if (!snow_ws_alive(conn, generation)) return false;
+        } else if (frame.opcode == WS_PONG) {
+            if (!snow_ws_deliver(conn, payload, len, WS_PONG, generation)) return false;
+        } else if (frame.opcode == WS_CLOSE) {
+            if (!conn->wsClosing) snow_ws_write(conn, WS_CLOSE, payload, len < 2 ? 0 : 2); // echoes the status code
+            if (!snow_ws_alive(conn, generation) || !snow_ws_deliver(conn, payload, len, WS_CLOSE, generation)) return false;
+
+            snow_closeConn(conn);
+            return false;
+        } else {
+            // a continuation needs a message to continue, a new message must not start inside one
+            if ((frame.opcode == WS_CONTINUATION) != (conn->wsOpcode != 0)) {
+                snow_processConnError(conn, WEBSOCKET_ERROR);
+                return false;
+            }
+
+            if (!conn->wsOpcode) {
+                conn->wsOpcode = frame.opcode;
+                conn->wsMessage = payload - buff->buff;
+                conn->wsMessageLen = 0;
+            }
+
+            char *messageEnd = buff->buff + conn->wsMessage + conn->wsMessageLen;
+            if (messageEnd != payload) memmove(messageEnd, payload, len); // over the headers of the fragments before
+            conn->wsMessageLen += len;
+
+            if (frame.fin) {
+                int opcode = conn->wsOpcode;
+                conn->wsOpcode = 0;
+                snow_count(snow_connStats(conn), STAT_WS_MESSAGES);
+                if (!snow_ws_deliver(conn, buff->buff + conn->wsMessage, conn->wsMessageLen, opcode, generation)) return false;
+            }
+        }
+    }
+
+    // what is left moves to the front: the message being joined, then the frame not complete yet
+    size_t kept = conn->wsOpcode ? conn->wsMessageLen : 0, rest = buff->head - buff->tail;
+    if (kept && conn->wsMessage) memmove(buff->buff, buff->buff + conn->wsMessage, kept);
+    if (rest && buff->tail != kept) memmove(buff->buff + kept, buff->buff + buff->tail, rest);
+
+    conn->wsMessage = 0;
+    buff->tail = kept;
+    buff->head = kept + rest;
+    buff->buff[buff->head] = 0;
+    return true;
+}
+
+void snow_ws_read(snow_connection_t *conn) {
+    buff_static_t *buff = &conn->readBuff;
+    uint32_t generation = conn->generation.load(std::memory_order_relaxed);
+
+    for (;;) {
+        size_t room = connBufferSize - 1 - buff->head;
+        size_t n = snow_buff_put_from_sock(buff, conn, (int) room);
+        if (!snow_ws_alive(conn, generation)) return;
+
+        if (!conn->wsOpen && !snow_ws_processUpgrade(conn, generation)) return;
+        if (!snow_ws_process(conn, generation)) return;
+        if (n < room) break; // wolfSSL may hold more than the socket signals, read until it runs dry
+    }
+}
+
+#endif
+
+///// PUBLIC
+
+// false if url does not fit a connection's requestUrl, the request then fails right away with URL_MALFORMATTED
+static bool snow_urlFits(snow_global_t *global, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                         void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback) {
+    if (SNOW_LIKELY(strlen(url) < connUrlSize)) return true;
+
+    snow_countError(snow_threadStats(global), URL_MALFORMATTED);
+    snow_deliver(callback, write_cb, err_cb, extra, URL_MALFORMATTED, nullptr, 0, 0);
+    return false;
+}
+
+// answers a GET from the response cache or attaches it to an identical one in flight, 0 if it needs a connection
+// *flightHash is set if it should lead a flight others can attach to
+static snow_handle_t snow_shortcut(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                                   void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback,
+                                   const char *extraHeaders, size_t extraHeaders_size, uint64_t *flightHash) {
+    *flightHash = 0;
+
+    uint64_t hash = 0;
+#ifdef SNOW_RESPONSE_CACHE
+    if (method == GET && strlen(url) < connUrlSize) {
+        hash = snow_flightHash(url, extraHeaders, extraHeaders_size);
+        if (snow_serveCached(global, hash, url, write_cb, extra, callback)) return HANDLE_CACHED;
+    }
+#endif
+
+    if (coalesceGets && method == GET && strlen(url) < connUrlSize) {
+        *flightHash = hash ? hash : snow_flightHash(url, extraHeaders, extraHeaders_size);
+        return snow_joinFlight(global, *flightHash, url, extraHeaders, extraHeaders_size, write_cb, err_cb, extra, callback);
+    }
+    return 0;
+}
+
+// snow_do & snow_doCallback, callback is used instead of write_cb / err_cb / extra if set
+static snow_handle_t snow_request(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                                  void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback,
+                                  const char *extraHeaders, size_t extraHeaders_size, int hedgeDelay) {
+
+    if (!snow_urlFits(global, url, write_cb, err_cb, extra, callback)) return 0;
+
+    uint64_t flightHash;
+    snow_handle_t handle = snow_shortcut(global, method, url, write_cb, err_cb, extra, callback, extraHeaders, extraHeaders_size, &flightHash);
+    if (handle) return handle;
+
+    handle = snow_start(global, method, url, write_cb, err_cb, extra, callback, extraHeaders, extraHeaders_size, hedgeDelay,
+                                      flightHash);
+    if (!handle) {
+        snow_countError(snow_threadStats(global), NO_FREE_CONN);
+        snow_deliver(callback, write_cb, err_cb, extra, NO_FREE_CONN, nullptr, 0, 0);
+    }
+    return handle;
+}
+
+snow_handle_t snow_do(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                      void (*err_cb)(int err, void *extra),
+                      void *extra, const char *extraHeaders, size_t extraHeaders_size, int hedgeDelay) {
+    return snow_request(global, method, url, write_cb, err_cb, extra, nullptr, extraHeaders, extraHeaders_size, hedgeDelay);
+}
+
+snow_handle_t snow_doCallback(snow_global_t *global, int method, const char *url, const snow_callback_t *callback,
+                              const char *extraHeaders, size_t extraHeaders_size, int hedgeDelay) {
+    return snow_request(global, method, url, nullptr, nullptr, nullptr, callback, extraHeaders, extraHeaders_size, hedgeDelay);
+}
+
+// snow_doBatch for up to batchChunkSize requests
+static size_t snow_startBatch(snow_global_t *global, const snow_batchRequest_t *requests, size_t n, snow_handle_t *handles) {
+    uint64_t flightHashes[batchChunkSize];
+    int loopOf[batchChunkSize];
+    int launch[multi_loop_max][batchChunkSize]; // claimed connections by loop
+    size_t launchN[multi_loop_max] = {};
 #ifdef SNOW_MULTI_LOOP
-    global->loop = global->loops[0];
+    int loopsN = multi_loop_n_runtime;
+    int ids[multi_loop_max][batchChunkSize];
+    size_t wanted[multi_loop_max] = {}, got[multi_loop_max] = {}, used[multi_loop_max] = {};
+#else
+    int loopsN = 1;
+#endif
+
+    for (size_t i = 0; i < n; i++) {
+        const snow_batchRequest_t &r = requests[i];
+        handles[i] = 0;
+        loopOf[i] = -2; // -2 - failed already
+        if (!snow_urlFits(global, r.url, r.write_cb, r.err_cb, r.extra, r.callback)) continue;
+
+        handles[i] = snow_shortcut(global, r.method, r.url, r.write_cb, r.err_cb, r.extra, r.callback, r.extraHeaders, r.extraHeaders_size,
+                                   &flightHashes[i]);
+        loopOf[i] = handles[i] ? -1 : 0; // -1 - answered without a connection
+#ifdef SNOW_MULTI_LOOP
+        if (handles[i]) continue;
+        loopOf[i] = snow_selectLoop(global, r.url);
+        global->loopLoad[loopOf[i]].fetch_add(1, std::memory_order_relaxed); // seen by the next selections
+        wanted[loopOf[i]]++;
+#endif
+    }
+
+#ifdef SNOW_MULTI_LOOP
+    for (int l = 0; l < loopsN; l++)
+        if (wanted[l]) got[l] = global->freeConnections[l].pop_bulk(ids[l], wanted[l]);
+#endif
+
+    uint64_t now = snow_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        if (loopOf[i] < 0) continue;
+        const snow_batchRequest_t &r = requests[i];
+        int l = loopOf[i], id = -1;
+
+#ifdef SNOW_MULTI_LOOP
+        if (used[l] < got[l]) {
+            id = ids[l][used[l]++];
+        } else { // the chosen loop ran out, the next loop with a free one takes it, as in snow_claimFree
+            global->loopLoad[l].fetch_sub(1, std::memory_order_relaxed);
+
+            int j = 1;
+            for (; j < loopsN && !global->freeConnections[(l + j) % loopsN].pop(id); j++);
+            if (id < 0) continue; // every loop is full, NO_FREE_CONN below
+
+            l = (l + j) % loopsN;
+            global->loopLoad[l].fetch_add(1, std::memory_order_relaxed);
+        }
+#else
+        if (global->freeConnections.empty()) continue;
+        id = global->freeConnections.front();
+        global->freeConnections.pop();
+#endif
+
+        snow_connection_t *conn = snow_claimConn(global, id, l, now, r.method, r.url, r.write_cb, r.err_cb, r.extra, r.extraHeaders,
+                                                 r.extraHeaders_size);
+        handles[i] = snow_prepare(conn, r.url, r.callback, r.hedgeDelay, flightHashes[i]);
+        launch[l][launchN[l]++] = id;
+    }
+
+    // handles are known, the connections must not be touched once launched
+    for (int l = 0; l < loopsN; l++) {
+        if (!launchN[l]) continue;
+#ifdef SNOW_MULTI_LOOP
+        if (l != snow_currentLoop) {
+            size_t pushed = global->loopInbox[l].push_bulk(launch[l], launchN[l]); // set up by its own loop thread
+            assert(pushed == launchN[l]); // holds every connection of the loop at most once
+            continue;
+        }
+#endif
+        snow_startConns(global, launch[l], launchN[l]);
+    }
+
+    size_t started = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (handles[i]) {
+            started++;
+            continue;
+        }
+        if (loopOf[i] == -2) continue;
+        snow_countError(snow_threadStats(global), NO_FREE_CONN);
+        snow_deliver(requests[i].callback, requests[i].write_cb, requests[i].err_cb, requests[i].extra, NO_FREE_CONN, nullptr, 0, 0);
+    }
+    return started;
+}
+
+size_t snow_doBatch(snow_global_t *global, const snow_batchRequest_t *requests, size_t n, snow_handle_t *handles) {
+    snow_handle_t chunkHandles[batchChunkSize];
+    size_t started = 0;
+
+    for (size_t begin = 0; begin < n; begin += batchChunkSize) {
+        size_t count = std::min(n - begin, (size_t) batchChunkSize);
+        started += snow_startBatch(global, requests + begin, count, handles ? handles + begin : chunkHandles);
+    }
+    return started;
+}
+
+bool snow_cancel(snow_global_t *global, snow_handle_t handle) {
+    unsigned id = handle & 0xffffffffU;
+    uint32_t generation = handle >> 32U;
+    if (!handle || id >= (unsigned) (concurrentConnections + coalesceWaitersMax)) return false;
+    if (id >= (unsigned) concurrentConnections) return snow_cancelWaiter(global, (int) (id - concurrentConnections), generation);
+
+    snow_connection_t *conn = &global->connections[id];
+    if (conn->generation.load(std::memory_order_acquire) != generation) return false;
+
+    // a hedged request whose connection failed lives on in its duplicate, unless the slot was claimed again meanwhile
+    snow_handle_t successor = conn->hedgeSuccessor.load(std::memory_order_acquire);
+    if (successor) return conn->generation.load(std::memory_order_acquire) == generation && snow_cancel(global, successor);
+
+    // the loop checks the generation again, a request that moved on in between is left alone
+    conn->cancelGeneration.store(generation, std::memory_order_release);
+    int loopId = __atomic_load_n(&conn->loopId, __ATOMIC_RELAXED);
+    global->loopCancel[loopId][id / 64].fetch_or(1ULL << (id % 64U), std::memory_order_release);
+    return true;
+}
+
+#ifdef SNOW_WEBSOCKET
+
+snow_handle_t snow_ws_open(snow_global_t *global, const char *url, void (*ws_cb)(char *data, size_t data_len, int opcode, void *extra),
+                           void (*err_cb)(int err, void *extra), void *extra, const char *extraHeaders, size_t extraHeaders_size) {
+
+    snow_connection_t *conn = snow_claimFree(global, __WEBSOCKET, url, nullptr, err_cb, extra, extraHeaders, extraHeaders_size);
+    if (!conn) {
+        snow_countError(snow_threadStats(global), NO_FREE_CONN);
+        if (err_cb) err_cb(NO_FREE_CONN, extra);
+        return 0;
+    }
+
+    conn->ws_cb = ws_cb;
+    snow_handle_t handle = snow_connHandle(conn);
+    snow_launch(conn);
+    return handle;
+}
+
+bool snow_ws_send(snow_global_t *global, snow_handle_t handle, const char *data, size_t data_len, int opcode) {
+    unsigned id = handle & 0xffffffffU;
+    uint32_t generation = handle >> 32U;
+    if (!handle || id >= (unsigned) concurrentConnections) return false;
+
+    snow_connection_t *conn = &global->connections[id];
+    if (conn->generation.load(std::memory_order_acquire) != generation || conn->method != __WEBSOCKET) return false;
+
+#ifdef SNOW_MULTI_LOOP
+    int loopId = __atomic_load_n(&conn->loopId, __ATOMIC_RELAXED);
+    if (loopId != snow_currentLoop) { // only the loop writes to its sockets, it sends the copy after its current iteration
+        if (data_len > wsOutboxMessageSize) return false;
+
+        static thread_local snow_ws_outgoing_t outgoing;
+        outgoing.handle = handle;
+        outgoing.opcode = opcode;
+        outgoing.len = data_len;
+        if (data_len) memcpy(outgoing.data, data, data_len);
+        return global->wsOutbox[loopId].push(outgoing);
+    }
+#endif
+
+    return snow_ws_write(conn, opcode, data, data_len);
+}
+
+bool snow_ws_close(snow_global_t *global, snow_handle_t handle, uint16_t code) {
+    char payload[2] = {(char) (code >> 8U), (char) code};
+    return snow_ws_send(global, handle, payload, sizeof(payload), WS_CLOSE);
+}
+
+#endif
+
+#ifdef SNOW_QUEUEING_ENABLED
+
+// snow_enqueue & snow_enqueueCallback, callback is used instead of write_cb / err_cb / extra if set
+static bool snow_enqueueRequest(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                                void (*err_cb)(int err, void *extra), void *extra, const snow_callback_t *callback,
+                                const char *extraHeaders, size_t extraHeaders_size, int priority, int deadline) {
+
+    if (!snow_urlFits(global, url, write_cb, err_cb, extra, callback)) return true; // before the fast path, claiming copies url
+
+    if (global->requestQueue->empty() &&
+        snow_start(global, method, url, write_cb, err_cb, extra, callback, extraHeaders, extraHeaders_size, 0, 0))
+        return true;
+
+    snow_bareRequest_t req;
+    size_t urlLen = strlen(url);
+
+    req.method = method;
+    memcpy(req.requestUrl, url, urlLen + 1);
+    req.deadline = deadline ? snow_monotonic_ms() + deadline : 0;
+    req.extra_cb = extra;
+    req.write_cb = write_cb;
+    req.err_cb = err_cb;
+    req.callback.invoke = nullptr;
+    if (callback) req.callback = *callback;
+    req.extraHeaders = extraHeaders;
+    req.extraHeaders_size = extraHeaders_size;
+
+    if (!global->requestQueue->push(req, priority)) {
+        snow_count(snow_threadStats(global), STAT_REJECTED);
+        return false;
+    }
+    snow_count(snow_threadStats(global), STAT_QUEUED);
+
+#ifndef SNOW_MULTI_LOOP // loops dispatch after every iteration, only they pop so the queue reserve stays bounded
+    snow_dispatchQueued(global); // a connection may have been freed meanwhile
+#endif
+    return true;
+}
+
+bool snow_enqueue(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+                  void (*err_cb)(int err, void *extra),
+                  void *extra, const char *extraHeaders, size_t extraHeaders_size, int priority, int deadline) {
+    return snow_enqueueRequest(global, method, url, write_cb, err_cb, extra, nullptr, extraHeaders, extraHeaders_size, priority, deadline);
+}
+
+bool snow_enqueueCallback(snow_global_t *global, int method, const char *url, const snow_callback_t *callback,
+                          const char *extraHeaders, size_t extraHeaders_size, int priority, int deadline) {
+    return snow_enqueueRequest(global, method, url, nullptr, nullptr, nullptr, callback, extraHeaders, extraHeaders_size, priority, deadline);
+}
+
+size_t snow_queueSize(snow_global_t *global) {
+    return global->requestQueue->size();
+}
+
+#endif
+
+void snow_stats(snow_global_t *global, snow_stats_t *out, int loop) {
+    memset(out, 0, sizeof(snow_stats_t));
+
+    for (int id = 0; id <= multi_loop_max; id++) {
+        if (loop >= 0 && id != loop) continue;
+        for (int i = 0; i < STAT_COUNT; i++) out->counters[i] += global->stats[id].counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < ERROR_COUNT; i++) out->errors[i] += global->stats[id].errors[i].load(std::memory_order_relaxed);
+    }
+
+    out->queueDepth = global->requestQueue->size();
+
+    int first = 0, last = concurrentConnections;
+#ifdef SNOW_MULTI_LOOP
+    if (loop >= 0) first = snow_loopFirstConn(loop), last = snow_loopFirstConn(loop + 1);
+#endif
+    for (int id = first; id < last; id++) // racy read, a gauge
+        out->connections[__atomic_load_n(&global->connections[id].connectionStatus, __ATOMIC_RELAXED)]++;
+}
+
+#ifdef SNOW_TRACE
+
+bool snow_traceSave(snow_global_t *global, int loop, const char *path) {
+    return snow_trace_save(&global->traceRings[loop], path);
+}
+
+#endif
+
+void snow_printStats(const snow_stats_t *stats, FILE *out) {
+    static const char *statNames[] = {
+            "requests_started", "requests_completed", "requests_queued", "requests_rejected", "tls_session_hits",
+            "tls_session_misses", "dns_cache_hits", "dns_cache_misses", "bytes_in", "bytes_out", "hedges", "hedge_wins",
+            "requests_coalesced", "cache_hits", "cache_revalidated", "h2_connections", "h2_streams", "ws_opened", "ws_messages",
+            "ktls_connections", "session_renewals_deferred", "session_renewals_dropped"
+    };
+    static const char *errorNames[] = {
+            "HOSTNAME_RESOLVE", "WOLFSSL_NEW", "CHUNKED_DATA_PARSING", "WOLFSSL_CONNECT", "HEADER_PARSING", "SOCK_CREATION",
+            "SOCK_CONNECTION", "SOCK_WRITE_ERR", "SOCK_READ_ERR", "SOCK_READ_CLOSED", "URL_MALFORMATTED", "BUFF_WRITE_SMALL",
+            "BUFF_READ_SMALL", "CONN_TIMEOUT", "NO_FREE_CONN", "DEADLINE_EXCEEDED", "CANCELLED", "HTTP2_ERROR", "WEBSOCKET_ERROR"
+    };
+    static const char *statusNames[] = {
+            "CONN_UNREADY", "CONN_IN_PROGRESS", "CONN_ACK", "CONN_TLS_HANDSHAKE", "CONN_READY", "CONN_WAITING", "CONN_RECEIVING", "CONN_DONE"
+    };
+
+    static_assert(sizeof(statNames) / sizeof(*statNames) == STAT_COUNT, "one name per stat_enum");
+    static_assert(sizeof(errorNames) / sizeof(*errorNames) == ERROR_COUNT, "one name per error_enum");
+    static_assert(sizeof(statusNames) / sizeof(*statusNames) == CONN_DONE + 1, "one name per conn_status_enum");
+
+    for (int i = 0; i < STAT_COUNT; i++)
+        fprintf(out, "snow_%s %lu\n", statNames[i], (unsigned long) stats->counters[i]);
+    for (int i = 0; i < ERROR_COUNT; i++)
+        fprintf(out, "snow_errors{error=\"%s\"} %lu\n", errorNames[i], (unsigned long) stats->errors[i]);
+    fprintf(out, "snow_queue_depth %lu\n", (unsigned long) stats->queueDepth);
+    for (int i = 0; i <= CONN_DONE; i++)
+        fprintf(out, "snow_connections{status=\"%s\"} %lu\n", statusNames[i], (unsigned long) stats->connections[i]);
+}
+
+#ifdef SNOW_TLS_SESSION_REUSE
+
+void snow_addWantedSession(snow_global_t *global, const std::string &url) {
+#ifdef SNOW_MULTI_LOOP
+    std::lock_guard<std::mutex> lock(global->wantedSessionsLock);
+#endif
+    global->wantedSessions.push_back(url);
+}
+
+#endif
+
+#ifdef SNOW_MULTI_LOOP
+
+// runs after every iteration of each loop
+static void snow_loop_cb(struct ev_loop *loop) {
+    snow_global_t *global = snow_currentGlobal;
+    int ids[batchChunkSize];
+    size_t n;
+
+    while ((n = global->loopInbox[snow_currentLoop].pop_bulk(ids, batchChunkSize)))
+        snow_startConns(global, ids, n); // one pass over the loop's watchers for all of them
+
+    snow_processCancels(global, snow_currentLoop);
+
+#ifdef SNOW_WEBSOCKET
+    static thread_local snow_ws_outgoing_t outgoing; // too large for the stack of every iteration
+    while (global->wsOutbox[snow_currentLoop].pop(outgoing))
+        snow_ws_send(global, outgoing.handle, outgoing.data, outgoing.len, outgoing.opcode);
 #endif
 
 #ifdef SNOW_QUEUEING_ENABLED
+    if (!global->requestQueue->empty()) snow_dispatchQueued(global); // hand slots freed in this iteration to waiters
+#endif
+}
+
+// applies global->placement[id] to the calling thread & first touches the loop's connections
+static void snow_placeLoop(snow_global_t *global, int id) {
+    snow_placement_t *placement = &global->placement[id];
+    snow_topology_t *topology = &global->topology[id];
+
+    if (CPU_COUNT(&placement->cpus) > 0) {
+        topology->pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &placement->cpus) == 0;
+        if (!topology->pinned) fprintf(stderr, "WARN: could not pin loop %d\n", id);
+    }
+
+    if (placement->fifoPriority > 0) {
+        struct sched_param param = {};
+        param.sched_priority = placement->fifoPriority;
+        topology->fifo = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+        if (!topology->fifo) fprintf(stderr, "WARN: could not set SCHED_FIFO on loop %d\n", id);
+    }
+
+    unsigned cpu = 0, node = 0;
+    getcpu(&cpu, &node);
+    topology->cpu = (int) cpu;
+    topology->node = (int) node;
+    global->loopCpu[id] = topology->pinned ? topology->cpu : -1;
+
+    topology->firstConn = snow_loopFirstConn(id);
+    topology->lastConn = snow_loopFirstConn(id + 1);
+
+    // snow_init faulted the arena in on its own thread, the loop's share (whole pages of its own) moves to this one's node
+    auto first = (uintptr_t) &global->connections[topology->firstConn];
+    size_t shareSize = snow_arenaShareSize(global, id);
+
+    if (shareSize > 0 && node < sizeof(unsigned long) * 8) {
+        unsigned long nodeMask = 1UL << node;
+        syscall(SYS_mbind, first, shareSize, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, MPOL_MF_MOVE);
+    }
+
+    int slabNode = -1;
+    if (syscall(SYS_get_mempolicy, &slabNode, nullptr, 0, global->connections[topology->firstConn].readBuff.buff, MPOL_F_NODE | MPOL_F_ADDR) == 0)
+        topology->slabNode = slabNode;
+}
+
+void snow_printTopology(snow_global_t *global, FILE *out) {
+    for (int id = 0; id < multi_loop_n_runtime; id++) {
+        snow_topology_t *t = &global->topology[id];
+        fprintf(out, "INFO: loop %d: cpu %d%s, node %d, connections [%d, %d) on node %d, %s\n", id, t->cpu, t->pinned ? " (pinned)" : "",
+                t->node, t->firstConn, t->lastConn, t->slabNode, t->fifo ? "SCHED_FIFO" : "SCHED_OTHER");
+    }
+    fprintf(out, "INFO: %zu KiB of connection state, %d loops\n", sizeof(snow_connection_t) * concurrentConnections / 1024, multi_loop_n_runtime);
+}
+
+void snow_spawnLoops(snow_global_t *global) {
+    for (int id = 0; id < multi_loop_n_runtime; id++)
+        global->threads[id] = std::thread([](snow_global_t *global, int id) {
+            snow_currentGlobal = global;
+            snow_currentLoop = id;
+
+            snow_placeLoop(global, id);
+#ifdef SNOW_TRACE
+            snow_trace_attach(&global->traceRings[id], id);
+#endif
+
+            // sessions are kept per connection, the loop's context does not need wolfSSL's shared session cache
+            if (tlsCtxPerLoop)
+                global->loopCtx[id] = snow_newTlsCtx(SSL_SESS_CACHE_NO_AUTO_CLEAR | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+            // timeouts of the connections owned by this loop
+            global->loopTimers[id].data = global;
+            ev_timer_init((struct ev_timer *) &global->loopTimers[id], snow_timer_cb, 0, mainTimerInterval);
+            ev_timer_start(global->loops[id], (struct ev_timer *) &global->loopTimers[id]);
+
+            global->loopsRunning.fetch_add(1);
+            ev_run(global->loops[id], snow_loop_cb);
+        }, global, id);
+
+    while (global->loopsRunning.load() < multi_loop_n_runtime) std::this_thread::yield();
+
+    if (loopTopologyReport) snow_printTopology(global, stdout);
+}
+
+void snow_joinLoops(snow_global_t *global) {
+    for (int id = 0; id < multi_loop_n_runtime; id++)
+        global->threads[id].join();
+}
+
+#endif
+
+/*
+ * Maps & faults in the connections, then the request queue. Each loop's share starts on a page boundary, no page is
+ * shared by two loops, so snow_placeLoop can move all of a loop's connections to its node (up to a page per loop is padding).
+ */
+static void snow_mapArena(snow_global_t *global) {
+    snow_arena_t *arena = &global->arena;
+#ifdef SNOW_MULTI_LOOP
+    int shares = multi_loop_n_runtime;
+#else
+    int shares = 1;
+#endif
+    auto layout = [global, arena, shares]() {
+        arena->size = 0;
+        for (int share = 0; share <= shares; share++) arena->size += snow_arenaShareSize(global, share);
+    };
+    void *base = MAP_FAILED;
+
+    if (arenaHugePages) {
+        arena->pageSize = 2U << 20U;
+        layout();
+        base = mmap(nullptr, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        arena->hugetlb = base != MAP_FAILED;
+    }
+
+    if (base == MAP_FAILED) { // no reserved huge pages, transparent ones are only used for aligned 2MiB ranges anyway
+        arena->pageSize = sysconf(_SC_PAGESIZE);
+        layout();
+        base = mmap(nullptr, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "ERR: could not map %zu KiB for the connections.\n", arena->size / 1024);
+            assert(0);
+        }
+
+        if (arenaHugePages) madvise(base, arena->size, MADV_HUGEPAGE);
+        memset(base, 0, arena->size); // every page faulted in now instead of on the first request
+    }
+
+    arena->base = base;
+    arena->locked = arenaLock && mlock(base, arena->size) == 0;
+    if (arenaLock && !arena->locked) fprintf(stderr, "WARN: could not lock the arena, %s\n", strerror(errno));
+
+    auto *at = (char *) base;
+    for (int share = 0, id = 0; share < shares; share++) {
+        auto *conns = (snow_connection_t *) at;
+#ifdef SNOW_MULTI_LOOP
+        int last = snow_loopFirstConn(share + 1);
+#else
+        int last = concurrentConnections;
+#endif
+        for (; id < last; id++) global->connections.at[id] = new(conns++) snow_connection_t;
+        at += snow_arenaShareSize(global, share);
+    }
+    global->requestQueue = new(at) std::remove_pointer_t<decltype(global->requestQueue)>;
+
+    if (loopTopologyReport) // benches keep stdout to their result line
+        printf("INFO: %zu KiB arena on %s pages%s, %zu KiB in snow_global_t\n", arena->size / 1024,
+               arena->hugetlb ? "2MiB" : arenaHugePages ? "transparent huge" : "4KiB", arena->locked ? ", locked" : "", sizeof(snow_global_t) / 1024);
+}
+
+void snow_init(snow_global_t *global) {
+    wolfSSL_Init();
+
+    global->wolfCtx = snow_newTlsCtx(SSL_SESS_CACHE_NO_AUTO_CLEAR);
+
+    snow_mapArena(global);
+
+    for (int id = 0; id < concurrentConnections; id++)
+        global->connections[id].connectionStatus = CONN_DONE; // free
+
+    for (int i = 0; i < coalesceWaitersMax; i++)
+        global->freeWaiters.push(i);
+
+#ifdef SNOW_MULTI_LOOP
+    for (int id = 0; id < multi_loop_n_runtime; id++) {
+        global->loopCpu[id] = -1;
+        for (int i = snow_loopFirstConn(id); i < snow_loopFirstConn(id + 1) - h2Transports; i++)
+            global->freeConnections[id].push(i);
+    }
+#else
+    for (int i = 0; i < concurrentConnections - h2Transports; i++)
+        global->freeConnections.push(i);
+#endif
+
+#ifdef SNOW_MULTI_LOOP
+    global->loop = global->loops[0];
+#endif
+
+#if defined(SNOW_TRACE) && !defined(SNOW_MULTI_LOOP) // the thread calling snow_init runs the loop
+    snow_trace_attach(&global->traceRings[0], 0);
+#endif
+
+#if defined(SNOW_QUEUEING_ENABLED) && !defined(SNOW_MULTI_LOOP) // multi loop runs one timer per loop, see snow_spawnLoops
     global->mainTimer.data = global;
     ev_timer_init((struct ev_timer *) &global->mainTimer, snow_timer_cb, 0, mainTimerInterval);
     ev_timer_start(global->loop, (struct ev_timer *) &global->mainTimer);
 #endif
 
+#ifdef SNOW_SNAPSHOT
+    int64_t restoredSessions = 0; // saved at, realtime ms
+    if (snapshotPath) {
+        snow_loadSnapshot(global, snapshotPath, &restoredSessions); // a missing or stale file only means a cold start
+
+        global->snapshotTimer.data = global;
+        ev_timer_init((struct ev_timer *) &global->snapshotTimer, snow_timer_snapshot_cb, snapshotInterval, snapshotInterval);
+        ev_timer_start(global->loop, (struct ev_timer *) &global->snapshotTimer);
+    }
+#endif
+
 #ifdef SNOW_TLS_SESSION_REUSE
+    double renewAfter = 0; // right away, unless a snapshot brought sessions back: once the oldest of them is due
+#ifdef SNOW_SNAPSHOT
+    if (restoredSessions) renewAfter = std::max(0.0, sessionRenewInterval - (double) (snow_realtime_ms() - restoredSessions) / 1000);
+#endif
     global->sessionRenewTimer.data = global;
-    ev_timer_init((struct ev_timer *) &global->sessionRenewTimer, snow_timer_renew_cb, 0, sessionRenewInterval); // reset the sessions hourly
+    ev_timer_init((struct ev_timer *) &global->sessionRenewTimer, snow_timer_renew_cb, renewAfter, sessionRenewInterval); // reset the sessions hourly
     ev_timer_start(global->loop, (struct ev_timer *) &global->sessionRenewTimer);
+
+    global->renewRetryTimer.data = global; // started while renewals wait for room in the queue
+    ev_timer_init((struct ev_timer *) &global->renewRetryTimer, snow_timer_renewRetry_cb, mainTimerInterval, mainTimerInterval);
 #endif
 }
 
 void snow_destroy(snow_global_t *global) {
+#ifdef SNOW_SNAPSHOT
+    if (global->snapshotWriter.joinable()) global->snapshotWriter.join();
+    if (snapshotPath && !snow_saveSnapshot(global, snapshotPath)) fprintf(stderr, "WARN: could not write snapshot %s\n", snapshotPath);
+#endif
+
+#ifdef SNOW_MULTI_LOOP
+    for (WOLFSSL_CTX *&ctx : global->loopCtx) {
+        if (ctx != nullptr) wolfSSL_CTX_free(ctx);
+        ctx = nullptr;
+    }
+#endif
     wolfSSL_CTX_free(global->wolfCtx);
     wolfSSL_Cleanup();
-}
\ No newline at end of file
+
+    for (snow_connection_t *&conn : global->connections.at) {
+        conn->~snow_connection_t();
+        conn = nullptr;
+    }
+    global->requestQueue->~priority_queue();
+    munmap(global->arena.base, global->arena.size);
+    global->requestQueue = nullptr;
+}
+
+SNOW_NAMESPACE_END
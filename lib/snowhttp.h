@@ -29,7 +29,16 @@ SOFTWARE.
 #include <stack>
 #include <atomic>
 #include <thread>
+#include <sched.h>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include "atomic.h"
+#include "histogram.h"
+#include "trace.h"
+#include "cache.h"
+#include "http2.h"
+#include "websocket.h"
 
 #include "wolfssl/options.h"
 #include "wolfssl/wolfcrypt/settings.h"
@@ -37,19 +46,89 @@ SOFTWARE.
 
 #include "events.h"
 
-constexpr int concurrentConnections = 256; // maximum concurrent connections
-constexpr int connUrlSize = 512; // maximum request url size
-constexpr int connBufferSize = 1 << 15U; // read & write buffer sizes
-constexpr int connSockPriority = 6; // socket priority
-constexpr int connSockTimeout = 2000; // socket timeout in ms
+#ifdef SNOW_NAMESPACE
+#define SNOW_NAMESPACE_BEGIN namespace SNOW_NAMESPACE {
+#define SNOW_NAMESPACE_END }
+#else
+#define SNOW_NAMESPACE_BEGIN
+#define SNOW_NAMESPACE_END
+#endif
+
+SNOW_NAMESPACE_BEGIN
+
+/*
+ * Sizes & intervals. A build with -DSNOW_CONFIG='"file.h"' takes them from the snow_config struct declared there, usually
+ * deriving from snow_default_config & overriding a few, the file can also #define / #undef the features further down.
+ * With -DSNOW_NAMESPACE=name the whole library lives in that namespace, differently configured builds then link into one binary.
+ * Features are not members: each build's defines decide which state its connections & snow_global_t carry.
+ */
+struct snow_default_config {
+    static constexpr int concurrentConnections = 256; // maximum concurrent connections
+    static constexpr int connUrlSize = 512; // maximum request url size
+    static constexpr int connBufferSize = 1 << 15U; // read & write buffer sizes
+    static constexpr int connSockPriority = 6; // socket priority
+    static constexpr int connSockTimeout = 2000; // socket timeout in ms
+
+    static constexpr int requestQueueSize = 1024; // pending request queue capacity, per priority class
+
+    static constexpr int addrCacheSize = 1024; // cached host:port addresses, power of two
+    static constexpr int addrCacheKeySize = 256; // longer host:port keys are resolved every time
+    static constexpr int addrCacheTtl = 300000; // 5min - cached addresses are resolved again after this, in ms
+
+    static constexpr int trackedHostsMax = 4; // hosts with their own latency histograms, see snow_trackHost
+
+    static constexpr int coalesceIndexSize = 512; // in-flight GETs others can attach to, power of two, see coalesceGets
+    static constexpr int coalesceWaitersMax = 1024; // GETs attached to in-flight ones, further ones make their own request
+
+    static constexpr size_t callbackInlineSize = 48; // captures of a callable given to snow_do / snow_enqueue, checked at compile time
+
+    static constexpr int batchChunkSize = 64; // snow_doBatch claims & hands out connections this many requests at a time, bounds its stack use
+
+    static constexpr int hedgeDefaultDelay = 10; // ms, HEDGE_P95 delay until the host has hedgeMinSamples responses on the loop
+    static constexpr int hedgeMinSamples = 100;
+    static constexpr int hedgeRefreshInterval = 100; // ms, HEDGE_P95 delays are recomputed from the loop's histograms this often
 
-constexpr double mainTimerInterval = 0.001; // 1ms - queue checking - timeot checking
-constexpr double sessionRenewInterval = 3600; // 1hr - cached session renewal timer
+    static constexpr int cacheSets = 64; // SNOW_RESPONSE_CACHE, power of two
+    static constexpr int cacheWays = 4; // cached responses per set, CLOCK eviction within a set
+    static constexpr int cacheBodySize = 1 << 14U; // larger responses are not cached
+
+    static constexpr int h2SessionsMax = 4; // SNOW_HTTP2, hosts with an HTTP/2 connection per loop, each keeps a connection of the loop's share
+    static constexpr int h2StreamsMax = 100; // concurrent streams per connection, fewer if the server says so
+    static constexpr int h2RetryInterval = 300000; // 5min - a host that did not negotiate h2 is only asked again after this, in ms
+
+    static constexpr int tlsReadAheadSize = 1 << 16U; // SNOW_TLS_READ_AHEAD, per loop, ciphertext taken from a socket with one recv
+
+    static constexpr int wsOutboxSize = 64; // SNOW_WEBSOCKET, per loop, messages sent from other threads waiting for the loop
+    static constexpr int wsOutboxMessageSize = 1024; // larger messages can only be sent from the connection's loop thread
+
+    static constexpr double mainTimerInterval = 0.001; // 1ms - queue checking - timeot checking
+    static constexpr double sessionRenewInterval = 3600; // 1hr - cached session renewal timer
+    static constexpr double snapshotInterval = 60; // SNOW_SNAPSHOT, snapshotPath is rewritten this often, in s
+    static constexpr int snapshotSessionsMax = 64; // SNOW_SNAPSHOT, host:port sessions kept for the snapshot, power of two
+    static constexpr int snapshotSessionSize = 2048; // SNOW_SNAPSHOT, larger serialized sessions are not kept
+
+    static constexpr int multi_loop_max = 16; // needed for static allocation, needs to be > multi_loop_n_runtime
+};
 
-constexpr int multi_loop_max = 16; // needed for static allocation, needs to be > multi_loop_n_runtime
 inline int multi_loop_n_runtime = 8; // actual thead number - must be < multi_loop_max
 
+enum loop_policy_enum {
+    LOOP_ROUND_ROBIN, // cycle through loops
+    LOOP_LEAST_OUTSTANDING, // loop with the fewest requests in flight
+    LOOP_POWER_OF_TWO, // less loaded of two random loops
+    LOOP_HOST_AFFINITY // same host:port always on the same loop
+};
+inline int loopPolicy = LOOP_ROUND_ROBIN; // how snow_do assigns requests to loops
+inline int loopStealThreshold = 0; // LOOP_HOST_AFFINITY: use the least loaded loop instead if the affine one has this many more in flight, 0 - never
+inline bool loopTopologyReport = true; // snow_spawnLoops prints where each loop ended up, snow_init the arena footprint & what a snapshot restored
+inline bool tlsCtxPerLoop = false; // every loop creates its own WOLFSSL_CTX, loops share nothing during handshakes
+inline bool arenaHugePages = true; // connections & the request queue on MAP_HUGETLB pages if any are reserved, transparent huge pages otherwise
+inline bool arenaLock = false; // mlock the arena, needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK
+inline bool coalesceGets = false; // a snow_do GET identical to one in flight (url & extraHeaders) waits for its response instead
+inline bool ktlsReceive = false; // SNOW_KTLS, the kernel also decrypts (TLS_RX), otherwise only encryption is offloaded
+
 inline const char *sslCertPath = "/etc/ssl/certs/ca-certificates.crt";
+inline const char *snapshotPath = nullptr; // SNOW_SNAPSHOT, sessions & addresses loaded by snow_init, nullptr - none
 
 #define SNOW_DISABLE_NAGLE
 #define SNOW_QUEUEING_ENABLED
@@ -57,6 +136,66 @@ inline const char *sslCertPath = "/etc/ssl/certs/ca-certificates.crt";
 #define SNOW_NO_POST_BODY
 #define SNOW_MULTI_LOOP
 #define SNOW_NO_CERT_VERIFY
+// #define SNOW_LATENCY_HISTOGRAMS // per loop phase histograms (snow_latencySnapshot, HEDGE_P95), about 5MB of snow_global_t & a record per request
+// #define SNOW_RESPONSE_CACHE
+// #define SNOW_HTTP2 // needs wolfSSL built with ALPN (--enable-alpn)
+// #define SNOW_WEBSOCKET // snow_ws_open & friends
+// #define SNOW_TLS_READ_AHEAD // after the handshake wolfSSL reads through a per loop buffer filled with one recv per readiness event
+// #define SNOW_SNAPSHOT // sessions & addresses survive restarts through snapshotPath, needs wolfSSL with --enable-opensslextra
+// #define SNOW_KTLS // experimental, TLS 1.2 AES-GCM records go to the kernel after the handshake, needs wolfSSL with --enable-atomicuser
+
+#ifdef SNOW_CONFIG
+#include SNOW_CONFIG
+#else
+using snow_config = snow_default_config;
+#endif
+
+constexpr int concurrentConnections = snow_config::concurrentConnections;
+constexpr int connUrlSize = snow_config::connUrlSize;
+constexpr int connBufferSize = snow_config::connBufferSize;
+constexpr int connSockPriority = snow_config::connSockPriority;
+constexpr int connSockTimeout = snow_config::connSockTimeout;
+
+constexpr int requestQueueSize = snow_config::requestQueueSize;
+
+constexpr int addrCacheSize = snow_config::addrCacheSize;
+constexpr int addrCacheKeySize = snow_config::addrCacheKeySize;
+constexpr int addrCacheTtl = snow_config::addrCacheTtl;
+
+constexpr int trackedHostsMax = snow_config::trackedHostsMax;
+
+constexpr int coalesceIndexSize = snow_config::coalesceIndexSize;
+constexpr int coalesceWaitersMax = snow_config::coalesceWaitersMax;
+
+constexpr size_t callbackInlineSize = snow_config::callbackInlineSize;
+
+constexpr int batchChunkSize = snow_config::batchChunkSize;
+
+constexpr int hedgeDefaultDelay = snow_config::hedgeDefaultDelay;
+constexpr int hedgeMinSamples = snow_config::hedgeMinSamples;
+constexpr int hedgeRefreshInterval = snow_config::hedgeRefreshInterval;
+
+constexpr int cacheSets = snow_config::cacheSets;
+constexpr int cacheWays = snow_config::cacheWays;
+constexpr int cacheBodySize = snow_config::cacheBodySize;
+
+constexpr int h2SessionsMax = snow_config::h2SessionsMax;
+constexpr int h2StreamsMax = snow_config::h2StreamsMax;
+constexpr int h2StreamWindow = connBufferSize - 4096; // receive window of a stream, its body has to fit its readBuff after the headers
+constexpr int h2RetryInterval = snow_config::h2RetryInterval;
+
+constexpr int tlsReadAheadSize = snow_config::tlsReadAheadSize;
+
+constexpr int wsOutboxSize = snow_config::wsOutboxSize;
+constexpr int wsOutboxMessageSize = snow_config::wsOutboxMessageSize;
+
+constexpr double mainTimerInterval = snow_config::mainTimerInterval;
+constexpr double sessionRenewInterval = snow_config::sessionRenewInterval;
+constexpr double snapshotInterval = snow_config::snapshotInterval;
+constexpr int snapshotSessionsMax = snow_config::snapshotSessionsMax;
+constexpr int snapshotSessionSize = snow_config::snapshotSessionSize;
+
+constexpr int multi_loop_max = snow_config::multi_loop_max;
 
 enum method_enum {
     GET, POST, DELETE
@@ -65,10 +204,95 @@ const char method_strings[3][10] = {"GET", "POST", "DELETE"};
 
 enum error_enum {
     HOSTNAME_RESOLVE, WOLFSSL_NEW, CHUNKED_DATA_PARSING, WOLFSSL_CONNECT, HEADER_PARSING, SOCK_CREATION, SOCK_CONNECTION,
-    SOCK_WRITE_ERR, SOCK_READ_ERR, SOCK_READ_CLOSED, URL_MALFORMATTED, BUFF_WRITE_SMALL, BUFF_READ_SMALL, CONN_TIMEOUT, NO_FREE_CONN
+    SOCK_WRITE_ERR, SOCK_READ_ERR, SOCK_READ_CLOSED, URL_MALFORMATTED, BUFF_WRITE_SMALL, BUFF_READ_SMALL, CONN_TIMEOUT, NO_FREE_CONN,
+    DEADLINE_EXCEEDED, CANCELLED, HTTP2_ERROR, WEBSOCKET_ERROR, ERROR_COUNT
+};
+
+// per loop counters, see snow_stats
+enum stat_enum {
+    STAT_STARTED, // requests picked up by a loop
+    STAT_COMPLETED, // responses delivered to write_cb
+    STAT_QUEUED, // requests put in the pending queue
+    STAT_REJECTED, // snow_enqueue returned false
+    STAT_SESSION_HITS, // tls handshakes that resumed a session
+    STAT_SESSION_MISSES, // full tls handshakes
+    STAT_DNS_HITS, // addresses found in the cache
+    STAT_DNS_MISSES, // getaddrinfo calls
+    STAT_BYTES_IN, // received, after tls
+    STAT_BYTES_OUT, // sent, before tls
+    STAT_HEDGES, // duplicate requests sent, see snow_do hedgeDelay
+    STAT_HEDGE_WINS, // responses delivered by the duplicate
+    STAT_COALESCED, // GETs attached to an identical one in flight, see coalesceGets
+    STAT_CACHE_HITS, // GETs answered from the response cache without a request
+    STAT_CACHE_REVALIDATED, // 304s, the cached body was delivered
+    STAT_H2_CONNECTIONS, // HTTP/2 connections opened, see SNOW_HTTP2
+    STAT_H2_STREAMS, // requests sent as streams of one
+    STAT_WS_OPENED, // WebSocket upgrades completed, see SNOW_WEBSOCKET
+    STAT_WS_MESSAGES, // WebSocket messages delivered to ws_cb
+    STAT_KTLS, // connections whose records went to the kernel after the handshake, see SNOW_KTLS
+    STAT_RENEWALS_DEFERRED, // session renewals that did not fit the queue's low priority class, retried every mainTimerInterval
+    STAT_RENEWALS_DROPPED, // deferred renewals still pending when the next sessionRenewInterval began
+    STAT_COUNT
 };
 
+// request phases, each one ends at the status transition named after it
+enum phase_enum {
+    PHASE_DISPATCH, // snow_do / dequeue -> picked up by its loop
+    PHASE_DNS, // address lookup & socket creation
+    PHASE_CONNECT, // tcp handshake
+    PHASE_TLS, // tls handshake, ~0 for http
+    PHASE_SEND, // request written
+    PHASE_TTFB, // first response bytes
+    PHASE_BODY, // rest of the response
+    PHASE_TOTAL, // snow_do -> response
+    PHASE_COUNT
+};
+
+enum priority_enum {
+    PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_LOW
+};
+constexpr int requestPriorities = 3;
+
+constexpr int HEDGE_P95 = -1; // snow_do hedgeDelay, the host's observed p95 on the loop, hedgeDefaultDelay without SNOW_LATENCY_HISTOGRAMS
+
 struct snow_global_t;
+struct snow_stats_t;
+
+// request started by snow_do: generation << 32 | connection id, or concurrentConnections + waiter index for a GET
+// attached to an identical one in flight (see coalesceGets), 0 - not started
+typedef uint64_t snow_handle_t;
+constexpr snow_handle_t HANDLE_CACHED = UINT64_MAX; // answered from the response cache, write_cb was already called
+
+// what a callable given to snow_do / snow_enqueue gets, for a response & an error alike
+struct snow_response_t {
+    int err; // -1 - success, otherwise an error_enum
+    int statusCode; // 0 on errors, 304 - revalidated, data is the cached body
+    char *data; // body, only valid during the call
+    size_t len;
+};
+
+// a callable stored inline with the request, copied bytewise with it & never destroyed
+struct snow_callback_t {
+    void (*invoke)(void *storage, const snow_response_t *response); // nullptr - the request uses write_cb / err_cb
+    alignas(std::max_align_t) char storage[callbackInlineSize];
+
+    template<class callable_t>
+    static snow_callback_t from(callable_t &&callable) {
+        using stored_t = std::decay_t<callable_t>;
+        static_assert(sizeof(stored_t) <= callbackInlineSize, "captures do not fit callbackInlineSize, capture a pointer to them instead");
+        static_assert(alignof(stored_t) <= alignof(std::max_align_t), "over-aligned captures");
+        static_assert(std::is_trivially_copyable_v<stored_t> && std::is_trivially_destructible_v<stored_t>,
+                      "captures are copied bytewise & never destroyed, capture pointers & plain values only");
+
+        snow_callback_t callback;
+        callback.invoke = [](void *storage, const snow_response_t *response) { (*(stored_t *) storage)(*response); };
+        new(callback.storage) stored_t(std::forward<callable_t>(callable));
+        return callback;
+    }
+};
+
+template<class callable_t>
+using snow_if_callable_t = std::enable_if_t<std::is_invocable_v<std::decay_t<callable_t> &, const snow_response_t &>, int>;
 
 // initialises the lib
 void snow_init(snow_global_t *global);
@@ -86,29 +310,149 @@ void snow_destroy(snow_global_t *global);
  * extra             : extra data for above functions
  * extraHeaders
  * extraHeaders_size
+ * hedgeDelay        : GET only, ms - if no response started arriving by then, a duplicate goes out on another connection
+ *                     of the same loop, the first response wins and the other connection is closed without callbacks.
+ *                     HEDGE_P95 - the host's observed p95 (snow_trackHost hosts, all hosts otherwise), 0 - off,
+ *                     needs SNOW_LATENCY_HISTOGRAMS, hedgeDefaultDelay without
+ *
+ * Returns a handle for snow_cancel, 0 if there was no free connection (err_cb got NO_FREE_CONN).
+ *
+ * With coalesceGets, a GET identical to one in flight makes no request of its own: its callbacks get the response
+ * (the same buffer, do not modify it) or the error of the one in flight, on that one's loop. It returns a handle of its
+ * own, cancelling it only drops its callbacks, the request in flight is aborted once none of the GETs waits for it.
  *
+ * With SNOW_RESPONSE_CACHE, a GET with a fresh cached response makes no request either: write_cb gets the cached
+ * body right away, on the calling thread (valid until its next snow_do), and it returns HANDLE_CACHED.
+ * Stale ones go out with the cached validators, on a 304 write_cb gets the cached body.
  */
-void snow_do(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+snow_handle_t snow_do(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
              void (*err_cb)(int err, void *extra),
-             void *extra = nullptr, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0);
+             void *extra = nullptr, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0, int hedgeDelay = 0);
+
+/*
+ * Aborts a request started by snow_do, safe from any thread. The owning loop closes the connection after its current
+ * iteration (its hedge duplicate too, or only the duplicate once the first connection failed over to it), frees the slot
+ * for queued requests & calls err_cb with CANCELLED.
+ * A request that completes or fails before that still gets its usual callback, exactly one callback is ever made.
+ * A GET attached to an identical one in flight gets CANCELLED right away, on the calling thread.
+ * Returns false if the handle is stale, the connection already went on to another request.
+ */
+bool snow_cancel(snow_global_t *global, snow_handle_t handle);
+
+// snow_do with a callback, see the template below
+snow_handle_t snow_doCallback(snow_global_t *global, int method, const char *url, const snow_callback_t *callback,
+                              const char *extraHeaders, size_t extraHeaders_size, int hedgeDelay);
+
+/*
+ * snow_do with one callable instead of write_cb / err_cb / extra, e.g. a lambda capturing its context:
+ *
+ *     snow_do(&global, GET, url, [order, &book](const snow_response_t &r) { if (r.err < 0) book.update(order, r.data, r.len); });
+ *
+ * It gets a snow_response_t for the response & errors alike, exactly once, on the same threads write_cb / err_cb would.
+ * The captures are stored inline with the request, no allocation: they have to fit callbackInlineSize and be trivially
+ * copyable (pointers, references & plain values), both checked at compile time.
+ */
+template<class callable_t, snow_if_callable_t<callable_t> = 0>
+snow_handle_t snow_do(snow_global_t *global, int method, const char *url, callable_t &&callable, const char *extraHeaders = nullptr,
+                      size_t extraHeaders_size = 0, int hedgeDelay = 0) {
+    snow_callback_t callback = snow_callback_t::from(std::forward<callable_t>(callable));
+    return snow_doCallback(global, method, url, &callback, extraHeaders, extraHeaders_size, hedgeDelay);
+}
+
+// one request of snow_doBatch, the arguments of snow_do
+struct snow_batchRequest_t {
+    int method;
+    const char *url;
+    void (*write_cb)(char *data, size_t data_len, void *extra) = nullptr;
+    void (*err_cb)(int err, void *extra) = nullptr;
+    void *extra = nullptr;
+    const char *extraHeaders = nullptr;
+    size_t extraHeaders_size = 0;
+    int hedgeDelay = 0;
+    const snow_callback_t *callback = nullptr; // used instead of write_cb / err_cb / extra if set, copied
+};
+
+/*
+ * snow_do for n requests at once, same callbacks, coalescing & cache. Costs are per batch where they can be:
+ * one timestamp, one locked pop from each loop's free connections & one locked push to each loop's inbox,
+ * the loop then registers all the new sockets in one pass over its watchers (one epoll_ctl per socket).
+ * Requests are taken batchChunkSize at a time.
+ *
+ * handles           : optional, n handles as snow_do would return them, 0 - no free connection
+ *
+ * Returns how many were started (or answered from the cache / attached to one in flight), the others got NO_FREE_CONN.
+ */
+size_t snow_doBatch(snow_global_t *global, const snow_batchRequest_t *requests, size_t n, snow_handle_t *handles = nullptr);
+
+#ifdef SNOW_WEBSOCKET
+
+/*
+ * Opens a WebSocket on a connection of one of the loops, with the same TLS context, buffers & timeouts as requests.
+ *
+ * url               : ws:// or wss://, copied
+ * ws_cb             : on the connection's loop thread - WS_OPEN once the upgrade is done (data is nullptr), then every
+ *                     WS_TEXT / WS_BINARY message (fragments joined, terminated), WS_PONG, and WS_CLOSE (code & reason)
+ *                     right before the connection is closed. data is only valid during the call.
+ * err_cb            : upgrade refused (WEBSOCKET_ERROR), protocol errors, lost connections, called once, the socket is closed
+ * extraHeaders      : sent with the upgrade request, must outlive it
+ *
+ * Messages have to fit connBufferSize. The connection stays open until either side closes it, snow_cancel drops it.
+ * Returns a handle for snow_ws_send / snow_ws_close / snow_cancel, 0 if there was no free connection (err_cb got NO_FREE_CONN).
+ */
+snow_handle_t snow_ws_open(snow_global_t *global, const char *url, void (*ws_cb)(char *data, size_t data_len, int opcode, void *extra),
+                           void (*err_cb)(int err, void *extra), void *extra = nullptr, const char *extraHeaders = nullptr,
+                           size_t extraHeaders_size = 0);
+
+/*
+ * Sends a message (WS_TEXT / WS_BINARY / WS_PING), masked. From the connection's loop thread (e.g. in ws_cb) it is written
+ * right away, false if the socket is not open yet, closing, or its writeBuff has no room left. From other threads it is
+ * copied & written after the loop's current iteration, up to wsOutboxMessageSize, false only if the handle is stale or
+ * the loop's outbox is full, a message the loop cannot write then is dropped.
+ */
+bool snow_ws_send(snow_global_t *global, snow_handle_t handle, const char *data, size_t data_len, int opcode = WS_TEXT);
+
+// starts the closing handshake, ws_cb gets WS_CLOSE with the server's reply, same threading as snow_ws_send
+bool snow_ws_close(snow_global_t *global, snow_handle_t handle, uint16_t code = 1000);
+
+#endif
 
 #ifdef SNOW_QUEUEING_ENABLED
 
 /*
- * Tries to send request, if there is no free connection, puts it in the pending request queue
+ * Tries to send request, if there is no free connection, puts it in the pending request queue.
+ * Queued requests are served by priority as soon as a connection is freed.
+ * Returns false if the queue is full for that priority (backpressure), err_cb is not called in that case.
  *
  * method            : GET / POST / DELETE
- * ur
+ * ur                : copied, does not need to outlive the call
  * write_cb          : called on successful completion
- * err_cb            : called on error / timeout
+ * err_cb            : called on error / timeout / DEADLINE_EXCEEDED
  * extra             : extra data for above functions
- * extraHeaders
+ * extraHeaders      : not copied, must outlive the request
  * extraHeaders_size
+ * priority          : PRIORITY_HIGH / PRIORITY_NORMAL / PRIORITY_LOW
+ * deadline          : ms, dropped with DEADLINE_EXCEEDED if not sent by then, 0 - no deadline
  *
  */
-void snow_enqueue(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
+bool snow_enqueue(snow_global_t *global, int method, const char *url, void (*write_cb)(char *data, size_t data_len, void *extra),
                   void (*err_cb)(int err, void *extra),
-                  void *extra = nullptr, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0);
+                  void *extra = nullptr, const char *extraHeaders = nullptr, size_t extraHeaders_size = 0,
+                  int priority = PRIORITY_NORMAL, int deadline = 0);
+
+// snow_enqueue with a callback, see the template below
+bool snow_enqueueCallback(snow_global_t *global, int method, const char *url, const snow_callback_t *callback,
+                          const char *extraHeaders, size_t extraHeaders_size, int priority, int deadline);
+
+// snow_enqueue with one callable, see the snow_do taking one
+template<class callable_t, snow_if_callable_t<callable_t> = 0>
+bool snow_enqueue(snow_global_t *global, int method, const char *url, callable_t &&callable, const char *extraHeaders = nullptr,
+                  size_t extraHeaders_size = 0, int priority = PRIORITY_NORMAL, int deadline = 0) {
+    snow_callback_t callback = snow_callback_t::from(std::forward<callable_t>(callable));
+    return snow_enqueueCallback(global, method, url, &callback, extraHeaders, extraHeaders_size, priority, deadline);
+}
+
+// number of requests waiting in the queue
+size_t snow_queueSize(snow_global_t *global);
 
 #endif
 
@@ -122,19 +466,76 @@ void snow_addWantedSession(snow_global_t *global, const std::string &url);
 
 #endif
 
+#ifdef SNOW_SNAPSHOT
+
+/*
+ * Writes the cached addresses & the sessions of the wanted hosts to path, snow_init loads them back from snapshotPath.
+ * Also done every snapshotInterval from a helper thread & by snow_destroy. Safe from any thread, returns false on io errors.
+ */
+bool snow_saveSnapshot(snow_global_t *global, const char *path);
+
+#endif
+
+/*
+ * Snapshot of the counters & gauges, safe from any thread. Counters are monotonic, diff two snapshots for rates.
+ * loop : loop index, -1 - all loops & requests made outside of them
+ */
+void snow_stats(snow_global_t *global, snow_stats_t *out, int loop = -1);
+
+// text exposition, one "snow_<name>{<label>} <value>" line per value
+void snow_printStats(const snow_stats_t *stats, FILE *out);
+
+#ifdef SNOW_TRACE
+
+/*
+ * Writes the trace ring of a loop to path, convert it with tools/trace2json. Returns false on io errors.
+ * Safe while the loop runs, the events recorded meanwhile may be torn.
+ */
+bool snow_traceSave(snow_global_t *global, int loop, const char *path);
+
+#endif
+
+#ifdef SNOW_LATENCY_HISTOGRAMS
+
+/*
+ * Gives host:port its own latency histograms, on top of the ones for all requests.
+ * Call before snow_init, returns the host index for snow_latencySnapshot or -1 if trackedHostsMax are tracked already.
+ */
+int snow_trackHost(snow_global_t *global, const char *host, int port);
+
+/*
+ * Merged latency histogram of one phase of the successful requests, in ns. Safe from any thread, the loops are not stopped.
+ *
+ * phase : PHASE_*
+ * loop  : loop index, -1 - all loops
+ * host  : snow_trackHost index, -1 - all hosts
+ */
+void snow_latencySnapshot(snow_global_t *global, int phase, int loop, int host, snow_histogram_snapshot_t *out);
+
+#endif
+
 #ifdef SNOW_MULTI_LOOP
 
-// creates threads
+/*
+ * Creates threads, returns once every loop is running.
+ * Each loop moves its own share of the connections to its NUMA node.
+ * Set global->placement[loop] beforehand to pin loops / use SCHED_FIFO.
+ */
 void snow_spawnLoops(snow_global_t *global);
 
 // joins threads
 void snow_joinLoops(snow_global_t *global);
 
+// prints the cpu, NUMA node & connection range of every loop
+void snow_printTopology(snow_global_t *global, FILE *out);
+
 #endif
 
 /////////////////////////////////////////////////////
 
 constexpr int __TLS_DUMMY = -1;
+constexpr int __H2_SESSION = -2; // connection carrying the HTTP/2 streams of a host
+constexpr int __WEBSOCKET = -3; // upgraded by snow_ws_open, stays open
 
 #define SNOW_LIKELY(x) __builtin_expect(!!(x), 1)
 #define SNOW_UNLIKELY(x) __builtin_expect(!!(x), 0)
@@ -150,6 +551,21 @@ enum conn_status_enum {
     CONN_DONE // received http response
 };
 
+// one cell per loop, only contended by the threads outside of the loops
+struct alignas(64) snow_loop_stats_t {
+    std::atomic<uint64_t> counters[STAT_COUNT];
+    std::atomic<uint64_t> errors[ERROR_COUNT];
+};
+
+struct snow_stats_t {
+    uint64_t counters[STAT_COUNT];
+    uint64_t errors[ERROR_COUNT];
+
+    // gauges
+    uint64_t queueDepth;
+    uint64_t connections[CONN_DONE + 1]; // by status, CONN_DONE - free
+};
+
 struct buff_static_t {
     char buff[connBufferSize] = {};
     size_t tail = 0;
@@ -176,24 +592,65 @@ struct host_port_t_functor {
     using is_transparent = void;
     bool operator()(host_port_t<std::string> const &lhs, host_port_t<std::string> const &rhs) const {
         int r = lhs.host.compare(rhs.host);
-        return r == 0 ? lhs.port < rhs.port : r;
+        return r == 0 ? lhs.port < rhs.port : r < 0;
     }
     bool operator()(host_port_t<char *> const &lhs, host_port_t<std::string> const &rhs) const {
         int r = rhs.host.compare(lhs.host);
-        return r == 0 ? lhs.port < rhs.port : -r;
+        return r == 0 ? lhs.port < rhs.port : r > 0;
     }
     bool operator()(host_port_t<std::string> const &lhs, host_port_t<char *> const &rhs) const {
         int r = lhs.host.compare(rhs.host);
-        return r == 0 ? lhs.port < rhs.port : r;
+        return r == 0 ? lhs.port < rhs.port : r < 0;
     }
 };
 
+// resolved address, copied out of the cache into the connection
+struct snow_address_t {
+    int family, socktype, protocol;
+    socklen_t len;
+    struct sockaddr_storage addr;
+    uint64_t expiry; // monotonic ms
+};
+
+#ifdef SNOW_SNAPSHOT
+// serialized session of a host:port, kept for snow_saveSnapshot
+struct snow_sessionBlob_t {
+    int64_t savedAt; // realtime ms
+    uint32_t len;
+    unsigned char der[snapshotSessionSize]; // wolfSSL_i2d_SSL_SESSION
+};
+#endif
+
 constexpr struct linger sock_linger0 = {1, 0};
 
+struct snow_placement_t {
+    cpu_set_t cpus; // loop thread affinity, empty - not pinned
+    int fifoPriority; // > 0 - SCHED_FIFO with this priority, the loops busy poll so give each its own cpu
+};
+
+// one mapping for the connections & the request queue, faulted in by snow_init
+struct snow_arena_t {
+    void *base = nullptr;
+    size_t size = 0;
+    size_t pageSize = 0;
+    bool hugetlb = false; // MAP_HUGETLB, otherwise madvised for transparent huge pages
+    bool locked = false;
+};
+
+struct snow_topology_t {
+    int cpu = -1;
+    int node = -1; // NUMA node of the cpu
+    int slabNode = -1; // NUMA node the loop's connections ended up on
+    int firstConn = 0, lastConn = 0; // connections owned by the loop, [first, last)
+    bool pinned = false;
+    bool fifo = false;
+};
+
 struct snow_connection_t {
     int id;
 
     ev_loop *loop;
+    int loopId;
 
     char requestUrl[connUrlSize] = {};
     char *protocol = nullptr, *hostname = nullptr, *path = nullptr, *query = nullptr;
@@ -206,20 +663,52 @@ struct snow_connection_t {
     const char *extraHeaders = nullptr;
     size_t extraHeaders_size = 0;
 
-    struct addrinfo *addrinfo = nullptr;
-    struct addrinfo hints = {};
+    snow_address_t address;
 
     int sockfd = 0;
     int connectionStatus = 0;
-    uint64_t creationTime;
+    uint64_t creationTime; // monotonic ms
+
+    uint64_t statusTime[CONN_DONE + 1]; // ns when each status was entered, [CONN_UNREADY] - handed out by snow_do
+    uint64_t pickupTime; // ns, snow_startConn on the owning loop
+    int trackedHost; // 1 + snow_trackHost index, 0 - not tracked
+
+    int flight; // 1 + flights index of the GET others wait on, 0 - none
+
+    int statusCode;
+#ifdef SNOW_RESPONSE_CACHE
+    uint64_t cacheHash; // GET the response cache may store, hash of url & extraHeaders, 0 - not cacheable
+    int cacheSlot; // 1 + responseCache slot being revalidated, pinned until the connection is released, 0 - none
+#endif
+
+#ifdef SNOW_HTTP2
+    int h2Session; // 1 + the loop's h2Sessions index, set on the connection carrying it & on its streams, 0 - HTTP/1.1
+    uint32_t h2StreamId; // 0 - no open stream
+    int h2Next; // 1 + id of the next connection waiting for a stream of the same session, 0 - last
+    bool h2Headers; // response headers are in readBuff
+#endif
+
+#ifdef SNOW_WEBSOCKET
+    void (*ws_cb)(char *data, size_t data_len, int opcode, void *extra);
+    bool wsOpen; // upgrade done, readBuff holds frames
+    bool wsClosing; // our close frame went out, nothing else is sent
+    int wsOpcode; // of the fragmented message being joined, 0 - none
+    size_t wsMessage, wsMessageLen; // its readBuff offset & length so far
+    char wsAccept[wsAcceptSize + 1]; // expected Sec-WebSocket-Accept
+#endif
+
+    int hedgeDelay; // ms, HEDGE_P95, 0 - no hedging
+    uint64_t hedgeAt; // ns, when the duplicate goes out, 0 - not pending
+    int hedgePeer; // 1 + id of the other connection of a hedged pair, always on the same loop, 0 - none
+    bool hedge; // this is the duplicate
 
     WOLFSSL *ssl = nullptr;
+#ifdef SNOW_KTLS
+    bool ktlsTx, ktlsRx; // records are encrypted / decrypted by the kernel, wolfSSL is only used for the handshake
+#endif
 
     struct ev_io_snow ior = {}, iow = {};
 
-    buff_static_t writeBuff;
-    buff_static_t readBuff;
-
     int expectedContentLen = 0;
     char *content = nullptr;
     size_t contentLen = 0;
@@ -229,51 +718,217 @@ struct snow_connection_t {
 
     void (*write_cb)(char *data, size_t data_len, void *extra) = nullptr;
     void (*err_cb)(int err, void *extra) = nullptr;
+    snow_callback_t callback = {}; // used instead of the two above if set
 
     snow_global_t *global = nullptr;
 
+    // everything above is cleared for every request, the buffers are only rewound by the owning loop
+    buff_static_t writeBuff;
+    buff_static_t readBuff;
+
+#ifdef SNOW_RESPONSE_CACHE
+    char cacheUrl[connUrlSize]; // requestUrl before snow_parseUrl split it, valid while cacheHash is set
+#endif
+
 #ifdef SNOW_TLS_SESSION_REUSE
     std::map<host_port_t<std::string>, WOLFSSL_SESSION *, host_port_t_functor> sessions;
 #endif
+
+    // kept across requests, see snow_handle_t
+    std::atomic<uint32_t> generation = 0; // bumped for every request, never 0 once used
+    std::atomic<uint32_t> cancelGeneration = 0; // snow_cancel, the request is cancelled while equal to generation
+    std::atomic<snow_handle_t> hedgeSuccessor = 0; // the duplicate carrying on after this connection failed, 0 - none
 };
 
 struct snow_bareRequest_t {
     int method;
-    const char *requestUrl;
+    char requestUrl[connUrlSize];
+    uint64_t deadline; // monotonic ms, 0 - none
 
     void *extra_cb;
 
     void (*write_cb)(char *data, size_t data_len, void *extra);
     void (*err_cb)(int err, void *extra);
+    snow_callback_t callback;
 
     const char *extraHeaders;
     size_t extraHeaders_size;
 };
 
+// GET attached to an identical one in flight
+struct snow_waiter_t {
+    void (*write_cb)(char *data, size_t data_len, void *extra);
+    void (*err_cb)(int err, void *extra);
+    void *extra;
+    snow_callback_t callback;
+    int next; // waiters index, -1 - last
+    int flight; // flights index, read by snow_cancel before it holds the flight's lock
+    uint32_t generation; // bumped every time the slot is handed out, part of the waiter's handle
+};
+
+// GET in flight others can attach to
+struct snow_flight_t {
+    std::mutex lock;
+    std::atomic<uint64_t> hash = 0; // of url & extraHeaders, 0 - free
+    char url[connUrlSize] = {};
+    const char *extraHeaders = nullptr; // the first request's, valid while it is in flight
+    size_t extraHeaders_size = 0;
+    snow_handle_t handle = 0;
+    int waiters = -1; // waiters index, -1 - none
+    bool leaderCancelled = false; // the first request's callbacks are gone, it runs on for the waiters only
+};
+
+enum h2_state_enum {
+    H2_SESSION_FREE,
+    H2_SESSION_CONNECTING, // connection & TLS handshake, requests wait for it
+    H2_SESSION_OPEN,
+    H2_SESSION_GOAWAY, // no new streams, open ones finish
+    H2_SESSION_CLOSING, // failing its streams
+    H2_SESSION_UNSUPPORTED // the host did not negotiate h2, until retryAt
+};
+
+// SNOW_HTTP2 connection to a host:port, its requests are streams of it - only touched by the owning loop
+struct snow_h2_session_t {
+    int state = H2_SESSION_FREE;
+    char host[addrCacheKeySize] = {};
+    int port = 0;
+    uint64_t retryAt = 0; // H2_SESSION_UNSUPPORTED, monotonic ms
+
+    int conn = 0; // 1 + id of the connection carrying it, 0 - closed
+    uint32_t generation = 0; // of that connection, it can be reused while a callback runs
+    uint32_t nextStreamId = 1;
+
+    int streams[h2StreamsMax] = {}; // 1 + ids of the connections with an open stream, 0 - free
+    int streamN = 0;
+    int maxStreams = h2StreamsMax; // SETTINGS_MAX_CONCURRENT_STREAMS
+    int waitingFirst = 0, waitingLast = 0; // 1 + ids of the connections waiting for a stream, linked through h2Next
+
+    int64_t sendWindow = h2DefaultWindow; // connection flow control window, request bodies only
+    int64_t peerStreamWindow = h2DefaultWindow; // SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t recvUnacked = 0; // DATA received since our last WINDOW_UPDATE
+
+    bool tableResized = false; // the next header block starts with a size update
+    snow_hpack_table_t encoder, decoder;
+};
+
+// snow_ws_send from a thread other than the connection's loop, copied
+struct snow_ws_outgoing_t {
+    snow_handle_t handle;
+    int opcode;
+    size_t len;
+    char data[wsOutboxMessageSize];
+};
+
+/*
+ * global->connections[id] is the connection, as when they were one array in snow_global_t. They live in the arena now,
+ * each loop's share on pages of its own, so consecutive ids of different loops are not adjacent in memory.
+ */
+struct snow_connections_t {
+    snow_connection_t *at[concurrentConnections] = {};
+
+    snow_connection_t &operator[](int id) const { return *at[id]; }
+};
+
 struct snow_global_t {
 #ifndef SNOW_MULTI_LOOP
     ev_loop *loop = nullptr;
-    std::map<host_port_t<std::string>, struct addrinfo *, host_port_t_functor> addrCache;
     std::queue<int, std::deque<int>> freeConnections;
 #else
-    int rr_loop = 0;
+    std::atomic<unsigned> rr_loop = 0;
+    std::atomic<int> loopLoad[multi_loop_max] = {}; // requests in flight per loop
+
+    // connections are split between loops, each loop only ever runs its own
+    atomic::ring<int, concurrentConnections> freeConnections[multi_loop_max];
+
+    // connections assigned to a loop from another thread, set up by the loop itself
+    atomic::ring<int, concurrentConnections> loopInbox[multi_loop_max];
+    uint64_t loopActive[multi_loop_max][(concurrentConnections + 63) / 64] = {}; // connections owned by each loop, only touched by it
+    struct ev_timer_snow loopTimers[multi_loop_max] = {};
+
+    // custom loop selection, overrides loopPolicy - returns a loop index < multi_loop_n_runtime
+    int (*loopSelect)(snow_global_t *global, const char *url) = nullptr;
+
+    snow_placement_t placement[multi_loop_max] = {};
+    snow_topology_t topology[multi_loop_max] = {};
+    int loopCpu[multi_loop_max] = {}; // SO_INCOMING_CPU hint for the loop's sockets, -1 - none
+    std::atomic<int> loopsRunning = 0;
+
     std::thread threads[multi_loop_max];
     ev_loop *loops[multi_loop_max];
     ev_loop *loop = nullptr;
 
-    atomic::map<host_port_t<std::string>, struct addrinfo *, host_port_t_functor> addrCache;
-    atomic::queue<int, std::deque<int>> freeConnections;
+    WOLFSSL_CTX *loopCtx[multi_loop_max] = {}; // tlsCtxPerLoop, created on the loop's thread
+
+#ifdef SNOW_WEBSOCKET
+    atomic::ring<snow_ws_outgoing_t, wsOutboxSize> wsOutbox[multi_loop_max]; // drained by the loop after every iteration
+#endif
 #endif
 
     WOLFSSL_CTX *wolfCtx = nullptr;
 
+    // connections snow_cancel marked, [loop][bit per connection], drained by the loop after every iteration
+    std::atomic<uint64_t> loopCancel[multi_loop_max][(concurrentConnections + 63) / 64] = {};
+
+    snow_loop_stats_t stats[multi_loop_max + 1] = {}; // [multi_loop_max] - threads outside of the loops
+
+#ifdef SNOW_TRACE
+    snow_trace_ring_t traceRings[multi_loop_max] = {};
+#endif
+
+#ifdef SNOW_LATENCY_HISTOGRAMS
+    // [loop][0 - all hosts, 1 + snow_trackHost index][phase], each written by its loop only
+    snow_histogram_t latency[multi_loop_max][1 + trackedHostsMax][PHASE_COUNT] = {};
+    host_port_t<char[addrCacheKeySize]> trackedHosts[trackedHostsMax] = {};
+    int trackedHostN = 0;
+
+    // HEDGE_P95 delays in ns, [loop][0 - all hosts, 1 + snow_trackHost index], 0 - not computed yet
+    uint64_t hedgeDelays[multi_loop_max][1 + trackedHostsMax] = {};
+    uint64_t hedgeRefreshed[multi_loop_max] = {}; // monotonic ms
+#endif
+
+    // coalesceGets, indexed by hash, a key whose slot is taken by another key is not coalesced
+    snow_flight_t flights[coalesceIndexSize];
+    snow_waiter_t waiters[coalesceWaitersMax] = {};
+    atomic::ring<int, coalesceWaitersMax> freeWaiters;
+
+#ifdef SNOW_HTTP2
+    snow_h2_session_t h2Sessions[multi_loop_max][h2SessionsMax];
+#endif
+
+#ifdef SNOW_RESPONSE_CACHE
+    // GET responses by url & extraHeaders, lookups from any thread are lock-free
+    snow_cache_t<cacheSets, cacheWays, cacheBodySize, connUrlSize> responseCache;
+#endif
+
+    // host:port -> address, lookups from every loop are lock-free
+    atomic::seqlock_map<snow_address_t, addrCacheSize, addrCacheKeySize> addrCache;
+
+#ifdef SNOW_SNAPSHOT
+    // host:port -> latest session renewed by any loop
+    atomic::seqlock_map<snow_sessionBlob_t, snapshotSessionsMax, addrCacheKeySize> sessionSnapshots;
+    struct ev_timer_snow snapshotTimer = {};
+    std::thread snapshotWriter; // the periodic write, file io & fsync stay off the main loop
+    std::atomic<bool> snapshotWriting = false;
+#endif
+
     struct ev_timer_snow mainTimer = {};
     struct ev_timer_snow sessionRenewTimer = {};
 
-    snow_connection_t connections[concurrentConnections];
-    std::queue<struct snow_bareRequest_t, std::deque<struct snow_bareRequest_t>> requestQueue;
+    // carved out of the arena by snow_init, each loop's share of the connections is contiguous & starts on a page boundary
+    snow_arena_t arena;
+    snow_connections_t connections;
+    // one reserved slot per dispatching loop, for requests popped right before another thread took the free connection
+    atomic::priority_queue<struct snow_bareRequest_t, requestQueueSize, requestPriorities, multi_loop_max> *requestQueue = nullptr;
 
 #ifdef SNOW_TLS_SESSION_REUSE
-    std::vector<std::string> wantedSessions;
+    std::vector<std::string> wantedSessions; // one list for all loops, every loop's connections renew the same hosts
+#ifdef SNOW_MULTI_LOOP
+    std::mutex wantedSessionsLock;
 #endif
-};
\ No newline at end of file
+    // renewals still to be enqueued, url & how many, only touched by the main loop
+    std::vector<std::pair<std::string, int>> pendingRenewals;
+    struct ev_timer_snow renewRetryTimer = {};
+#endif
+};
+
+SNOW_NAMESPACE_END
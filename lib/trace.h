@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+// #define SNOW_TRACE // per loop event trace, see snow_traceSave & tools/trace2json - or -DSNOW_TRACE
+
+#ifdef SNOW_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Binary trace ring, one per loop thread, the oldest events are overwritten.
+ * Events are 16 bytes stamped with the tsc, converted to ns when the ring is saved.
+ */
+
+constexpr int traceRingBits = 16; // 64Ki events, 1 MiB per loop
+
+enum trace_enum {
+    TRACE_EPOLL, // epoll_wait returned events, arg - count
+    TRACE_IO_BEGIN, // io callback, id - fd, arg - EV_READ / EV_WRITE
+    TRACE_IO_END,
+    TRACE_TIMER_BEGIN, // timer callback
+    TRACE_TIMER_END,
+    TRACE_READ, // id - connection, arg - bytes
+    TRACE_WRITE, // id - connection, arg - bytes
+    TRACE_TLS_WANT_READ, // id - connection
+    TRACE_TLS_WANT_WRITE, // id - connection
+    TRACE_STATUS // id - connection, arg - conn_status_enum
+};
+
+struct snow_trace_event_t {
+    uint64_t tick;
+    uint32_t arg;
+    uint16_t id;
+    uint16_t type;
+};
+
+struct snow_trace_ring_t {
+    snow_trace_event_t events[1U << traceRingBits];
+    std::atomic<uint64_t> head; // only written by the owning thread
+    uint64_t tickBase, nsBase; // calibration point
+    int loop;
+};
+
+// file layout: header, then count events oldest first
+struct snow_trace_header_t {
+    char magic[8]; // "SNOWTRC1"
+    int32_t loop;
+    uint32_t count;
+    uint64_t tickBase, nsBase;
+    double ticksPerNs;
+};
+
+inline thread_local snow_trace_ring_t *snow_traceRing = nullptr; // the ring of the loop running on this thread
+
+inline uint64_t snow_trace_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+inline uint64_t snow_trace_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return snow_trace_ns();
+#endif
+}
+
+// binds ring to the calling thread
+inline void snow_trace_attach(snow_trace_ring_t *ring, int loop) {
+    ring->loop = loop;
+    ring->tickBase = snow_trace_tick();
+    ring->nsBase = snow_trace_ns();
+    snow_traceRing = ring;
+}
+
+inline void snow_trace(int type, uint32_t id, uint32_t arg) {
+    snow_trace_ring_t *ring = snow_traceRing;
+    if (!ring) return;
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head & ((1U << traceRingBits) - 1)] = {snow_trace_tick(), arg, (uint16_t) id, (uint16_t) type};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// safe while the owning thread records, the events written meanwhile may be torn
+inline bool snow_trace_save(snow_trace_ring_t *ring, const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (!out) return false;
+
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t count = head < (1U << traceRingBits) ? head : (1U << traceRingBits);
+
+    snow_trace_header_t header = {{'S', 'N', 'O', 'W', 'T', 'R', 'C', '1'}, ring->loop, (uint32_t) count, ring->tickBase, ring->nsBase, 1.0};
+    uint64_t tick = snow_trace_tick(), ns = snow_trace_ns();
+    if (ns > ring->nsBase) header.ticksPerNs = (double) (tick - ring->tickBase) / (double) (ns - ring->nsBase);
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (uint64_t i = head - count; ok && i < head; i++)
+        ok = fwrite(&ring->events[i & ((1U << traceRingBits) - 1)], sizeof(snow_trace_event_t), 1, out) == 1;
+
+    return fclose(out) == 0 && ok;
+}
+
+#define SNOW_TRACE_EVENT(type, id, arg) snow_trace(type, id, arg)
+
+#else
+
+#define SNOW_TRACE_EVENT(type, id, arg) ((void) 0)
+
+#endif
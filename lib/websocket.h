@@ -0,0 +1,170 @@
+/*
+MIT License
+
+Copyright (c) 2020 Razvan Dan David
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * WebSocket framing (RFC 6455) for SNOW_WEBSOCKET, no allocations.
+ * Frames are parsed & unmasked in place in the connection's readBuff, client frames are masked as they are written.
+ */
+
+constexpr char wsGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+constexpr size_t wsMaxHeaderSize = 14; // 2 + 8 byte length + 4 byte mask key
+constexpr size_t wsKeySize = 24; // Sec-WebSocket-Key, base64 of 16 bytes
+constexpr size_t wsAcceptSize = 28; // Sec-WebSocket-Accept, base64 of a SHA-1
+
+enum ws_opcode_enum {
+    WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_CLOSE = 8, WS_PING, WS_PONG,
+    WS_OPEN = 16 // not a frame, ws_cb gets it once the upgrade is done
+};
+
+struct snow_ws_frame_t {
+    int opcode;
+    bool fin;
+    bool masked;
+    uint8_t mask[4];
+    uint64_t len; // payload
+    size_t headerLen;
+};
+
+// 1 - *frame is filled in, 0 - the header is not complete yet, -1 - invalid
+static inline int snow_ws_parseHeader(const uint8_t *in, size_t avail, snow_ws_frame_t *frame) {
+    if (avail < 2) return 0;
+    if (in[0] & 0x70U) return -1; // RSV bits, no extension is negotiated
+
+    frame->fin = in[0] & 0x80U;
+    frame->opcode = in[0] & 0x0fU;
+    frame->masked = in[1] & 0x80U;
+    if ((frame->opcode > WS_BINARY && frame->opcode < WS_CLOSE) || frame->opcode > WS_PONG) return -1;
+
+    uint64_t len = in[1] & 0x7fU;
+    size_t at = 2;
+    if (len == 126) {
+        if (avail < 4) return 0;
+        len = in[2] << 8U | in[3];
+        at = 4;
+    } else if (len == 127) {
+        if (avail < 10) return 0;
+        len = 0;
+        for (int i = 0; i < 8; i++) len = len << 8U | in[2 + i];
+        if (len >> 63U) return -1;
+        at = 10;
+    }
+    if (frame->opcode >= WS_CLOSE && (len > 125 || !frame->fin)) return -1; // control frames are small & never fragmented
+
+    if (frame->masked) {
+        if (avail < at + 4) return 0;
+        memcpy(frame->mask, in + at, 4);
+        at += 4;
+    }
+
+    frame->len = len;
+    frame->headerLen = at;
+    return 1;
+}
+
+// writes the header of a frame with len bytes of payload, mask - 4 byte key or nullptr, returns the end of the header
+static inline char *snow_ws_frameHeader(char *out, int opcode, bool fin, uint64_t len, const uint8_t *mask) {
+    *out++ = (char) ((fin ? 0x80U : 0) | (unsigned) opcode);
+    uint8_t maskBit = mask ? 0x80U : 0;
+
+    if (len < 126) *out++ = (char) (maskBit | len);
+    else if (len <= 0xffff) {
+        *out++ = (char) (maskBit | 126U);
+        *out++ = (char) (len >> 8U);
+        *out++ = (char) len;
+    } else {
+        *out++ = (char) (maskBit | 127U);
+        for (int i = 7; i >= 0; i--) *out++ = (char) (len >> (8U * i));
+    }
+
+    if (mask) {
+        memcpy(out, mask, 4);
+        out += 4;
+    }
+    return out;
+}
+
+// XORs len bytes with the repeating 4 byte key, masks & unmasks alike, large payloads go through SIMD
+static inline void snow_ws_mask(char *data, size_t len, const uint8_t *mask) {
+    uint32_t key32;
+    memcpy(&key32, mask, 4);
+    size_t i = 0;
+
+    // every step is a multiple of 4 bytes, the key stays aligned with the payload
+#if defined(__AVX2__)
+    __m256i key256 = _mm256_set1_epi32((int) key32);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        _mm256_storeu_si256((__m256i *) (data + i), _mm256_xor_si256(v, key256));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key128 = _mm_set1_epi32((int) key32);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        _mm_storeu_si128((__m128i *) (data + i), _mm_xor_si128(v, key128));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8((uint8_t *) data + i, veorq_u8(vld1q_u8((const uint8_t *) data + i), key128));
+#endif
+
+    uint64_t key64 = (uint64_t) key32 << 32U | key32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key64;
+        memcpy(data + i, &v, 8);
+    }
+    for (; i < len; i++) data[i] = (char) (data[i] ^ mask[i & 3U]);
+}
+
+// standard base64 with padding, out needs 4 * ((len + 2) / 3) + 1 bytes, returns the length written
+static inline size_t snow_base64Encode(const uint8_t *in, size_t len, char *out) {
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *it = out;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = in[i] << 16U | (i + 1 < len ? in[i + 1] << 8U : 0) | (i + 2 < len ? in[i + 2] : 0);
+        *it++ = alphabet[v >> 18U & 63U];
+        *it++ = alphabet[v >> 12U & 63U];
+        *it++ = i + 1 < len ? alphabet[v >> 6U & 63U] : '=';
+        *it++ = i + 2 < len ? alphabet[v & 63U] : '=';
+    }
+    *it = 0;
+    return it - out;
+}
@@ -0,0 +1,92 @@
+// snow_doBatch: chunks, callables, malformed urls, batches from a loop thread & more requests than connections
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl tests/batch.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_batch && bin/test_batch
+
+#include <vector>
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr size_t bodySize = 64;
+static std::atomic<int> done = 0, ok = 0, malformed = 0, noConn = 0, bad = 0, nested = 0;
+static char url[64], badUrl[] = "ftp://127.0.0.1/";
+
+static void write_cb(char *data, size_t len, void *extra) {
+    if (len != bodySize || data[0] != 'x') bad++;
+    ok++;
+    done++;
+}
+
+static void err_cb(int err, void *extra) {
+    if (err == URL_MALFORMATTED) malformed++;
+    else if (err == NO_FREE_CONN) noConn++;
+    else bad++;
+    done++;
+}
+
+// on a loop thread, part of the batch starts on that same loop
+static void write_cb_nested(char *data, size_t len, void *extra) {
+    write_cb(data, len, extra);
+
+    snow_batchRequest_t requests[3];
+    for (auto &r : requests) r = {GET, url, write_cb, err_cb};
+    requests[1].url = badUrl;
+    nested += 3;
+    snow_doBatch(&global, requests, 3);
+}
+
+int main() {
+    bench_server_t server;
+    server.bodySize = bodySize;
+    if (!bench_server_start(&server)) return 1;
+
+    test_start(&global);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+
+    // 150 is more than two chunks of batchChunkSize
+    constexpr int batchN = 150;
+    std::vector<snow_batchRequest_t> requests(batchN);
+    std::vector<snow_handle_t> handles(batchN);
+    int expected = 0, expectedMalformed = 0;
+
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < batchN; i++) requests[i] = {GET, i % 7 == 3 ? badUrl : url, write_cb, err_cb};
+        snow_callback_t callback = snow_callback_t::from([](const snow_response_t &r) {
+            if (r.err >= 0 || r.statusCode != 200) bad++;
+            ok++;
+            done++;
+        });
+        requests[5].callback = &callback;
+        requests[6].write_cb = write_cb_nested;
+
+        size_t started = snow_doBatch(&global, requests.data(), batchN, handles.data());
+        TEST_CHECK(started == batchN, "round %d started %zu of %d", round, started, batchN);
+        for (int i = 0; i < batchN; i++) {
+            TEST_CHECK(handles[i] || i % 7 == 3, "round %d request %d has no handle", round, i);
+            expectedMalformed += i % 7 == 3;
+        }
+        expected += batchN;
+        TEST_CHECK(test_wait(done, expected) && test_wait(done, expected + nested), "round %d: %d of %d done", round, done.load(),
+                   expected + nested.load());
+    }
+    expectedMalformed += nested / 3;
+
+    // more than there are connections, the rest gets NO_FREE_CONN right away
+    constexpr int overflowN = concurrentConnections + 50;
+    requests.resize(overflowN);
+    handles.resize(overflowN);
+    for (auto &r : requests) r = {GET, url, write_cb, err_cb};
+    size_t started = snow_doBatch(&global, requests.data(), overflowN, handles.data());
+    int zero = 0;
+    for (snow_handle_t handle : handles) zero += !handle;
+    expected += overflowN;
+
+    TEST_CHECK(started + zero == overflowN && started <= (size_t) concurrentConnections, "%zu started, %d without a handle", started, zero);
+    TEST_CHECK(test_wait(done, expected + nested), "%d of %d done", done.load(), expected + nested.load());
+    TEST_CHECK(noConn == zero, "%d NO_FREE_CONN for %d unstarted", noConn.load(), zero);
+    TEST_CHECK(malformed == expectedMalformed, "%d of %d malformed", malformed.load(), expectedMalformed);
+    TEST_CHECK(bad == 0, "%d bad responses", bad.load());
+
+    test_stop(&global);
+    bench_server_stop(&server);
+    return test_report("batch");
+}
@@ -0,0 +1,75 @@
+// callables with inline captures for snow_do & snow_enqueue, responses & errors, alone & coalesced
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl tests/callbacks.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_callbacks && bin/test_callbacks
+
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr int requestN = 600;
+constexpr size_t bodySize = 64;
+static std::atomic<int> calls[requestN], done = 0, bad = 0;
+
+struct context_t {
+    int id;
+    std::atomic<int> *calls;
+};
+
+static void run(const char *url, const char *badUrl) {
+    done = 0;
+    for (auto &n : calls) n = 0;
+
+    for (int i = 0; i < requestN; i++) {
+        context_t context = {i, &calls[i]};
+        double half = i * 0.5;
+        long twice = 2L * i; // captures of several types & alignments, checked on the way back
+
+        while (done + 100 < i) usleep(100);
+        if (i % 3 == 0)
+            snow_do(&global, GET, url, [context, half, twice](const snow_response_t &r) {
+                if (r.err >= 0 || r.statusCode != 200 || r.len != bodySize || half != context.id * 0.5 || twice != 2L * context.id) bad++;
+                (*context.calls)++;
+                done++;
+            });
+        else if (i % 3 == 1)
+            while (!snow_enqueue(&global, GET, url, [context](const snow_response_t &r) {
+                if (r.err >= 0 || r.statusCode != 200) bad++;
+                (*context.calls)++;
+                done++;
+            }, nullptr, 0, PRIORITY_HIGH)) usleep(10);
+        else
+            snow_do(&global, GET, badUrl, [context](const snow_response_t &r) {
+                if (r.err != URL_MALFORMATTED || r.statusCode || r.data) bad++;
+                (*context.calls)++;
+                done++;
+            });
+    }
+
+    TEST_CHECK(test_wait(done, requestN), "%d of %d done", done.load(), requestN);
+    for (int i = 0; i < requestN; i++) TEST_CHECK(calls[i] == 1, "request %d got %d calls", i, calls[i].load());
+}
+
+int main() {
+    bench_server_t server;
+    server.bodySize = bodySize;
+    if (!bench_server_start(&server)) return 1;
+
+    test_start(&global);
+
+    char url[64], badUrl[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+    snprintf(badUrl, sizeof(badUrl), "ftp://127.0.0.1:%d/", server.port);
+
+    run(url, badUrl);
+
+    // attached GETs get their own callable's copy
+    coalesceGets = true;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/?d=1000", server.port);
+    run(url, badUrl);
+    TEST_CHECK(test_counter(&global, STAT_COALESCED) > 0, "nothing coalesced");
+
+    TEST_CHECK(bad == 0, "%d bad responses", bad.load());
+
+    test_stop(&global);
+    bench_server_stop(&server);
+    return test_report("callbacks");
+}
@@ -0,0 +1,72 @@
+// snow_cancel: one CANCELLED callback, late & stale handles change nothing, a hedged pair goes together
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl tests/cancel.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_cancel && bin/test_cancel
+
+#include "tests.h"
+
+static snow_global_t global = {};
+static std::atomic<int> calls = 0, err = 0;
+
+static snow_handle_t get(const char *url, int hedgeDelay = 0) {
+    calls = 0;
+    return snow_do(&global, GET, url, [](const snow_response_t &r) {
+        err = r.err;
+        calls++;
+    }, nullptr, 0, hedgeDelay);
+}
+
+int main() {
+    bench_server_t server;
+    server.delayUs = 500000;
+    if (!bench_server_start(&server)) return 1;
+
+    test_start(&global);
+
+    char slow[64], fast[64];
+    snprintf(slow, sizeof(slow), "http://127.0.0.1:%d/", server.port);
+    snprintf(fast, sizeof(fast), "http://127.0.0.1:%d/?d=0", server.port);
+
+    // in flight
+    snow_handle_t handle = get(slow);
+    usleep(20000);
+    uint64_t begin = bench_server_now_ns();
+    TEST_CHECK(snow_cancel(&global, handle), "not cancelled");
+    TEST_CHECK(test_wait(calls, 1, 200), "no callback %lu us after the cancel", (bench_server_now_ns() - begin) / 1000);
+    TEST_CHECK(err == CANCELLED, "err %d", err.load());
+    snow_cancel(&global, handle);
+
+    // right away, likely still in the loop's inbox
+    handle = get(slow);
+    TEST_CHECK(snow_cancel(&global, handle), "not cancelled");
+    TEST_CHECK(test_wait(calls, 1, 200) && err == CANCELLED, "%d callbacks, err %d", calls.load(), err.load());
+
+    usleep(20000);
+    TEST_CHECK(calls == 1, "%d callbacks after cancelling twice", calls.load());
+
+    // done already, the handle may name a connection serving the next request by now
+    for (int i = 0; i < 2 * concurrentConnections; i++) {
+        handle = get(fast);
+        TEST_CHECK(test_wait(calls, 1) && err == -1, "%d callbacks, err %d", calls.load(), err.load());
+        snow_cancel(&global, handle);
+        get(fast);
+        snow_cancel(&global, handle);
+        TEST_CHECK(test_wait(calls, 1) && err == -1, "stale handle, the next request got err %d", err.load());
+    }
+
+    // hedged, the duplicate is out too
+    handle = get(slow, 10);
+    usleep(50000);
+    TEST_CHECK(test_counter(&global, STAT_HEDGES) == 1, "not hedged");
+    TEST_CHECK(snow_cancel(&global, handle), "hedged request not cancelled");
+    TEST_CHECK(test_wait(calls, 1, 200) && err == CANCELLED, "%d callbacks, err %d", calls.load(), err.load());
+
+    usleep(server.delayUs);
+    TEST_CHECK(calls == 1, "%d callbacks in the end", calls.load());
+    snow_stats_t stats;
+    snow_stats(&global, &stats);
+    TEST_CHECK(stats.connections[CONN_DONE] == (uint64_t) concurrentConnections, "%lu of %d connections free",
+               stats.connections[CONN_DONE], concurrentConnections);
+
+    test_stop(&global);
+    bench_server_stop(&server);
+    return test_report("cancel");
+}
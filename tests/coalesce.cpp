@@ -0,0 +1,66 @@
+// snow_cancel of GETs coalesced onto one request, each has its own handle & only the last one aborts the request
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl tests/coalesce.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_coalesce && bin/test_coalesce
+
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr int requestsMax = 8;
+static std::atomic<int> calls[requestsMax], errs[requestsMax], done = 0;
+
+static snow_handle_t get(const char *url, int i) {
+    errs[i] = 0;
+    return snow_do(&global, GET, url, [i](const snow_response_t &r) {
+        errs[i] = r.err;
+        calls[i]++;
+        done++;
+    });
+}
+
+int main() {
+    bench_server_t server;
+    server.delayUs = 200000; // the first GET is still in flight when the others attach
+    if (!bench_server_start(&server)) return 1;
+
+    coalesceGets = true;
+    test_start(&global, 1);
+
+    char url[64];
+
+    // a waiter cancels, the first GET & the other waiter get the response
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/a", server.port);
+    snow_handle_t a[3] = {get(url, 0), get(url, 1), get(url, 2)};
+    TEST_CHECK(a[0] != a[1] && a[1] != a[2], "attached GETs share a handle");
+    TEST_CHECK(snow_cancel(&global, a[1]), "waiter not cancelled");
+    TEST_CHECK(calls[1] == 1 && errs[1] == CANCELLED, "waiter got %d calls, err %d", calls[1].load(), errs[1].load());
+    TEST_CHECK(test_wait(done, 3), "%d of 3 callbacks", done.load());
+    TEST_CHECK(errs[0] == -1 && errs[2] == -1, "err %d & %d instead of responses", errs[0].load(), errs[2].load());
+    TEST_CHECK(!snow_cancel(&global, a[1]), "waiter cancelled twice");
+
+    // the first GET cancels, its request carries on for the waiter
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/b", server.port);
+    done = 0;
+    snow_handle_t b[2] = {get(url, 3), get(url, 4)};
+    TEST_CHECK(snow_cancel(&global, b[0]), "first GET not cancelled");
+    TEST_CHECK(test_wait(done, 2), "%d of 2 callbacks", done.load());
+    TEST_CHECK(errs[3] == CANCELLED && errs[4] == -1, "err %d & %d", errs[3].load(), errs[4].load());
+
+    // everyone cancels, the request is aborted
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/c", server.port);
+    done = 0;
+    uint64_t completed = test_counter(&global, STAT_COMPLETED);
+    snow_handle_t c[2] = {get(url, 5), get(url, 6)};
+    TEST_CHECK(snow_cancel(&global, c[0]), "first GET not cancelled");
+    TEST_CHECK(test_wait(done, 1), "first GET not called back");
+    TEST_CHECK(snow_cancel(&global, c[1]), "last waiter not cancelled");
+    TEST_CHECK(test_wait(done, 2), "%d of 2 callbacks", done.load());
+    usleep(2 * server.delayUs);
+    TEST_CHECK(errs[5] == CANCELLED && errs[6] == CANCELLED, "err %d & %d", errs[5].load(), errs[6].load());
+    TEST_CHECK(test_counter(&global, STAT_COMPLETED) == completed, "abandoned request still completed");
+
+    for (int i = 0; i < 7; i++) TEST_CHECK(calls[i] == 1, "request %d got %d callbacks", i, calls[i].load());
+
+    test_stop(&global);
+    bench_server_stop(&server);
+    return test_report("coalesce");
+}
@@ -0,0 +1,76 @@
+// lib/snowco.h: chained & concurrent awaits, errors, frames going back to their pool from other threads
+// g++ -std=c++20 -pthread -I. -Ilib/wolf/wolfssl tests/coroutines.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_coroutines && bin/test_coroutines
+
+#include <set>
+#include <vector>
+#include "../lib/snowco.h"
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr int taskN = 200;
+constexpr size_t bodySize = 64;
+static std::atomic<int> done = 0, bad = 0;
+static char url[64], badUrl[64];
+
+static bool isBody(const snow::response_t &r, const char *at) {
+    return r.err < 0 && r.len == bodySize && r.data == at && r.data[0] == 'x' && r.data[bodySize - 1] == 'x';
+}
+
+snow::task chain() {
+    snow::response_t r = co_await snow::get(&global, url);
+    if (r.err >= 0 || r.len != bodySize) bad++;
+
+    char a[128], b[128];
+    auto [x, y, failed] = co_await snow::when_all(snow::get(&global, url).into(a, sizeof(a)), snow::get(&global, url).into(b, sizeof(b)),
+                                                  snow::get(&global, badUrl));
+    if (!isBody(x, a) || !isBody(y, b) || failed.err != URL_MALFORMATTED) bad++;
+
+    snow::response_t z = co_await snow::get(&global, badUrl);
+    if (z.err != URL_MALFORMATTED) bad++;
+    done++;
+}
+
+int main() {
+    bench_server_t server;
+    server.bodySize = bodySize;
+    if (!bench_server_start(&server)) return 1;
+
+    test_start(&global);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+    snprintf(badUrl, sizeof(badUrl), "ftp://127.0.0.1:%d/", server.port);
+
+    for (int i = 0; i < taskN; i++) {
+        chain();
+        while (i - done > 40) usleep(100); // within the connections, 4 requests in flight per task at most
+    }
+    TEST_CHECK(test_wait(done, taskN), "%d of %d tasks done", done.load(), taskN);
+    TEST_CHECK(bad == 0, "%d bad results", bad.load());
+
+    test_stop(&global);
+    bench_server_stop(&server);
+
+    // frames freed on another thread go back to this thread's pool, later rounds allocate no new ones
+    std::vector<void *> frames;
+    std::set<void *> first;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 1000; i++) {
+            frames.push_back(snow::co_alloc(200 + i % 1500));
+            if (round == 0) first.insert(frames.back());
+        }
+        std::thread([&] {
+            for (size_t i = 0; i < frames.size(); i++) snow::co_free(frames[i], 200 + i % 1500);
+        }).join();
+        frames.clear();
+    }
+    int fresh = 0;
+    for (int i = 0; i < 1000; i++) {
+        void *frame = snow::co_alloc(200 + i % 1500);
+        fresh += !first.count(frame);
+        frames.push_back(frame);
+    }
+    TEST_CHECK(fresh == 0, "%d frames not reused", fresh);
+    for (size_t i = 0; i < frames.size(); i++) snow::co_free(frames[i], 200 + i % 1500);
+
+    return test_report("coroutines");
+}
@@ -0,0 +1,73 @@
+// HEADERS + CONTINUATION reassembly of lib/http2.h, fed cut at every byte offset
+// g++ -std=c++17 -fsanitize=address,undefined -Ilib tests/h2_frames.cpp -o bin/h2_frames && bin/h2_frames
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "http2.h"
+
+// :status 200, x-a: b, content-length: 5
+static const uint8_t block[] = {0x88, 0x00, 0x03, 'x', '-', 'a', 0x01, 'b', 0x0f, 0x0d, 0x01, '5'};
+
+static void appendFrame(std::vector<uint8_t> &out, const uint8_t *payload, size_t len, int type, int flags, uint32_t streamId) {
+    char header[h2FrameHeaderSize];
+    snow_h2_frameHeader(header, len, type, flags, streamId);
+    out.insert(out.end(), header, header + h2FrameHeaderSize);
+    out.insert(out.end(), payload, payload + len);
+}
+
+// HEADERS with its fragment padded & prioritized, then two CONTINUATIONs
+static std::vector<uint8_t> headerBlock(int secondType) {
+    std::vector<uint8_t> out, headers = {2, 0, 0, 0, 0, 16};
+    headers.insert(headers.end(), block, block + 3);
+    headers.insert(headers.end(), {0, 0});
+
+    appendFrame(out, headers.data(), headers.size(), H2_HEADERS, H2_PADDED | H2_PRIORITY_FLAG, 1);
+    appendFrame(out, block + 3, 5, H2_CONTINUATION, 0, 1);
+    appendFrame(out, block + 8, sizeof(block) - 8, secondType, H2_END_HEADERS, 1);
+    return out;
+}
+
+int main() {
+    int failed = 0;
+    std::vector<uint8_t> frames = headerBlock(H2_CONTINUATION);
+    size_t first = h2FrameHeaderSize + snow_h2_frameLen(frames.data());
+
+    // the HEADERS frame itself is complete before the block is looked at
+    for (size_t cut = first; cut < frames.size(); cut++) {
+        auto *part = (uint8_t *) malloc(cut); // exactly sized, reads past it are caught by the sanitizer
+        memcpy(part, frames.data(), cut);
+
+        size_t end = 0;
+        int result = snow_h2_blockEnd(part, cut, &end);
+        if (result != H2_BLOCK_PARTIAL) {
+            printf("cut at %zu of %zu: %d instead of partial\n", cut, frames.size(), result);
+            failed++;
+        }
+        free(part);
+    }
+
+    auto *whole = (uint8_t *) malloc(frames.size());
+    memcpy(whole, frames.data(), frames.size());
+
+    size_t end = 0;
+    long len = -1;
+    if (snow_h2_blockEnd(whole, frames.size(), &end) != H2_BLOCK_COMPLETE || end != frames.size()) {
+        printf("whole block not complete, end %zu of %zu\n", end, frames.size());
+        failed++;
+    } else if ((len = snow_h2_joinBlock(whole, end)) != (long) sizeof(block) ||
+               memcmp(whole + h2FrameHeaderSize, block, sizeof(block)) != 0) {
+        printf("joined block of %ld bytes differs\n", len);
+        failed++;
+    }
+    free(whole);
+
+    std::vector<uint8_t> interleaved = headerBlock(H2_DATA);
+    if (snow_h2_blockEnd(interleaved.data(), interleaved.size(), &end) != H2_BLOCK_ERROR) {
+        printf("DATA inside a header block not rejected\n");
+        failed++;
+    }
+
+    printf("h2_frames: %zu cuts, %d failed\n", frames.size() - first + 2, failed);
+    return failed != 0;
+}
@@ -0,0 +1,54 @@
+// hedged GETs: the duplicate goes out after hedgeDelay, exactly one callback per request & both connections are freed
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl tests/hedge.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_hedge && bin/test_hedge
+
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr int requestN = 20;
+static std::atomic<int> calls[requestN], ok = 0, done = 0;
+
+int main() {
+    bench_server_t server;
+    server.delayUs = 50000;
+    if (!bench_server_start(&server)) return 1;
+
+    test_start(&global);
+
+    char url[64], fast[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+    snprintf(fast, sizeof(fast), "http://127.0.0.1:%d/?d=0", server.port);
+
+    for (int i = 0; i < requestN; i++)
+        snow_do(&global, GET, url, [i](const snow_response_t &r) {
+            if (r.err < 0 && r.statusCode == 200 && r.len == 64) ok++;
+            calls[i]++;
+            done++;
+        }, nullptr, 0, 10);
+
+    TEST_CHECK(test_wait(done, requestN), "%d of %d done", done.load(), requestN);
+    usleep(2 * server.delayUs); // the losing duplicates would report by now
+    TEST_CHECK(ok == requestN, "%d of %d ok", ok.load(), requestN);
+    for (int i = 0; i < requestN; i++) TEST_CHECK(calls[i] == 1, "request %d got %d callbacks", i, calls[i].load());
+    TEST_CHECK(test_counter(&global, STAT_HEDGES) == requestN, "%lu hedges", test_counter(&global, STAT_HEDGES));
+
+    // answered before the delay, no duplicate
+    done = 0;
+    for (int i = 0; i < requestN; i++)
+        snow_do(&global, GET, fast, [](const snow_response_t &r) { done++; }, nullptr, 0, 1000);
+    TEST_CHECK(test_wait(done, requestN), "%d of %d done", done.load(), requestN);
+    TEST_CHECK(test_counter(&global, STAT_HEDGES) == requestN, "%lu hedges, none expected", test_counter(&global, STAT_HEDGES) - requestN);
+
+    // the last callbacks may still be running, their connections are released right after
+    snow_stats_t stats;
+    for (int t = 0; t < 1000; t++, usleep(1000)) {
+        snow_stats(&global, &stats);
+        if (stats.connections[CONN_DONE] == (uint64_t) concurrentConnections) break;
+    }
+    TEST_CHECK(stats.connections[CONN_DONE] == (uint64_t) concurrentConnections, "%lu of %d connections free",
+               stats.connections[CONN_DONE], concurrentConnections);
+
+    test_stop(&global);
+    bench_server_stop(&server);
+    return test_report("hedge");
+}
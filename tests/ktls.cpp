@@ -0,0 +1,75 @@
+// SNOW_KTLS: https requests with the records handed to the kernel, skipped where the tls module is missing
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl -DSNOW_CONFIG='"tests/ktls_config.h"' tests/ktls.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_ktls && bin/test_ktls
+
+#include <netinet/tcp.h>
+#include "tests.h"
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+static snow_global_t global = {}, receiveGlobal = {};
+
+constexpr int requestN = 200;
+static std::atomic<int> done = 0, bad = 0;
+
+// TCP_ULP needs an established socket, a plain connection to the server will do
+static bool ktls_available(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    bool ok = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+              (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 || errno != ENOENT);
+    close(fd);
+    return ok;
+}
+
+static void run(snow_global_t *global, const char *url, size_t len) {
+    int start = done;
+    for (int i = 0; i < requestN; i++) {
+        while (done + 32 < start + i) usleep(100);
+        snow_do(global, GET, url, [len](const snow_response_t &r) {
+            if (r.err >= 0 || r.statusCode != 200 || r.len != len || r.data[0] != 'x' || r.data[r.len - 1] != 'x') bad++;
+            done++;
+        });
+    }
+    TEST_CHECK(test_wait(done, start + requestN, 20000), "%d of %d done", done.load() - start, requestN);
+}
+
+int main() {
+    // several records per response, the sequence numbers have to carry on across them
+    bench_server_t server;
+    server.tls = true;
+    server.bodySize = 20000;
+    if (!bench_server_start(&server)) return 1;
+
+    if (!ktls_available(server.port)) {
+        printf("ktls: skipped, no tls module\n");
+        bench_server_stop(&server);
+        return 0;
+    }
+
+    test_start(&global);
+
+    char url[64];
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/", server.port);
+
+    ktlsReceive = false;
+    run(&global, url, server.bodySize);
+    TEST_CHECK(test_counter(&global, STAT_KTLS) > 0, "no connection offloaded");
+
+    // fresh connections for the receive side
+    test_stop(&global);
+    ktlsReceive = true;
+    test_start(&receiveGlobal);
+    run(&receiveGlobal, url, server.bodySize);
+    TEST_CHECK(test_counter(&receiveGlobal, STAT_KTLS) > 0, "no connection offloaded with ktlsReceive");
+    TEST_CHECK(bad == 0, "%d bad responses", bad.load());
+
+    test_stop(&receiveGlobal);
+    bench_server_stop(&server);
+    return test_report("ktls");
+}
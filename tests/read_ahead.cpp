@@ -0,0 +1,47 @@
+// SNOW_TLS_READ_AHEAD: https responses of many records, chunked & not, read through the per loop buffer
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl -DSNOW_CONFIG='"tests/read_ahead_config.h"' tests/read_ahead.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_read_ahead && bin/test_read_ahead
+
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr int requestN = 400;
+static std::atomic<int> done = 0, bad = 0;
+static size_t expectedLen[2];
+
+static void get(const char *url, int server) {
+    snow_do(&global, GET, url, [server](const snow_response_t &r) {
+        if (r.err >= 0 || r.statusCode != 200 || r.len != expectedLen[server] || r.data[0] != 'x' || r.data[r.len - 1] != 'x') bad++;
+        done++;
+    });
+}
+
+int main() {
+    // larger than tlsReadAheadSize in 4096 byte chunks, & small ones next to them
+    bench_server_t servers[2];
+    servers[0].tls = servers[1].tls = true;
+    servers[0].bodySize = 20000;
+    servers[0].chunked = true;
+    servers[1].bodySize = 64;
+    for (int i = 0; i < 2; i++) {
+        if (!bench_server_start(&servers[i])) return 1;
+        expectedLen[i] = servers[i].bodySize;
+    }
+
+    test_start(&global);
+
+    char urls[2][64];
+    for (int i = 0; i < 2; i++) snprintf(urls[i], sizeof(urls[i]), "https://127.0.0.1:%d/", servers[i].port);
+
+    for (int i = 0; i < requestN; i++) {
+        while (done + 64 < i) usleep(100);
+        get(urls[i % 2], i % 2);
+    }
+
+    TEST_CHECK(test_wait(done, requestN, 20000), "%d of %d done", done.load(), requestN);
+    TEST_CHECK(bad == 0, "%d bad responses", bad.load());
+
+    test_stop(&global);
+    for (auto &server : servers) bench_server_stop(&server);
+    return test_report("read_ahead");
+}
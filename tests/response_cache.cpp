@@ -0,0 +1,73 @@
+// SNOW_RESPONSE_CACHE: fresh responses are served without a request, stale ones revalidated, no-store ones never kept
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl -DSNOW_CONFIG='"tests/response_cache_config.h"' tests/response_cache.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_response_cache && bin/test_response_cache
+
+#include "tests.h"
+
+static snow_global_t global = {};
+
+constexpr size_t bodySize = 5000; // more than one read
+static std::atomic<int> served200 = 0, served304 = 0, done = 0, bad = 0;
+
+// ETag "v1" & max-age=1, on /nostore Cache-Control: no-store
+static void serve(int fd) {
+    std::string req, body(bodySize, 'x');
+    while (test_readRequest(fd, req)) {
+        bool noStore = req.find("GET /nostore") == 0;
+        char head[256];
+        int len;
+        if (!noStore && req.find("If-None-Match: \"v1\"") != std::string::npos) {
+            served304++;
+            len = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\nCache-Control: max-age=1\r\nContent-Length: 0\r\n\r\n");
+            body.clear();
+        } else {
+            served200++;
+            len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nETag: \"v1\"\r\nCache-Control: %s\r\nContent-Length: %zu\r\n\r\n",
+                           noStore ? "no-store" : "public, max-age=1", bodySize);
+            body.assign(bodySize, 'x');
+        }
+        if (!test_writeAll(fd, head, len) || !test_writeAll(fd, body.data(), body.size())) return;
+    }
+}
+
+static snow_handle_t get(const char *url) {
+    return snow_do(&global, GET, url, [](const snow_response_t &r) {
+        if (r.err >= 0 || r.len != bodySize || r.data[0] != 'x' || r.data[bodySize - 1] != 'x') bad++;
+        done++;
+    });
+}
+
+int main() {
+    int port = test_listen(serve);
+    if (!port) return 1;
+
+    test_start(&global);
+
+    char url[64], noStore[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/a", port);
+    snprintf(noStore, sizeof(noStore), "http://127.0.0.1:%d/nostore", port);
+
+    get(url);
+    TEST_CHECK(test_wait(done, 1) && served200 == 1, "first GET not served, %d responses", served200.load());
+
+    // fresh, answered on this thread
+    TEST_CHECK(get(url) == HANDLE_CACHED, "fresh response not served from the cache");
+    TEST_CHECK(done == 2 && served200 == 1, "%d callbacks, %d responses", done.load(), served200.load());
+    TEST_CHECK(test_counter(&global, STAT_CACHE_HITS) == 1, "%lu cache hits", test_counter(&global, STAT_CACHE_HITS));
+
+    // stale, revalidated with the ETag, the 304 delivers the cached body
+    usleep(1100000);
+    TEST_CHECK(get(url) != HANDLE_CACHED, "stale response served from the cache");
+    TEST_CHECK(test_wait(done, 3) && served304 == 1, "not revalidated, %d 304s", served304.load());
+    TEST_CHECK(test_counter(&global, STAT_CACHE_REVALIDATED) == 1, "%lu revalidated", test_counter(&global, STAT_CACHE_REVALIDATED));
+    TEST_CHECK(get(url) == HANDLE_CACHED, "revalidated response not fresh again");
+
+    get(noStore);
+    TEST_CHECK(test_wait(done, 5), "no-store GET not done");
+    TEST_CHECK(get(noStore) != HANDLE_CACHED, "no-store response cached");
+    TEST_CHECK(test_wait(done, 6) && served200 == 3, "%d responses, the no-store ones each need one", served200.load());
+
+    TEST_CHECK(bad == 0, "%d bodies differ", bad.load());
+
+    test_stop(&global);
+    return test_report("response_cache");
+}
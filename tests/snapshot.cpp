@@ -0,0 +1,64 @@
+// snow_saveSnapshot from two threads while the periodic writer runs, then a warm start from the file
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl -DSNOW_CONFIG='"tests/snapshot_config.h"' tests/snapshot.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_snapshot && bin/test_snapshot
+
+#include <dirent.h>
+#include <string>
+#include "tests.h"
+
+static snow_global_t global = {}, restarted = {};
+static std::atomic<int> done = 0, bad = 0;
+
+static void request(snow_global_t *global, const char *url, int n) {
+    for (int i = 0; i < n; i++)
+        snow_do(global, GET, url, [](const snow_response_t &r) {
+            if (r.err >= 0 || r.statusCode != 200) bad++;
+            done++;
+        });
+}
+
+int main() {
+    bench_server_t server;
+    if (!bench_server_start(&server)) return 1;
+
+    char dir[] = "/tmp/snow_snapshot_XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+    std::string path = std::string(dir) + "/snapshot";
+    snapshotPath = path.c_str();
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+
+    test_start(&global);
+    request(&global, url, 10);
+    TEST_CHECK(test_wait(done, 10) && bad == 0, "%d of 10 done, %d bad", done.load(), bad.load());
+
+    constexpr int saves = 200;
+    std::atomic<int> failedSaves = 0;
+    std::thread other([&] {
+        for (int i = 0; i < saves; i++) failedSaves += !snow_saveSnapshot(&global, snapshotPath);
+    });
+    for (int i = 0; i < saves; i++) failedSaves += !snow_saveSnapshot(&global, snapshotPath);
+    other.join();
+    TEST_CHECK(failedSaves == 0, "%d of %d saves failed", failedSaves.load(), 2 * saves);
+
+    test_stop(&global);
+
+    int files = 0;
+    DIR *d = opendir(dir);
+    for (struct dirent *e; (e = readdir(d)) != nullptr;)
+        if (e->d_name[0] != '.') files++;
+    closedir(d);
+    TEST_CHECK(files == 1, "%d files left behind, only the snapshot should be", files);
+
+    done = 0;
+    test_start(&restarted); // loads the snapshot
+    request(&restarted, url, 1);
+    TEST_CHECK(test_wait(done, 1) && bad == 0, "request after the restart failed");
+    TEST_CHECK(test_counter(&restarted, STAT_DNS_MISSES) == 0, "address not restored");
+    test_stop(&restarted);
+
+    unlink(snapshotPath);
+    rmdir(dir);
+    bench_server_stop(&server);
+    return test_report("snapshot");
+}
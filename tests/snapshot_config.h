@@ -0,0 +1,5 @@
+// tests/snapshot.cpp - declarations only, included inside the namespace
+struct snow_config : snow_default_config {
+    static constexpr double snapshotInterval = 0.005; // the helper thread writes all the time
+};
+#define SNOW_SNAPSHOT
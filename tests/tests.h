@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+ * Shared helpers for the tests that run requests through the library against bench/bench_server.h,
+ * run them from the repo root (the tls ones load the wolfSSL certificates from there).
+ * A test includes its SNOW_CONFIG, if any, through the build: -DSNOW_CONFIG='"tests/<name>_config.h"'.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "../lib/snowhttp.h"
+#include "../bench/bench_server.h"
+
+static int testFailed = 0;
+
+// counts & prints a failed check, the test keeps going
+#define TEST_CHECK(cond, ...) do {                                 \
+        if (!(cond)) {                                             \
+            printf("%s:%d: %s: ", __FILE__, __LINE__, #cond);      \
+            printf(__VA_ARGS__);                                   \
+            printf("\n");                                          \
+            testFailed++;                                          \
+        }                                                          \
+    } while (0)
+
+static ev_loop testLoops[multi_loop_max];
+
+// snow_init & the loop threads, global is large, keep it static
+static void test_start(snow_global_t *global, int loopN = 2) {
+    multi_loop_n_runtime = loopN;
+    loopTopologyReport = false;
+    for (int i = 0; i < loopN; i++) {
+        testLoops[i] = {-1, 0, nullptr, nullptr};
+        global->loops[i] = &testLoops[i];
+    }
+    snow_init(global);
+    snow_spawnLoops(global);
+}
+
+static void test_stop(snow_global_t *global) {
+    for (int i = 0; i < multi_loop_n_runtime; i++) testLoops[i].brk = 1;
+    snow_joinLoops(global);
+    snow_destroy(global);
+}
+
+// waits for n to reach want, false after timeoutMs
+static bool test_wait(const std::atomic<int> &n, int want, int timeoutMs = 5000) {
+    for (int t = 0; n.load() < want && t < timeoutMs; t++) usleep(1000);
+    return n.load() >= want;
+}
+
+static uint64_t test_counter(snow_global_t *global, int stat) {
+    snow_stats_t stats;
+    snow_stats(global, &stats);
+    return stats.counters[stat];
+}
+
+// reads up to the end of a request's headers into req, false once the connection is closed
+static bool test_readRequest(int fd, std::string &req) {
+    char buf[4096];
+    req.clear();
+    while (req.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) return false;
+        req.append(buf, n);
+    }
+    return true;
+}
+
+static bool test_writeAll(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Blocking loopback server for the responses bench_server.h does not give (validators, upgrades), serve(fd) runs on
+ * a thread of its own per connection & closes it. Returns the port, 0 on failure. Runs until the test exits.
+ */
+template<class serve_t>
+static int test_listen(serve_t serve) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 512) != 0 ||
+        getsockname(fd, (struct sockaddr *) &addr, &len) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    std::thread([fd, serve] {
+        for (int conn; (conn = accept(fd, nullptr, nullptr)) >= 0;)
+            std::thread([conn, serve] {
+                serve(conn);
+                close(conn);
+            }).detach();
+    }).detach();
+    return ntohs(addr.sin_port);
+}
+
+static int test_report(const char *name) {
+    printf("%s: %d failed\n", name, testFailed);
+    return testFailed != 0;
+}
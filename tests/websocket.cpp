@@ -0,0 +1,134 @@
+// SNOW_WEBSOCKET: upgrade, fragmented & interleaved messages, sends from the loop & other threads, ping, closing handshake
+// g++ -std=c++17 -pthread -I. -Ilib/wolf/wolfssl -DSNOW_CONFIG='"tests/websocket_config.h"' tests/websocket.cpp lib/snowhttp.cpp lib/events.cpp lib/wolf/libwolfssl.a -o bin/test_websocket && bin/test_websocket
+
+#include "tests.h"
+#include "wolfssl/wolfcrypt/hash.h"
+
+static snow_global_t global = {};
+
+constexpr int socketN = 4, messageN = 20;
+static snow_handle_t handles[socketN];
+static std::atomic<int> opened = 0, messages = 0, pongs = 0, closes = 0, errors = 0, refused = 0, bad = 0;
+static std::string big(20000, 'b');
+
+static bool readAll(int fd, char *out, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, out, len);
+        if (n <= 0) return false;
+        out += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void sendFrame(int fd, int opcode, bool fin, const char *payload, size_t len) {
+    char header[wsMaxHeaderSize];
+    char *end = snow_ws_frameHeader(header, opcode, fin, len, nullptr);
+    test_writeAll(fd, header, end - header);
+    test_writeAll(fd, payload, len);
+}
+
+// echoes messages in three fragments with a ping between them, answers pings & the close, /bad gets a wrong accept
+static void serve(int fd) {
+    std::string req;
+    if (!test_readRequest(fd, req)) return;
+
+    size_t at = req.find("Sec-WebSocket-Key: ");
+    if (at == std::string::npos) return;
+    std::string keyGuid = req.substr(at + 19, wsKeySize) + wsGuid;
+    uint8_t digest[WC_SHA_DIGEST_SIZE];
+    char accept[wsAcceptSize + 1];
+    wc_ShaHash((const byte *) keyGuid.data(), keyGuid.size(), digest);
+    snow_base64Encode(digest, sizeof(digest), accept);
+    if (req.find("GET /bad") == 0) accept[0] ^= 1;
+
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+    response += std::string(accept) + "\r\n\r\n";
+    test_writeAll(fd, response.data(), response.size());
+    sendFrame(fd, WS_TEXT, true, "hello", 5);
+
+    std::string payload;
+    for (;;) {
+        uint8_t in[wsMaxHeaderSize];
+        snow_ws_frame_t frame;
+        size_t have = 2;
+        if (!readAll(fd, (char *) in, 2)) return;
+        int ret;
+        while ((ret = snow_ws_parseHeader(in, have, &frame)) == 0) {
+            if (!readAll(fd, (char *) in + have, 1)) return;
+            have++;
+        }
+        if (ret < 0 || !frame.masked) return;
+
+        payload.resize(frame.len);
+        if (!readAll(fd, &payload[0], frame.len)) return;
+        snow_ws_mask(&payload[0], frame.len, frame.mask);
+
+        if (frame.opcode == WS_CLOSE) {
+            sendFrame(fd, WS_CLOSE, true, payload.data(), payload.size());
+            return;
+        } else if (frame.opcode == WS_PING) sendFrame(fd, WS_PONG, true, payload.data(), payload.size());
+        else if (frame.opcode == WS_TEXT || frame.opcode == WS_BINARY) {
+            size_t third = payload.size() / 3;
+            sendFrame(fd, frame.opcode, false, payload.data(), third);
+            sendFrame(fd, WS_PING, true, "x", 1);
+            sendFrame(fd, WS_CONTINUATION, false, payload.data() + third, third);
+            sendFrame(fd, WS_CONTINUATION, true, payload.data() + 2 * third, payload.size() - 2 * third);
+        }
+    }
+}
+
+static void ws_cb(char *data, size_t len, int opcode, void *extra) {
+    int i = (int) (size_t) extra;
+    if (opcode == WS_OPEN) opened++;
+    else if (opcode == WS_PONG) pongs++;
+    else if (opcode == WS_CLOSE) {
+        if (len != 2 || ((uint8_t) data[0] << 8U | (uint8_t) data[1]) != 1000) bad++;
+        closes++;
+    } else if (len == 5 && memcmp(data, "hello", 5) == 0) { // on the loop thread, written right away
+        if (!snow_ws_send(&global, handles[i], big.data(), big.size(), WS_BINARY)) bad++;
+        if (!snow_ws_send(&global, handles[i], "p", 1, WS_PING)) bad++;
+    } else {
+        if (data[len] != 0) bad++;
+        if (opcode == WS_BINARY ? len != big.size() || memcmp(data, big.data(), len) != 0 : len < 4 || memcmp(data, "msg ", 4) != 0) bad++;
+        messages++;
+    }
+}
+
+int main() {
+    int port = test_listen(serve);
+    if (!port) return 1;
+
+    test_start(&global);
+
+    char url[64];
+    snprintf(url, sizeof(url), "ws://127.0.0.1:%d/chat?x=1", port);
+    for (int i = 0; i < socketN; i++) handles[i] = snow_ws_open(&global, url, ws_cb, [](int err, void *extra) { errors++; }, (void *) (size_t) i);
+
+    snprintf(url, sizeof(url), "ws://127.0.0.1:%d/bad", port);
+    snow_ws_open(&global, url, ws_cb, [](int err, void *extra) { refused += err == WEBSOCKET_ERROR; });
+
+    TEST_CHECK(test_wait(opened, socketN), "%d of %d opened", opened.load(), socketN);
+    TEST_CHECK(test_wait(refused, 1), "wrong Sec-WebSocket-Accept taken");
+
+    // from this thread, through the loops' outboxes
+    char message[64];
+    for (int j = 0; j < messageN; j++)
+        for (int i = 0; i < socketN; i++) {
+            int len = snprintf(message, sizeof(message), "msg %d %d", i, j);
+            while (!snow_ws_send(&global, handles[i], message, len)) usleep(100);
+        }
+
+    int expected = socketN * (messageN + 1); // the big one each
+    TEST_CHECK(test_wait(messages, expected), "%d of %d messages", messages.load(), expected);
+    TEST_CHECK(test_wait(pongs, socketN), "%d of %d pongs", pongs.load(), socketN);
+
+    for (int i = 0; i < socketN; i++) snow_ws_close(&global, handles[i]);
+    TEST_CHECK(test_wait(closes, socketN), "%d of %d closed", closes.load(), socketN);
+
+    TEST_CHECK(errors == 0 && bad == 0, "%d errors, %d bad messages", errors.load(), bad.load());
+    TEST_CHECK(test_counter(&global, STAT_WS_OPENED) == socketN, "%lu opened", test_counter(&global, STAT_WS_OPENED));
+
+    test_stop(&global);
+    return test_report("websocket");
+}
@@ -0,0 +1,3 @@
+// tests/websocket.cpp - declarations only, included inside the namespace
+using snow_config = snow_default_config;
+#define SNOW_WEBSOCKET
@@ -0,0 +1,237 @@
+/*
+ * Open-loop load generator on top of snow_enqueue. Requests go out on a fixed schedule whatever the completions,
+ * latency is measured from the intended send time, so time spent behind a full requestQueue, waiting for a free
+ * connection or a late sender is counted (no coordinated omission).
+ *
+ * loadgen --url=http://a.local/ [--url=3@http://b.local/x ...] --rate=1000,20000,50000 --duration=10 --ramp=0
+ *         --loops=2 --hgrm=latency.hgrm --drain=5
+ *
+ * --url      weight@url, repeat for a mix, picked at random by weight
+ * --rate     req/s, a comma separated list runs one step per rate, each --duration seconds
+ * --ramp=1   the rate goes linearly from one step to the next instead of jumping
+ * --hgrm     writes the whole run as an HdrHistogram percentile distribution (ms), for the HdrHistogram plotter
+ * --drain    seconds to wait for the last responses
+ *
+ * Prints one JSON line per step and one for the whole run.
+ */
+
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cmath>
+
+#include "../lib/snowhttp.h"
+#include "../bench/bench.h"
+
+constexpr int maxSteps = 64;
+
+struct target_t {
+    std::string url;
+    int weight;
+};
+
+// one histogram per step per loop thread, histograms have a single writer
+struct thread_hists_t {
+    snow_histogram_t steps[maxSteps];
+};
+
+snow_global_t global = {};
+ev_loop loops[multi_loop_max];
+
+std::vector<uint64_t> intendedNs; // per request
+std::vector<uint8_t> requestStep;
+std::atomic<int> completed = 0;
+std::atomic<int> errors[maxSteps];
+
+std::mutex histsLock;
+std::vector<thread_hists_t *> hists;
+static thread_local thread_hists_t *threadHists = nullptr;
+
+static void record(size_t i) {
+    if (!threadHists) {
+        threadHists = new thread_hists_t();
+        std::lock_guard<std::mutex> lock(histsLock);
+        hists.push_back(threadHists);
+    }
+    snow_histogram_record(&threadHists->steps[requestStep[i]], bench_now_ns() - intendedNs[i]);
+}
+
+void http_cb(char *data, size_t len, void *extra) {
+    record((size_t) extra);
+    completed++;
+}
+
+void err_cb(int err, void *extra) {
+    errors[requestStep[(size_t) extra]]++;
+    completed++;
+}
+
+static void sleep_until(uint64_t ns) {
+    uint64_t now;
+    while ((now = bench_now_ns()) < ns) {
+        if (ns - now > 50000) usleep((ns - now) / 1000 - 20);
+        else std::this_thread::yield();
+    }
+}
+
+static void snapshot(int step, snow_histogram_snapshot_t *out) {
+    snow_histogram_clear(out);
+    snow_histogram_snapshot_t s;
+    std::lock_guard<std::mutex> lock(histsLock);
+    for (thread_hists_t *t : hists) {
+        for (int i = 0; i < maxSteps; i++) {
+            if (step >= 0 && i != step) continue;
+            snow_histogram_snapshot(&t->steps[i], &s);
+            snow_histogram_merge(out, &s);
+        }
+    }
+}
+
+// HdrHistogram outputPercentileDistribution format, one row per non-empty bucket
+static bool write_hgrm(const snow_histogram_snapshot_t *h, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+
+    constexpr double ms = 1e6;
+    double mean = snow_histogram_mean(h), var = 0;
+    uint64_t seen = 0;
+
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (int i = 0; i < histogramBuckets; i++) {
+        if (!h->counts[i]) continue;
+        seen += h->counts[i];
+
+        uint64_t high = i + 1 < histogramBuckets ? snow_histogram_lowest(i + 1) - 1 : UINT64_MAX;
+        double value = (double) std::min(high, h->max);
+        var += h->counts[i] * (value - mean) * (value - mean);
+
+        double p = (double) seen / (double) h->total;
+        if (seen < h->total) fprintf(out, "%12.3f %2.12f %10lu %14.2f\n", value / ms, p, seen, 1 / (1 - p));
+        else fprintf(out, "%12.3f %2.12f %10lu\n", value / ms, 1.0, seen);
+    }
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / ms, h->total ? sqrt(var / h->total) / ms : 0);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12lu]\n", h->max / ms, h->total);
+    fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n", histogramBuckets / histogramSubBuckets, histogramSubBuckets);
+    return fclose(out) == 0;
+}
+
+static void report(const char *name, int step, double rate, int sent, int errorN, double seconds) {
+    snow_histogram_snapshot_t h;
+    snapshot(step, &h);
+    printf("{\"step\":\"%s\",\"rate\":%.0f,\"sent\":%d,\"completed\":%lu,\"errors\":%d,\"rps\":%.0f,\"p50_us\":%.1f,"
+           "\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"mean_us\":%.1f}\n",
+           name, rate, sent, h.total, errorN, h.total / seconds, snow_histogram_percentile(&h, 0.5) / 1e3,
+           snow_histogram_percentile(&h, 0.9) / 1e3, snow_histogram_percentile(&h, 0.99) / 1e3,
+           snow_histogram_percentile(&h, 0.999) / 1e3, snow_histogram_percentile(&h, 1.0) / 1e3, snow_histogram_mean(&h) / 1e3);
+}
+
+int main(int argc, char **argv) {
+    std::vector<target_t> targets;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--url=", 6) != 0) continue;
+        const char *url = argv[i] + 6, *at = strchr(url, '@');
+        int weight = 1;
+        if (at && at < strstr(url, "://")) {
+            weight = atoi(url);
+            url = at + 1;
+        }
+        if (weight > 0) targets.push_back({url, weight});
+    }
+    if (targets.empty()) {
+        fprintf(stderr, "usage: %s --url=[weight@]url ... --rate=r1,r2,... --duration=s [--ramp=1] [--loops=n] [--hgrm=path]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<double> rates;
+    for (const char *it = bench_arg(argc, argv, "--rate", "1000"); *it;) {
+        rates.push_back(strtod(it, (char **) &it));
+        if (*it == ',') it++;
+        else if (*it) break;
+    }
+    assert(!rates.empty() && rates.size() <= maxSteps);
+
+    double duration = bench_arg(argc, argv, "--duration", 10.0);
+    bool ramp = bench_arg(argc, argv, "--ramp", 0L) != 0;
+    double drain = bench_arg(argc, argv, "--drain", 5.0);
+    const char *hgrm = bench_arg(argc, argv, "--hgrm", (const char *) nullptr);
+    multi_loop_n_runtime = (int) bench_arg(argc, argv, "--loops", (long) multi_loop_n_runtime);
+    assert(multi_loop_n_runtime > 0 && multi_loop_n_runtime <= multi_loop_max);
+
+    // the schedule is fixed up front, request i goes out at intendedNs[i] whatever happens to the others
+    std::vector<int> urlIndex;
+    int totalWeight = 0;
+    for (auto &t : targets) totalWeight += t.weight;
+    srand(42);
+
+    uint64_t stepNs = (uint64_t) (duration * 1e9);
+    for (size_t s = 0; s < rates.size(); s++) {
+        double t = 0;
+        while (t < stepNs) {
+            double rate = rates[s];
+            if (ramp && s + 1 < rates.size()) rate += (rates[s + 1] - rates[s]) * t / stepNs;
+            if (rate <= 0) {
+                t += 1e6; // idle step, look again in 1ms
+                continue;
+            }
+
+            intendedNs.push_back(s * stepNs + (uint64_t) t);
+            requestStep.push_back((uint8_t) s);
+
+            int pick = rand() % totalWeight, u = 0;
+            while (pick >= targets[u].weight) pick -= targets[u++].weight;
+            urlIndex.push_back(u);
+
+            t += 1e9 / rate;
+        }
+    }
+
+    loopTopologyReport = false;
+    for (int i = 0; i < multi_loop_n_runtime; i++) {
+        loops[i] = {-1, 0, nullptr, nullptr};
+        global.loops[i] = &loops[i];
+    }
+    snow_init(&global);
+    snow_spawnLoops(&global);
+
+    std::vector<int> sent(rates.size());
+    size_t queueMax = 0;
+    uint64_t begin = bench_now_ns();
+
+    for (size_t i = 0; i < intendedNs.size(); i++) {
+        intendedNs[i] += begin;
+        sleep_until(intendedNs[i]);
+
+        // a full queue stalls the sender, the delay lands on this and every later request
+        while (!snow_enqueue(&global, GET, targets[urlIndex[i]].url.c_str(), http_cb, err_cb, (void *) i))
+            usleep(10);
+        sent[requestStep[i]]++;
+        if ((i & 1023) == 0) queueMax = std::max(queueMax, snow_queueSize(&global));
+    }
+
+    uint64_t drainEnd = bench_now_ns() + (uint64_t) (drain * 1e9);
+    while (completed.load() < (int) intendedNs.size() && bench_now_ns() < drainEnd) usleep(1000);
+    double elapsed = (bench_now_ns() - begin) / 1e9;
+
+    for (int i = 0; i < multi_loop_n_runtime; i++) loops[i].brk = 1;
+    snow_joinLoops(&global);
+
+    int errorN = 0;
+    char name[16];
+    for (size_t s = 0; s < rates.size(); s++) {
+        snprintf(name, sizeof(name), "%zu", s);
+        report(name, (int) s, rates[s], sent[s], errors[s].load(), duration);
+        errorN += errors[s].load();
+    }
+    report("total", -1, intendedNs.size() / (duration * rates.size()), (int) intendedNs.size(), errorN, elapsed);
+    printf("{\"step\":\"queue\",\"queue_max\":%zu,\"unfinished\":%d}\n", queueMax, (int) intendedNs.size() - completed.load());
+
+    if (hgrm) {
+        snow_histogram_snapshot_t h;
+        snapshot(-1, &h);
+        if (!write_hgrm(&h, hgrm)) fprintf(stderr, "could not write %s\n", hgrm);
+    }
+
+    snow_destroy(&global);
+    return 0;
+}
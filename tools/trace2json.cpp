@@ -0,0 +1,102 @@
+/*
+ * Converts trace rings written by snow_traceSave to Chrome trace / Perfetto JSON.
+ *
+ * trace2json loop0.trace loop1.trace ... > trace.json
+ *
+ * Every file becomes one thread (tid = loop), timestamps are CLOCK_MONOTONIC.
+ */
+
+#define SNOW_TRACE
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../lib/events.h"
+#include "../lib/trace.h"
+
+// conn_status_enum, in order
+static const char *statusNames[] = {
+        "CONN_UNREADY", "CONN_IN_PROGRESS", "CONN_ACK", "CONN_TLS_HANDSHAKE", "CONN_READY", "CONN_WAITING", "CONN_RECEIVING", "CONN_DONE"
+};
+
+static bool first = true;
+
+static void emit(const char *name, const char *ph, double ts, int loop, const char *args) {
+    printf("%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d%s%s%s}", first ? "" : ",", name, ph, ts, loop,
+           *ph == 'i' ? ",\"s\":\"t\"" : "", *args ? ",\"args\":" : "", args);
+    first = false;
+}
+
+static bool convert(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) return false;
+
+    snow_trace_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "SNOWTRC1", 8) != 0) {
+        fclose(in);
+        return false;
+    }
+
+    std::vector<snow_trace_event_t> events(header.count);
+    size_t n = fread(events.data(), sizeof(snow_trace_event_t), header.count, in);
+    fclose(in);
+
+    int loop = header.loop;
+    char args[128];
+
+    printf("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"loop %d\"}}", first ? "" : ",", loop, loop);
+    first = false;
+
+    for (size_t i = 0; i < n; i++) {
+        const snow_trace_event_t &e = events[i];
+        double ts = ((double) header.nsBase + (double) (int64_t) (e.tick - header.tickBase) / header.ticksPerNs) / 1000.0;
+
+        switch (e.type) {
+            case TRACE_EPOLL:
+                snprintf(args, sizeof(args), "{\"events\":%u}", e.arg);
+                emit("epoll", "i", ts, loop, args);
+                break;
+            case TRACE_IO_BEGIN:
+            case TRACE_IO_END:
+                snprintf(args, sizeof(args), "{\"fd\":%u}", e.id);
+                emit(e.arg == EV_READ ? "io read" : "io write", e.type == TRACE_IO_BEGIN ? "B" : "E", ts, loop, args);
+                break;
+            case TRACE_TIMER_BEGIN:
+            case TRACE_TIMER_END:
+                emit("timer", e.type == TRACE_TIMER_BEGIN ? "B" : "E", ts, loop, "");
+                break;
+            case TRACE_READ:
+            case TRACE_WRITE:
+                snprintf(args, sizeof(args), "{\"conn\":%u,\"bytes\":%u}", e.id, e.arg);
+                emit(e.type == TRACE_READ ? "read" : "write", "i", ts, loop, args);
+                break;
+            case TRACE_TLS_WANT_READ:
+            case TRACE_TLS_WANT_WRITE:
+                snprintf(args, sizeof(args), "{\"conn\":%u}", e.id);
+                emit(e.type == TRACE_TLS_WANT_READ ? "tls want read" : "tls want write", "i", ts, loop, args);
+                break;
+            case TRACE_STATUS:
+                snprintf(args, sizeof(args), "{\"conn\":%u}", e.id);
+                emit(e.arg < sizeof(statusNames) / sizeof(*statusNames) ? statusNames[e.arg] : "status", "i", ts, loop, args);
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s loop0.trace [loop1.trace ...] > trace.json\n", argv[0]);
+        return 1;
+    }
+
+    printf("{\"traceEvents\":[");
+    for (int i = 1; i < argc; i++)
+        if (!convert(argv[i])) fprintf(stderr, "could not read %s\n", argv[i]);
+    printf("\n]}\n");
+
+    return 0;
+}